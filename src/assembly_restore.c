@@ -8,6 +8,7 @@
 #include "jcr.h"
 #include "recipe/recipestore.h"
 #include "storage/containerstore.h"
+#include "storage/readahead.h"
 #include "restore.h"
 
 struct {
@@ -22,6 +23,21 @@ static void init_assembly_area() {
 	assembly_area.area_size = (destor.restore_cache[1] - 1) * CONTAINER_SIZE;
 }
 
+/*
+ * Submit the containers of the area in the order they will be read,
+ * i.e., the order of their first chunks not ready.
+ */
+static void assembly_area_readahead() {
+	GSequenceIter *iter = g_sequence_get_begin_iter(assembly_area.area);
+	GSequenceIter *end = g_sequence_get_end_iter(assembly_area.area);
+	for (; iter != end; iter = g_sequence_iter_next(iter)) {
+		struct chunk *c = g_sequence_get(iter);
+		if (!CHECK_CHUNK(c, CHUNK_FILE_START) && !CHECK_CHUNK(c, CHUNK_FILE_END)
+				&& !CHECK_CHUNK(c, CHUNK_READY) && !readahead_submit(c->id, 0))
+			break;
+	}
+}
+
 /*
  * Forward assembly.
  * Return a queue of assembled chunks.
@@ -57,8 +73,11 @@ static GQueue* assemble_area() {
 	struct container *con = NULL;
 	jcr.read_container_num++;
 	VERBOSE("Restore cache: container %lld is missed", id);
-	if (destor.simulation_level == SIMULATION_NO)
-		con = retrieve_container_by_id(id);
+	if (destor.simulation_level == SIMULATION_NO) {
+		/* The next containers are read while this one is assembled. */
+		assembly_area_readahead();
+		con = readahead_take(id, 0);
+	}
 
 	/* assemble the area */
 	GSequenceIter *iter = g_sequence_get_begin_iter(assembly_area.area);
@@ -70,7 +89,7 @@ static GQueue* assemble_area() {
 			if (destor.simulation_level == SIMULATION_NO) {
 				struct chunk *buf = get_chunk_in_container(con, &c->fp);
 				assert(c->size == buf->size);
-				c->data = malloc(c->size);
+				c->data = slab_alloc(c->size);
 				memcpy(c->data, buf->data, c->size);
 				free_chunk(buf);
 			}
@@ -10,6 +10,7 @@
 
 #include "destor.h"
 #include "utils/sync_queue.h"
+#include "utils/spsc_ring.h"
 
 /*
  * CHUNK_FILE_START NORMAL_CHUNK... CHUNK_FILE_END
@@ -56,17 +57,21 @@ void stop_filter_phase();
 void start_append_phase();
 void stop_append_phase();
 
+/*
+ * Each queue between the phases has exactly one producer thread
+ * and one consumer thread, so they are lock-free SPSC rings.
+ */
 /* Output of read phase. */
-SyncQueue* read_queue;
+SpscRing* read_queue;
 /* Output of chunk phase. */
-SyncQueue* chunk_queue;
+SpscRing* chunk_queue;
 /* Output of hash phase. */
-SyncQueue* hash_queue;
+SpscRing* hash_queue;
 /* Output of trace phase. */
-SyncQueue* trace_queue;
+SpscRing* trace_queue;
 /* Output of dedup phase */
-SyncQueue* dedup_queue;
+SpscRing* dedup_queue;
 /* Output of rewrite phase. */
-SyncQueue* rewrite_queue;
+SpscRing* rewrite_queue;
 
 #endif /* BACKUP_H_ */
@@ -45,7 +45,7 @@ void *cap_rewrite(void* arg) {
 	top = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free);
 
 	while (1) {
-		struct chunk *c = sync_queue_pop(dedup_queue);
+		struct chunk *c = spsc_ring_pop(dedup_queue);
 
 		if (c == NULL)
 			break;
@@ -71,7 +71,7 @@ void *cap_rewrite(void* arg) {
 				chunk_num++;
 			}
 			TIMER_END(1, jcr.rewrite_time);
-			sync_queue_push(rewrite_queue, c);
+			spsc_ring_push(rewrite_queue, c);
 			TIMER_BEGIN(1);
 		}
 
@@ -93,12 +93,12 @@ void *cap_rewrite(void* arg) {
 			}
 			chunk_num++;
 		}
-		sync_queue_push(rewrite_queue, c);
+		spsc_ring_push(rewrite_queue, c);
 	}
 
 	g_hash_table_remove_all(top);
 
-	sync_queue_term(rewrite_queue);
+	spsc_ring_term(rewrite_queue);
 
 	return NULL;
 }
@@ -77,7 +77,7 @@ void *cbr_rewrite(void* arg) {
 
 	/* content-based rewrite*/
 	while (1) {
-		struct chunk *c = sync_queue_pop(dedup_queue);
+		struct chunk *c = spsc_ring_pop(dedup_queue);
 		if (c == NULL)
 			break;
 
@@ -97,7 +97,7 @@ void *cbr_rewrite(void* arg) {
 				|| CHECK_CHUNK(decision_chunk, CHUNK_SEGMENT_END)) {
 			rewrite_buffer_pop();
 			TIMER_END(1, jcr.rewrite_time);
-			sync_queue_push(rewrite_queue, decision_chunk);
+			spsc_ring_push(rewrite_queue, decision_chunk);
 			TIMER_BEGIN(1);
 			decision_chunk = rewrite_buffer_top();
 		}
@@ -137,14 +137,14 @@ void *cbr_rewrite(void* arg) {
 
 		rewrite_buffer_pop();
 		TIMER_END(1, jcr.rewrite_time);
-		sync_queue_push(rewrite_queue, decision_chunk);
+		spsc_ring_push(rewrite_queue, decision_chunk);
 	}
 
 	/* process the remaining chunks in stream context */
 	struct chunk *remaining_chunk = NULL;
 	while ((remaining_chunk = rewrite_buffer_pop()))
-		sync_queue_push(rewrite_queue, remaining_chunk);
-	sync_queue_term(rewrite_queue);
+		spsc_ring_push(rewrite_queue, remaining_chunk);
+	spsc_ring_term(rewrite_queue);
 
 	return NULL;
 }
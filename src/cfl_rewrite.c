@@ -25,7 +25,7 @@ void *cfl_rewrite(void* arg) {
 	containerid last_id = TEMPORARY_ID;
 	int buffer_full = 0;
 	while (1) {
-		struct chunk* c = sync_queue_pop(dedup_queue);
+		struct chunk* c = spsc_ring_pop(dedup_queue);
 		if (c == NULL) {
 			/* The end */
 			break;
@@ -42,7 +42,7 @@ void *cfl_rewrite(void* arg) {
 				if (CHECK_CHUNK(bc,	CHUNK_FILE_START) || CHECK_CHUNK(bc, CHUNK_FILE_END)
 						|| CHECK_CHUNK(bc, CHUNK_SEGMENT_START)
 						|| CHECK_CHUNK(bc, CHUNK_SEGMENT_END)) {
-					sync_queue_push(rewrite_queue, bc);
+					spsc_ring_push(rewrite_queue, bc);
 					continue;
 				}
 
@@ -54,7 +54,7 @@ void *cfl_rewrite(void* arg) {
 							chunk_num, bc->id);
 				}
 				chunk_num++;
-				sync_queue_push(rewrite_queue, bc);
+				spsc_ring_push(rewrite_queue, bc);
 			}
 			buffer_full = 0;
 		}
@@ -73,7 +73,7 @@ void *cfl_rewrite(void* arg) {
 		if (CHECK_CHUNK(bc,	CHUNK_FILE_START) || CHECK_CHUNK(bc, CHUNK_FILE_END)
 				|| CHECK_CHUNK(bc, CHUNK_SEGMENT_START)
 				|| CHECK_CHUNK(bc, CHUNK_SEGMENT_END)) {
-			sync_queue_push(rewrite_queue, bc);
+			spsc_ring_push(rewrite_queue, bc);
 			continue;
 		}
 
@@ -84,10 +84,10 @@ void *cfl_rewrite(void* arg) {
 					chunk_num, bc->id);
 		}
 		chunk_num++;
-		sync_queue_push(rewrite_queue, bc);
+		spsc_ring_push(rewrite_queue, bc);
 	}
 	buffer_full = 0;
 
-	sync_queue_term(rewrite_queue);
+	spsc_ring_term(rewrite_queue);
 	return NULL;
 }
@@ -5,7 +5,6 @@
 #include "storage/containerstore.h"
 
 static pthread_t chunk_t;
-static int64_t chunk_num;
 
 static int (*chunking)(unsigned char* buf, int size);
 
@@ -13,104 +12,181 @@ static inline int fixed_chunk_data(unsigned char* buf, int size){
 	return destor.chunk_avg_size > size ? size : destor.chunk_avg_size;
 }
 
+/*
+ * With chunk-thread-num > 1,
+ * a dispatcher deals whole files round-robin to the workers,
+ * and a collector pops them back file by file in the same order,
+ * so chunk_queue is the same as the single-threaded output.
+ */
+struct chunkWorker {
+	pthread_t tid;
+	SpscRing *input;
+	SpscRing *output;
+	int64_t chunk_num;
+	/* Accumulated locally to avoid racing on jcr. */
+	double chunk_time;
+	int64_t zero_chunk_num;
+	int64_t zero_chunk_size;
+};
+
+static struct chunkWorker *workers;
+static pthread_t dispatch_t;
+
+/*
+ * The file is a series of read buffers (see read_phase.c),
+ * so chunks are cut in place as views into them.
+ * The tail of a block, shorter than a chunk, is moved in front of the next,
+ * so a chunk spanning blocks is still a view.
+ * c is the first view of the file. Return the CHUNK_FILE_END.
+ */
+static struct chunk* chunk_in_place(struct chunkWorker *w, struct chunk *c,
+		unsigned char *zeros) {
+	struct readBuffer *rb = c->buf;
+	unsigned char *base = c->data;
+	int64_t end = c->size;
+	int64_t off = 0;
+
+	/* hold the buffer while the views from read phase are freed */
+	read_buffer_ref(rb);
+	free_chunk(c);
+	c = NULL;
+
+	while (1) {
+		/* c == NULL indicates more data for this file can be read. */
+		while (end - off < destor.chunk_max_size && c == NULL) {
+			c = spsc_ring_pop(w->input);
+			if (CHECK_CHUNK(c, CHUNK_FILE_END))
+				break;
+			if (c->buf != rb) {
+				/* The next block. */
+				int64_t left = end - off;
+				assert(c->data == c->buf->data && left <= c->buf->headroom);
+				memcpy(c->buf->data - left, base + off, left);
+				read_buffer_ref(c->buf);
+				read_buffer_unref(rb);
+				rb = c->buf;
+				base = rb->data - left;
+				off = 0;
+				end = left;
+			}
+			assert(c->data == base + end);
+			end += c->size;
+			free_chunk(c);
+			c = NULL;
+		}
+
+		if (end == off) {
+			assert(c);
+			break;
+		}
+
+		int leftlen = end - off > destor.chunk_max_size ?
+				destor.chunk_max_size : end - off;
+
+		TIMER_DECLARE(1);
+		TIMER_BEGIN(1);
+
+		int chunk_size = chunking(base + off, leftlen);
+
+		TIMER_END(1, w->chunk_time);
+
+		struct chunk *nc = new_chunk_view(rb, base + off, chunk_size);
+		off += chunk_size;
+
+		if (memcmp(zeros, nc->data, chunk_size) == 0) {
+			VERBOSE("Chunk phase: %ldth chunk  of %d zero bytes",
+					w->chunk_num++, chunk_size);
+			w->zero_chunk_num++;
+			w->zero_chunk_size += chunk_size;
+		} else
+			VERBOSE("Chunk phase: %ldth chunk of %d bytes", w->chunk_num++,
+					chunk_size);
+
+		spsc_ring_push(w->output, nc);
+	}
+
+	read_buffer_unref(rb);
+	return c;
+}
+
 /*
  * chunk-level deduplication.
- * Destor currently supports fixed-sized chunking and (normalized) rabin-based chunking.
+ * Destor currently supports fixed-sized chunking, (normalized) rabin-based chunking,
+ * TTTD, AE and FastCDC.
  */
 static void* chunk_thread(void *arg) {
-	int leftlen = 0;
-	int leftoff = 0;
-	unsigned char *leftbuf = malloc(DEFAULT_BLOCK_SIZE + destor.chunk_max_size);
+	struct chunkWorker *w = arg;
 
 	unsigned char *zeros = malloc(destor.chunk_max_size);
 	bzero(zeros, destor.chunk_max_size);
-	unsigned char *data = malloc(destor.chunk_max_size);
 
 	struct chunk* c = NULL;
 
 	while (1) {
 
 		/* Try to receive a CHUNK_FILE_START. */
-		c = sync_queue_pop(read_queue);
+		c = spsc_ring_pop(w->input);
 
 		if (c == NULL) {
-			sync_queue_term(chunk_queue);
+			spsc_ring_term(w->output);
 			break;
 		}
 
 		assert(CHECK_CHUNK(c, CHUNK_FILE_START));
-		sync_queue_push(chunk_queue, c);
-
-		/* Try to receive normal chunks. */
-		c = sync_queue_pop(read_queue);
-		if (!CHECK_CHUNK(c, CHUNK_FILE_END)) {
-			memcpy(leftbuf, c->data, c->size);
-			leftlen += c->size;
-			free_chunk(c);
-			c = NULL;
-		}
+		spsc_ring_push(w->output, c);
 
-		while (1) {
-			/* c == NULL indicates more data for this file can be read. */
-			while ((leftlen < destor.chunk_max_size) && c == NULL) {
-				c = sync_queue_pop(read_queue);
-				if (!CHECK_CHUNK(c, CHUNK_FILE_END)) {
-					memmove(leftbuf, leftbuf + leftoff, leftlen);
-					leftoff = 0;
-					memcpy(leftbuf + leftlen, c->data, c->size);
-					leftlen += c->size;
-					free_chunk(c);
-					c = NULL;
-				}
-			}
-
-			if (leftlen == 0) {
-				assert(c);
-				break;
-			}
+		/* Try to receive normal chunks, or the CHUNK_FILE_END of an empty file. */
+		c = spsc_ring_pop(w->input);
+		if (!CHECK_CHUNK(c, CHUNK_FILE_END))
+			c = chunk_in_place(w, c, zeros);
+		spsc_ring_push(w->output, c);
+	}
 
-			TIMER_DECLARE(1);
-			TIMER_BEGIN(1);
+	free(zeros);
+	return NULL;
+}
 
-			int	chunk_size = chunking(leftbuf + leftoff, leftlen);
+static void* chunk_dispatch_thread(void *arg) {
+	int next = 0;
+	while (1) {
+		struct chunk* c = spsc_ring_pop(read_queue);
 
-			TIMER_END(1, jcr.chunk_time);
+		if (c == NULL) {
+			int i;
+			for (i = 0; i < destor.chunk_thread_num; i++)
+				spsc_ring_term(workers[i].input);
+			break;
+		}
 
-			struct chunk *nc = new_chunk(chunk_size);
-			memcpy(nc->data, leftbuf + leftoff, chunk_size);
-			leftlen -= chunk_size;
-			leftoff += chunk_size;
+		spsc_ring_push(workers[next].input, c);
+		if (CHECK_CHUNK(c, CHUNK_FILE_END))
+			next = (next + 1) % destor.chunk_thread_num;
+	}
+	return NULL;
+}
 
-			if (memcmp(zeros, nc->data, chunk_size) == 0) {
-				VERBOSE("Chunk phase: %ldth chunk  of %d zero bytes",
-						chunk_num++, chunk_size);
-				jcr.zero_chunk_num++;
-				jcr.zero_chunk_size += chunk_size;
-			} else
-				VERBOSE("Chunk phase: %ldth chunk of %d bytes", chunk_num++,
-						chunk_size);
+/*
+ * Collect files in the order they were dispatched.
+ * The first terminated worker in turn indicates the end of the stream.
+ */
+static void* chunk_collect_thread(void *arg) {
+	int next = 0;
+	while (1) {
+		struct chunk* c = spsc_ring_pop(workers[next].output);
 
-			sync_queue_push(chunk_queue, nc);
+		if (c == NULL) {
+			spsc_ring_term(chunk_queue);
+			break;
 		}
 
-		sync_queue_push(chunk_queue, c);
-		leftoff = 0;
-		c = NULL;
-
-		if(destor.chunk_algorithm == CHUNK_RABIN ||
-				destor.chunk_algorithm == CHUNK_NORMALIZED_RABIN)
-			windows_reset();
+		if (CHECK_CHUNK(c, CHUNK_FILE_END))
+			next = (next + 1) % destor.chunk_thread_num;
 
+		spsc_ring_push(chunk_queue, c);
 	}
-
-	free(leftbuf);
-	free(zeros);
-	free(data);
 	return NULL;
 }
 
-
-
 void start_chunk_phase() {
 
 	if (destor.chunk_algorithm == CHUNK_RABIN){
@@ -152,6 +228,26 @@ void start_chunk_phase() {
 
 		chunkAlg_init();
 		chunking = tttd_chunk_data;
+	}else if(destor.chunk_algorithm == CHUNK_FASTCDC){
+		int pwr;
+		for (pwr = 0; destor.chunk_avg_size; pwr++) {
+			destor.chunk_avg_size >>= 1;
+		}
+		destor.chunk_avg_size = 1 << (pwr - 1);
+
+		assert(destor.chunk_avg_size >= destor.chunk_min_size);
+		assert(destor.chunk_avg_size <= destor.chunk_max_size);
+		assert(destor.chunk_max_size <= CONTAINER_SIZE - CONTAINER_META_SIZE);
+
+		fastcdc_init();
+		chunking = fastcdc_chunk_data;
+	}else if(destor.chunk_algorithm == CHUNK_AE){
+		assert(destor.chunk_avg_size >= destor.chunk_min_size);
+		assert(destor.chunk_avg_size <= destor.chunk_max_size);
+		assert(destor.chunk_max_size <= CONTAINER_SIZE - CONTAINER_META_SIZE);
+
+		ae_init();
+		chunking = ae_chunk_data;
 	}else if(destor.chunk_algorithm == CHUNK_FIXED){
 		assert(destor.chunk_avg_size <= CONTAINER_SIZE - CONTAINER_META_SIZE);
 
@@ -173,11 +269,50 @@ void start_chunk_phase() {
 		exit(1);
 	}
 
-	chunk_queue = sync_queue_new(100);
-	pthread_create(&chunk_t, NULL, chunk_thread, NULL);
+	chunk_queue = spsc_ring_new(100);
+
+	int num = destor.chunk_thread_num > 1 ? destor.chunk_thread_num : 1;
+	workers = calloc(num, sizeof(struct chunkWorker));
+
+	if (num == 1) {
+		workers[0].input = read_queue;
+		workers[0].output = chunk_queue;
+		pthread_create(&chunk_t, NULL, chunk_thread, &workers[0]);
+		return;
+	}
+
+	int i;
+	for (i = 0; i < num; i++) {
+		workers[i].input = spsc_ring_new(100);
+		workers[i].output = spsc_ring_new(1000);
+		pthread_create(&workers[i].tid, NULL, chunk_thread, &workers[i]);
+	}
+	pthread_create(&dispatch_t, NULL, chunk_dispatch_thread, NULL);
+	pthread_create(&chunk_t, NULL, chunk_collect_thread, NULL);
 }
 
 void stop_chunk_phase() {
 	pthread_join(chunk_t, NULL);
+
+	int num = destor.chunk_thread_num > 1 ? destor.chunk_thread_num : 1;
+	int i;
+	double chunk_time = 0;
+	if (num > 1)
+		pthread_join(dispatch_t, NULL);
+	for (i = 0; i < num; i++) {
+		if (num > 1) {
+			pthread_join(workers[i].tid, NULL);
+			spsc_ring_free(workers[i].input, NULL);
+			spsc_ring_free(workers[i].output, NULL);
+		}
+		chunk_time += workers[i].chunk_time;
+		jcr.zero_chunk_num += workers[i].zero_chunk_num;
+		jcr.zero_chunk_size += workers[i].zero_chunk_size;
+	}
+	/* wall-clock estimate of the parallel chunking */
+	jcr.chunk_time += chunk_time / num;
+	free(workers);
+	workers = NULL;
+
 	NOTICE("chunk phase stops successfully!");
 }
@@ -0,0 +1,655 @@
+/*
+ * chunk_restore.c
+ *
+ *  Restore with a chunk-level cache and a look-ahead window.
+ *  The window buffers the next recipe chunks.
+ *  Its head, up to the size of the assembly area, is assembled
+ *  from each container read, as in forward assembly.
+ *  The other chunks of the container referenced later in the window
+ *  are kept in the chunk cache, and evicted by their next references,
+ *  as in OPT but at chunk granularity.
+ *
+ *  In the adaptive (ALACC) mode, recently read containers are also cached,
+ *  and the memory is moved among the assembly area, the chunk cache
+ *  and the container cache, to the one whose growth would have saved
+ *  the most container reads recently.
+ */
+#include "destor.h"
+#include "jcr.h"
+#include "recipe/recipestore.h"
+#include "storage/containerstore.h"
+#include "storage/readahead.h"
+#include "restore.h"
+#include "utils/lru_cache.h"
+
+/* How many chunks after the head are checked for reading ahead. */
+#define CHUNK_RESTORE_READAHEAD 4096
+/* How many container reads between two adaptations. */
+#define ALACC_ADAPT_INTERVAL 64
+
+/* A fingerprint referenced in the window. */
+struct chunkRef {
+	fingerprint fp;
+	int32_t size;
+	/* its first and last positions in the window */
+	int64_t first;
+	int64_t last;
+	/* its first position not assembled yet, or -1 */
+	int64_t next;
+	/* the cached copy, or NULL */
+	struct chunk *cached;
+	GSequenceIter *iter;
+	/* in the ghost of the cache, or NULL */
+	GSequenceIter *ghost;
+};
+
+static struct {
+	/* A ring of recipe chunks, from position head to tail. */
+	struct chunk **chunks;
+	/* the next position of the same fingerprint, or -1 */
+	int64_t *next;
+	int64_t size;
+	int64_t head;
+	int64_t tail;
+	int end;
+
+	/* fingerprint -> struct chunkRef */
+	GHashTable *refs;
+
+	/* The assembly area, from head to area_end. */
+	int64_t area_end;
+	int64_t area_bytes;
+	int64_t area_size;
+
+	/* Cached refs, in ascending order of their next positions. */
+	GSequence *cache;
+	int64_t cache_bytes;
+	int64_t cache_size;
+} window;
+
+/* The state of the adaptive mode. */
+static struct {
+	int enabled;
+
+	/* recently read containers */
+	struct lruCache *containers;
+	/* the container last evicted from the cache */
+	containerid last_evicted;
+
+	/* container id -> struct lastRead */
+	GHashTable *last_reads;
+	/*
+	 * The refs the chunk cache dropped while still referenced,
+	 * that one more unit would have kept, by their next positions.
+	 */
+	GSequence *ghost;
+	int64_t ghost_bytes;
+
+	/* the reads each component would have saved with one more unit */
+	double area_misses;
+	double chunk_misses;
+	double container_misses;
+	int reads;
+
+	/* the memory of each component, in containers */
+	int area_units;
+	int cache_units;
+	int container_units;
+} alacc;
+
+/* The window when a container was last read. */
+struct lastRead {
+	containerid id;
+	int64_t area_end;
+	int64_t tail;
+};
+
+#define WINDOW_CHUNK(pos) (window.chunks[(pos) % window.size])
+#define WINDOW_NEXT(pos) (window.next[(pos) % window.size])
+
+static int is_signal_chunk(struct chunk *c) {
+	return CHECK_CHUNK(c, CHUNK_FILE_START) || CHECK_CHUNK(c, CHUNK_FILE_END);
+}
+
+static gint g_chunk_ref_cmp_by_next(struct chunkRef *a, struct chunkRef *b,
+		gpointer data) {
+	if (a->next == b->next)
+		return 0;
+	return a->next < b->next ? -1 : 1;
+}
+
+static void free_chunk_ref(struct chunkRef *r) {
+	assert(r->cached == NULL);
+	free(r);
+}
+
+static void init_window(int adaptive) {
+	window.size = destor.restore_opt_window_size;
+	window.chunks = malloc(sizeof(struct chunk*) * window.size);
+	window.next = malloc(sizeof(int64_t) * window.size);
+	window.head = 0;
+	window.tail = 0;
+	window.end = 0;
+
+	window.refs = g_hash_table_new_full(g_int_hash,
+			(GEqualFunc) g_fingerprint_equal, NULL, (GDestroyNotify) free_chunk_ref);
+
+	/* A container is reserved for reading. */
+	int64_t memory = (destor.restore_cache[1] - 1) * CONTAINER_SIZE;
+	window.area_size = destor.restore_asm_area_size * CONTAINER_SIZE;
+	if (window.area_size > memory)
+		window.area_size = memory;
+	window.area_end = 0;
+	window.area_bytes = 0;
+
+	window.cache = g_sequence_new(NULL);
+	window.cache_bytes = 0;
+	window.cache_size = memory - window.area_size;
+
+	alacc.enabled = adaptive;
+	if (!adaptive)
+		return;
+
+	/* Start with an even split. */
+	int units = destor.restore_cache[1] > 1 ? destor.restore_cache[1] - 1 : 0;
+	alacc.area_units = units / 3;
+	alacc.container_units = units / 3;
+	alacc.cache_units = units - alacc.area_units - alacc.container_units;
+	window.area_size = alacc.area_units * CONTAINER_SIZE;
+	window.cache_size = alacc.cache_units * CONTAINER_SIZE;
+
+	if (destor.simulation_level == SIMULATION_NO)
+		alacc.containers = new_lru_cache(alacc.container_units,
+				(void*) free_container, (void*) container_check_id);
+	else
+		alacc.containers = new_lru_cache(alacc.container_units,
+				(void*) free_container_meta, (void*) container_meta_check_id);
+	alacc.last_evicted = TEMPORARY_ID;
+
+	alacc.last_reads = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+			NULL, free);
+	alacc.ghost = g_sequence_new(NULL);
+	alacc.ghost_bytes = 0;
+
+	alacc.area_misses = 0;
+	alacc.chunk_misses = 0;
+	alacc.container_misses = 0;
+	alacc.reads = 0;
+}
+
+static void close_window() {
+	assert(window.head == window.tail);
+	assert(g_sequence_get_length(window.cache) == 0);
+	g_sequence_free(window.cache);
+	g_hash_table_destroy(window.refs);
+	free(window.chunks);
+	free(window.next);
+
+	if (alacc.enabled) {
+		destor_log(DESTOR_NOTICE,
+				"restore memory: area %d, chunk cache %d, container cache %d",
+				alacc.area_units, alacc.cache_units, alacc.container_units);
+		free_lru_cache(alacc.containers);
+		assert(g_sequence_get_length(alacc.ghost) == 0);
+		g_sequence_free(alacc.ghost);
+		g_hash_table_destroy(alacc.last_reads);
+	}
+}
+
+static void uncache_chunk_ref(struct chunkRef *r) {
+	g_sequence_remove(r->iter);
+	window.cache_bytes -= r->cached->size;
+	r->cached = NULL;
+	r->iter = NULL;
+}
+
+static void unghost_chunk_ref(struct chunkRef *r) {
+	g_sequence_remove(r->ghost);
+	alacc.ghost_bytes -= r->size;
+	r->ghost = NULL;
+}
+
+/* Remember r dropped by the cache, if one more unit would have kept it. */
+static void ghost_chunk_ref(struct chunkRef *r) {
+	if (!alacc.enabled)
+		return;
+
+	r->ghost = g_sequence_insert_sorted(alacc.ghost, r,
+			(GCompareDataFunc) g_chunk_ref_cmp_by_next, NULL);
+	alacc.ghost_bytes += r->size;
+	while (alacc.ghost_bytes > CONTAINER_SIZE)
+		unghost_chunk_ref(g_sequence_get(g_sequence_iter_prev(
+				g_sequence_get_end_iter(alacc.ghost))));
+}
+
+/* Drop r from the cache while it is still referenced. */
+static void evict_chunk_ref(struct chunkRef *r) {
+	struct chunk *c = r->cached;
+	uncache_chunk_ref(r);
+	free_chunk(c);
+	ghost_chunk_ref(r);
+}
+
+/*
+ * Set the next position of r to the first one not assembled from pos on.
+ * Its cached copy is dropped if no longer needed.
+ */
+static void update_next(struct chunkRef *r, int64_t pos) {
+	while (pos != -1 && CHECK_CHUNK(WINDOW_CHUNK(pos), CHUNK_READY))
+		pos = WINDOW_NEXT(pos);
+	r->next = pos;
+
+	if (r->ghost) {
+		if (r->next == -1)
+			unghost_chunk_ref(r);
+		else
+			g_sequence_sort_changed(r->ghost,
+					(GCompareDataFunc) g_chunk_ref_cmp_by_next, NULL);
+	}
+
+	if (r->cached) {
+		if (r->next == -1) {
+			struct chunk *c = r->cached;
+			uncache_chunk_ref(r);
+			free_chunk(c);
+		} else {
+			g_sequence_sort_changed(r->iter,
+					(GCompareDataFunc) g_chunk_ref_cmp_by_next, NULL);
+		}
+	}
+}
+
+/*
+ * Extend the assembly area over the window,
+ * which always covers the head.
+ */
+static void extend_area() {
+	if (window.area_end < window.head)
+		window.area_end = window.head;
+
+	while (window.area_end < window.tail) {
+		struct chunk *c = WINDOW_CHUNK(window.area_end);
+		int32_t size = is_signal_chunk(c) ? 0 : c->size;
+		if (window.area_end > window.head
+				&& window.area_bytes + size > window.area_size)
+			break;
+		window.area_bytes += size;
+		window.area_end++;
+	}
+}
+
+static void fill_window() {
+	while (!window.end && window.tail - window.head < window.size) {
+		struct chunk *c = sync_queue_pop(restore_recipe_queue);
+		if (!c) {
+			window.end = 1;
+			break;
+		}
+
+		int64_t pos = window.tail++;
+		WINDOW_CHUNK(pos) = c;
+		WINDOW_NEXT(pos) = -1;
+		if (is_signal_chunk(c))
+			continue;
+
+		struct chunkRef *r = g_hash_table_lookup(window.refs, &c->fp);
+		if (!r) {
+			r = malloc(sizeof(struct chunkRef));
+			memcpy(&r->fp, &c->fp, sizeof(fingerprint));
+			r->size = c->size;
+			r->first = pos;
+			r->next = pos;
+			r->cached = NULL;
+			r->iter = NULL;
+			r->ghost = NULL;
+			g_hash_table_insert(window.refs, &r->fp, r);
+		} else {
+			WINDOW_NEXT(r->last) = pos;
+			if (r->first == -1)
+				r->first = pos;
+			if (r->next == -1)
+				r->next = pos;
+		}
+		r->last = pos;
+	}
+	extend_area();
+}
+
+/*
+ * Cache the chunk of r, taking buf if not NULL or reading it in con,
+ * and evicting the cached chunks referenced after it.
+ * Return 1 if cached.
+ */
+static int cache_chunk(struct chunkRef *r, struct container *con,
+		struct chunk *buf) {
+	int32_t size = r->size;
+
+	/* Is there room after evicting those referenced after r? */
+	int64_t room = window.cache_size - window.cache_bytes;
+	GSequenceIter *iter = g_sequence_get_end_iter(window.cache);
+	while (room < size && iter != g_sequence_get_begin_iter(window.cache)) {
+		iter = g_sequence_iter_prev(iter);
+		struct chunkRef *victim = g_sequence_get(iter);
+		if (victim->next < r->next)
+			break;
+		room += victim->cached->size;
+	}
+	if (room < size) {
+		if (!r->ghost)
+			ghost_chunk_ref(r);
+		return 0;
+	}
+
+	while (window.cache_bytes + size > window.cache_size)
+		evict_chunk_ref(g_sequence_get(g_sequence_iter_prev(
+				g_sequence_get_end_iter(window.cache))));
+
+	struct chunk *c = buf;
+	if (c) {
+		assert(c->size == size);
+	} else if (destor.simulation_level == SIMULATION_NO) {
+		c = get_chunk_in_container(con, &r->fp);
+	} else {
+		c = new_chunk(0);
+		c->size = size;
+	}
+	r->cached = c;
+	r->iter = g_sequence_insert_sorted(window.cache, r,
+			(GCompareDataFunc) g_chunk_ref_cmp_by_next, NULL);
+	if (r->ghost)
+		unghost_chunk_ref(r);
+	window.cache_bytes += size;
+	return 1;
+}
+
+/* Fill the chunk at pos with the data of buf. */
+static void assemble_chunk(int64_t pos, struct chunk *buf) {
+	struct chunk *c = WINDOW_CHUNK(pos);
+	if (buf) {
+		assert(c->size == buf->size);
+		c->data = slab_alloc(c->size);
+		memcpy(c->data, buf->data, c->size);
+	}
+	SET_CHUNK(c, CHUNK_READY);
+}
+
+/*
+ * Assemble the chunks of fp in the area,
+ * and cache it if referenced after the area.
+ */
+static void assemble_fingerprint(fingerprint *fp, void *data) {
+	struct container *con = data;
+	struct chunkRef *r = g_hash_table_lookup(window.refs, fp);
+	if (!r || r->next == -1)
+		return;
+
+	struct chunk *buf = NULL;
+	int64_t pos = r->next;
+	for (; pos != -1 && pos < window.area_end; pos = WINDOW_NEXT(pos)) {
+		if (CHECK_CHUNK(WINDOW_CHUNK(pos), CHUNK_READY))
+			continue;
+		if (con && !buf)
+			buf = get_chunk_in_container(con, fp);
+		assemble_chunk(pos, buf);
+	}
+
+	update_next(r, pos);
+	if (r->next != -1 && !r->cached && cache_chunk(r, con, buf))
+		buf = NULL;
+	if (buf)
+		free_chunk(buf);
+}
+
+/*
+ * Submit the containers of the chunks after the head,
+ * which are neither assembled nor cached.
+ */
+static void window_readahead() {
+	if (destor.restore_read_thread_num <= 0)
+		return;
+
+	containerid last = TEMPORARY_ID;
+	int64_t pos = window.head + 1;
+	for (; pos < window.tail && pos <= window.head + CHUNK_RESTORE_READAHEAD;
+			pos++) {
+		struct chunk *c = WINDOW_CHUNK(pos);
+		if (is_signal_chunk(c) || CHECK_CHUNK(c, CHUNK_READY) || c->id == last)
+			continue;
+		struct chunkRef *r = g_hash_table_lookup(window.refs, &c->fp);
+		if (r->cached || (alacc.enabled
+				&& lru_cache_lookup_without_update(alacc.containers, &c->id)))
+			continue;
+		if (!readahead_submit(c->id, pos))
+			break;
+		last = c->id;
+	}
+}
+
+static containerid cached_container_id(void *con) {
+	if (destor.simulation_level == SIMULATION_NO)
+		return ((struct container*) con)->meta.id;
+	return ((struct containerMeta*) con)->id;
+}
+
+static void ghost_container(void *con, void *arg) {
+	alacc.last_evicted = cached_container_id(con);
+}
+
+static void free_cached_container(void *con) {
+	if (destor.simulation_level == SIMULATION_NO)
+		free_container(con);
+	else
+		free_container_meta(con);
+}
+
+/*
+ * Account the read of container id for the head r,
+ * to the components that would have saved it with one more unit.
+ */
+static void alacc_account_miss(containerid id, struct chunkRef *r) {
+	if (r->ghost)
+		alacc.chunk_misses++;
+
+	if (alacc.last_evicted == id)
+		alacc.container_misses++;
+
+	struct lastRead *l = g_hash_table_lookup(alacc.last_reads, &id);
+	if (l && window.head < l->tail && window.head >= l->area_end) {
+		int64_t avg = jcr.chunk_num > 0 ? jcr.data_size / jcr.chunk_num : 1;
+		if ((window.head - l->area_end) * avg < CONTAINER_SIZE)
+			alacc.area_misses++;
+	}
+}
+
+static void alacc_record_read(containerid id) {
+	struct lastRead *l = g_hash_table_lookup(alacc.last_reads, &id);
+	if (!l) {
+		l = malloc(sizeof(struct lastRead));
+		l->id = id;
+		g_hash_table_insert(alacc.last_reads, &l->id, l);
+	}
+	l->area_end = window.area_end;
+	l->tail = window.tail;
+}
+
+/* Resize the components to their units. */
+static void alacc_resize() {
+	window.area_size = alacc.area_units * CONTAINER_SIZE;
+
+	window.cache_size = alacc.cache_units * CONTAINER_SIZE;
+	while (window.cache_bytes > window.cache_size)
+		evict_chunk_ref(g_sequence_get(g_sequence_iter_prev(
+				g_sequence_get_end_iter(window.cache))));
+
+	lru_cache_resize(alacc.containers, alacc.container_units, ghost_container,
+			NULL);
+}
+
+/* Move a unit of memory to the component missing it most. */
+static void alacc_adapt() {
+	if (++alacc.reads % ALACC_ADAPT_INTERVAL)
+		return;
+
+	/* Drop the reads the window has passed. */
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, alacc.last_reads);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		if (((struct lastRead*) value)->tail <= window.head)
+			g_hash_table_iter_remove(&iter);
+
+	int *units[] = { &alacc.area_units, &alacc.cache_units,
+			&alacc.container_units };
+	double misses[] = { alacc.area_misses, alacc.chunk_misses,
+			alacc.container_misses };
+	int i, best = 0, worst = -1;
+	for (i = 1; i < 3; i++)
+		if (misses[i] > misses[best])
+			best = i;
+	for (i = 0; i < 3; i++)
+		if (i != best && *units[i] > 0
+				&& (worst == -1 || misses[i] < misses[worst]))
+			worst = i;
+
+	if (worst != -1 && misses[best] > misses[worst]) {
+		(*units[worst])--;
+		(*units[best])++;
+		alacc_resize();
+		VERBOSE("Restore memory: area %d, chunk cache %d, container cache %d",
+				alacc.area_units, alacc.cache_units, alacc.container_units);
+	}
+
+	/* Forget the past gradually. */
+	alacc.area_misses /= 2;
+	alacc.chunk_misses /= 2;
+	alacc.container_misses /= 2;
+}
+
+/* Assemble the area with a container, or its metadata when simulating. */
+static void assemble_container(void *con) {
+	if (destor.simulation_level == SIMULATION_NO)
+		container_meta_foreach(&((struct container*) con)->meta,
+				assemble_fingerprint, con);
+	else
+		container_meta_foreach(con, assemble_fingerprint, NULL);
+}
+
+/* Read the container of the head r, and assemble the area with it. */
+static void read_container(containerid id, struct chunkRef *r) {
+	if (alacc.enabled) {
+		void *con = lru_cache_lookup(alacc.containers, &id);
+		if (con) {
+			assemble_container(con);
+			return;
+		}
+		alacc_account_miss(id, r);
+	}
+
+	jcr.read_container_num++;
+	VERBOSE("Restore cache: container %lld is missed", id);
+
+	void *con;
+	if (destor.simulation_level == SIMULATION_NO) {
+		/* The next containers are read while this one is assembled. */
+		window_readahead();
+		con = readahead_take(id, window.head);
+	} else {
+		con = retrieve_container_meta_by_id(id);
+	}
+	assemble_container(con);
+
+	if (!alacc.enabled) {
+		free_cached_container(con);
+		return;
+	}
+
+	if (alacc.container_units > 0) {
+		lru_cache_insert(alacc.containers, con, ghost_container, NULL);
+	} else {
+		ghost_container(con, NULL);
+		free_cached_container(con);
+	}
+	alacc_record_read(id);
+	alacc_adapt();
+}
+
+/* Pop the head of the window, assembled. */
+static struct chunk* pop_window() {
+	fill_window();
+	if (window.head == window.tail)
+		return NULL;
+
+	int64_t pos = window.head;
+	struct chunk *c = WINDOW_CHUNK(pos);
+	if (is_signal_chunk(c)) {
+		window.head++;
+		extend_area();
+		return c;
+	}
+
+	struct chunkRef *r = g_hash_table_lookup(window.refs, &c->fp);
+	assert(r && r->first == pos);
+
+	if (!CHECK_CHUNK(c, CHUNK_READY)) {
+		assert(r->next == pos);
+		if (r->cached) {
+			assemble_chunk(pos,
+					destor.simulation_level == SIMULATION_NO ? r->cached : NULL);
+		} else {
+			read_container(c->id, r);
+			assert(CHECK_CHUNK(c, CHUNK_READY));
+		}
+	}
+
+	r->first = WINDOW_NEXT(pos);
+	window.head++;
+	window.area_bytes -= c->size;
+
+	if (r->first == -1) {
+		update_next(r, -1);
+		g_hash_table_remove(window.refs, &r->fp);
+	} else if (r->next == pos) {
+		update_next(r, r->first);
+	}
+
+	extend_area();
+	return c;
+}
+
+static void restore_window(int adaptive) {
+	init_window(adaptive);
+
+	struct chunk* c;
+	while (1) {
+		TIMER_DECLARE(1);
+		TIMER_BEGIN(1);
+		c = pop_window();
+		TIMER_END(1, jcr.read_chunk_time);
+		if (!c)
+			break;
+
+		if (!is_signal_chunk(c)) {
+			jcr.data_size += c->size;
+			jcr.chunk_num++;
+			if (destor.simulation_level >= SIMULATION_RESTORE) {
+				free_chunk(c);
+				continue;
+			}
+		}
+		sync_queue_push(restore_chunk_queue, c);
+	}
+
+	sync_queue_term(restore_chunk_queue);
+
+	close_window();
+}
+
+void* chunk_restore_thread(void *arg) {
+	restore_window(0);
+	return NULL;
+}
+
+void* alacc_restore_thread(void *arg) {
+	restore_window(1);
+	return NULL;
+}
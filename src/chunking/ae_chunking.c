@@ -0,0 +1,50 @@
+/*
+ * AE (Asymmetric Extremum)
+ * See their paper:
+ * 	AE: An Asymmetric Extremum Content Defined Chunking Algorithm
+ * 	for Fast and Bandwidth-Efficient Data Deduplication (INFOCOM'15)
+ *
+ * A cut point is declared once no value larger than the current maximum
+ * appears in the following ae_window bytes.
+ * The expected chunk size is ae_window * (e - 1) after chunk_min_size.
+ */
+#include "../destor.h"
+
+static int ae_window;
+
+void ae_init() {
+	ae_window = destor.chunk_avg_size / 1.718281828;
+	if (ae_window < 1)
+		ae_window = 1;
+}
+
+/* The value at a position is the 8 bytes starting from it. */
+static inline uint64_t ae_value(unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+int ae_chunk_data(unsigned char *p, int n) {
+	if (n <= destor.chunk_min_size)
+		return n;
+
+	int end = n > destor.chunk_max_size ? destor.chunk_max_size : n;
+	int i = destor.chunk_min_size;
+	if (i + 8 > end)
+		return end;
+
+	int max_pos = i;
+	uint64_t max_value = ae_value(p + i);
+
+	for (i++; i + 8 <= end; i++) {
+		uint64_t v = ae_value(p + i);
+		if (v > max_value) {
+			max_value = v;
+			max_pos = i;
+		} else if (i == max_pos + ae_window) {
+			return i;
+		}
+	}
+	return end;
+}
@@ -1,11 +1,12 @@
 /* chunking.h
  the main fuction is to chunking the file!
+ The window state lives on the stack of each *_chunk_data call,
+ so they can be called by multiple threads after the init.
  */
 
 #ifndef CHUNK_H_
 #define CHUNK_H_
 
-void windows_reset();
 void chunkAlg_init();
 int rabin_chunk_data(unsigned char *p, int n);
 int normalized_rabin_chunk_data(unsigned char *p, int n);
@@ -15,4 +16,7 @@ int ae_chunk_data(unsigned char *p, int n);
 
 int tttd_chunk_data(unsigned char *p, int n);
 
+void fastcdc_init();
+int fastcdc_chunk_data(unsigned char *p, int n);
+
 #endif
@@ -0,0 +1,190 @@
+/*
+ * FastCDC
+ * See their paper:
+ * 	FastCDC: a Fast and Efficient Content-Defined Chunking Approach
+ * 	for Data Deduplication (USENIX ATC'16)
+ *
+ * A gear hash is rolled from chunk_min_size (the min-size region is skipped),
+ * and normalized chunking uses a harder mask before chunk_avg_size
+ * and an easier one after it.
+ *
+ * The gear hash only depends on the last 64 bytes,
+ * so the scan can be split into segments hashed in parallel SIMD lanes,
+ * each warmed up by the 64 bytes before it.
+ * The AVX-512 scan consumes 64 bytes (8 lanes x 8 bytes) per iteration,
+ * and returns exactly the same cut points as the scalar one.
+ * With AVX2 the table lookups (gathers) cost more than the scalar loop,
+ * so only AVX-512 is vectorized.
+ */
+#include "../destor.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define FASTCDC_X86
+#endif
+
+/* The bytes hashed by a SIMD lane in a pass. */
+#define FASTCDC_SEGMENT 512
+/* Bytes shifted out of the gear hash. */
+#define FASTCDC_WINDOW 64
+
+/* Never change the gear table, otherwise cut points differ from old backups. */
+#define FASTCDC_GEAR_SEED 0x2ec1a0ad5e2dcd34ULL
+
+static uint64_t gear[256];
+static uint64_t mask_s;
+static uint64_t mask_l;
+
+/*
+ * Return the first i in [from, to) with (hash(i) & mask) == 0,
+ * or -1 if none.
+ * hash(i) covers the bytes in [origin, i].
+ */
+static int (*gear_scan)(unsigned char *p, int origin, int from, int to,
+		uint64_t mask);
+
+static int gear_scan_scalar(unsigned char *p, int origin, int from, int to,
+		uint64_t mask) {
+	uint64_t fp = 0;
+	int i = from - FASTCDC_WINDOW > origin ? from - FASTCDC_WINDOW : origin;
+
+	for (; i < from; i++)
+		fp = (fp << 1) + gear[p[i]];
+
+	for (; i < to; i++) {
+		fp = (fp << 1) + gear[p[i]];
+		if (!(fp & mask))
+			return i;
+	}
+	return -1;
+}
+
+#ifdef FASTCDC_X86
+
+/*
+ * The SIMD lanes are warmed up by whole 8-byte words,
+ * so a scan starting less than FASTCDC_WINDOW bytes after origin
+ * is done in scalar until it reaches origin + FASTCDC_WINDOW.
+ */
+static inline int gear_scan_head(unsigned char *p, int origin, int *from,
+		int to, uint64_t mask) {
+	if (*from == origin || *from - FASTCDC_WINDOW >= origin)
+		return -1;
+	int lim = to < origin + FASTCDC_WINDOW ? to : origin + FASTCDC_WINDOW;
+	int i = gear_scan_scalar(p, origin, *from, lim, mask);
+	*from = lim;
+	return i;
+}
+
+/*
+ * 8 lanes, each hashing a FASTCDC_SEGMENT-byte segment.
+ * Lane 0 starting at origin is fed zeros during the warm-up,
+ * which keeps its hash 0 as the scalar scan does.
+ */
+__attribute__((target("avx512f")))
+static int gear_scan_avx512(unsigned char *p, int origin, int from, int to,
+		uint64_t mask) {
+	const __m512i lane_off = _mm512_set_epi64(7 * FASTCDC_SEGMENT,
+			6 * FASTCDC_SEGMENT, 5 * FASTCDC_SEGMENT, 4 * FASTCDC_SEGMENT,
+			3 * FASTCDC_SEGMENT, 2 * FASTCDC_SEGMENT, FASTCDC_SEGMENT, 0);
+	const __m512i vmask = _mm512_set1_epi64(mask);
+	const __m512i byte = _mm512_set1_epi64(0xff);
+	int i = gear_scan_head(p, origin, &from, to, mask);
+	if (i >= 0)
+		return i;
+
+	while (to - from >= 8 * FASTCDC_SEGMENT) {
+		__m512i pos = _mm512_add_epi64(_mm512_set1_epi64(from - FASTCDC_WINDOW),
+				lane_off);
+		__m512i fp = _mm512_setzero_si512();
+		__m512i words = _mm512_setzero_si512();
+		__mmask8 valid = from - FASTCDC_WINDOW >= origin ? 0xff : 0xfe;
+		__mmask8 hit = 0;
+		int first[8];
+		int t, j;
+
+		for (t = -FASTCDC_WINDOW; t < FASTCDC_SEGMENT; t += 8) {
+			if (t == 0)
+				valid = 0xff;
+			words = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), valid,
+					pos, p, 1);
+			for (j = 0; j < 8; j++) {
+				__m512i idx = _mm512_and_si512(
+						_mm512_srl_epi64(words, _mm_cvtsi32_si128(j * 8)),
+						byte);
+				__m512i g = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(),
+						valid, idx, (const void*) gear, 8);
+				fp = _mm512_add_epi64(_mm512_slli_epi64(fp, 1), g);
+				if (t < 0)
+					continue;
+				__mmask8 k = _mm512_testn_epi64_mask(fp, vmask) & ~hit;
+				while (k) {
+					int lane = __builtin_ctz(k);
+					first[lane] = t + j;
+					hit |= 1 << lane;
+					k &= k - 1;
+				}
+			}
+			pos = _mm512_add_epi64(pos, _mm512_set1_epi64(8));
+			if (hit & 1)
+				break;
+		}
+
+		if (hit) {
+			int lane = __builtin_ctz(hit);
+			return from + lane * FASTCDC_SEGMENT + first[lane];
+		}
+		from += 8 * FASTCDC_SEGMENT;
+	}
+
+	return gear_scan_scalar(p, origin, from, to, mask);
+}
+
+#endif /* FASTCDC_X86 */
+
+void fastcdc_init() {
+	uint64_t x = FASTCDC_GEAR_SEED;
+	int i, bits;
+
+	/* splitmix64 */
+	for (i = 0; i < 256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+
+	for (bits = 0; (1 << bits) < destor.chunk_avg_size; bits++)
+		;
+	/* normalization level 2, using the high bits of the hash */
+	mask_s = ~0ULL << (64 - (bits + 2));
+	mask_l = bits > 2 ? ~0ULL << (64 - (bits - 2)) : 0;
+
+	gear_scan = gear_scan_scalar;
+#ifdef FASTCDC_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		gear_scan = gear_scan_avx512;
+#endif
+}
+
+int fastcdc_chunk_data(unsigned char *p, int n) {
+	if (n <= destor.chunk_min_size)
+		return n;
+
+	int end = n > destor.chunk_max_size ? destor.chunk_max_size : n;
+	int normal = end > destor.chunk_avg_size ? destor.chunk_avg_size : end;
+	int i;
+
+	if (destor.chunk_min_size < normal) {
+		i = gear_scan(p, destor.chunk_min_size, destor.chunk_min_size, normal,
+				mask_s);
+		if (i >= 0)
+			return i + 1;
+	}
+
+	i = gear_scan(p, destor.chunk_min_size,
+			destor.chunk_min_size > normal ? destor.chunk_min_size : normal, end,
+			mask_l);
+	return i >= 0 ? i + 1 : end;
+}
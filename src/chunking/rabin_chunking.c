@@ -27,10 +27,8 @@ typedef unsigned long long int UINT64;
 enum {
 	size = 48
 };
-UINT64 fp;
-int bufpos;
+/* Read-only after chunkAlg_init(), shared by all chunking threads. */
 UINT64 U[256];
-unsigned char buf[size];
 int shift;
 UINT64 T[256];
 UINT64 poly;
@@ -38,11 +36,6 @@ UINT64 poly;
 char *eFiles[] = { ".pdf", ".rmv", "ra", ".bmp", ".vmem", ".vmdk", ".jpeg",
 		".rmvb", ".exe", ".mtv", "\\Program Files", "C:\\" };
 
-size_t _last_pos;
-size_t _cur_pos;
-
-unsigned int _num_chunks;
-
 const char bytemsb[0x100] = { 0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 5,
 		5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6,
 		6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 7,
@@ -159,16 +152,6 @@ UINT64 append8(UINT64 p, unsigned char m) {
 	return ((p << 8) | m) ^ T[p >> shift];
 }
 
-UINT64 slide8(unsigned char m) {
-	unsigned char om;
-	//printf("this char is %c\n",m);
-	if (++bufpos >= size)
-		bufpos = 0;
-	om = buf[bufpos];
-	buf[bufpos] = m;
-	return fp = append8(fp ^ U[om], m);
-}
-
 UINT64 polymmult(UINT64 x, UINT64 y, UINT64 d) {
 
 	//printf ("polymmult (x %llu y %llu d %llu)\n", x, y, d);
@@ -218,30 +201,17 @@ void window_init(UINT64 poly) {
 	UINT64 sizeshift;
 
 	rabinpoly_init(poly);
-	fp = 0;
-	bufpos = -1;
 	sizeshift = 1;
 	for (i = 1; i < size; i++)
 		sizeshift = append8(sizeshift, 0);
 	for (i = 0; i < 256; i++)
 		U[i] = polymmult(i, sizeshift, poly);
-	memset((char*) buf, 0, sizeof(buf));
-}
-
-void windows_reset() {
-	fp = 0;
-	//memset((char*) buf,0,sizeof (buf));
-	//memset((char*) chunk,0,sizeof (chunk));
 }
 
 static int rabin_mask = 0;
 
 void chunkAlg_init() {
 	window_init(FINGERPRINT_PT);
-	_last_pos = 0;
-	_cur_pos = 0;
-	windows_reset();
-	_num_chunks = 0;
 	rabin_mask = destor.chunk_avg_size - 1;
 }
 
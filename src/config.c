@@ -92,6 +92,10 @@ void load_config_from_string(sds config) {
 				destor.chunk_algorithm = CHUNK_TTTD;
 			} else if (strcasecmp(argv[1], "file") == 0) {
 				destor.chunk_algorithm = CHUNK_FILE;
+			} else if (strcasecmp(argv[1], "ae") == 0) {
+				destor.chunk_algorithm = CHUNK_AE;
+			} else if (strcasecmp(argv[1], "fastcdc") == 0) {
+				destor.chunk_algorithm = CHUNK_FASTCDC;
 			} else {
 				err = "Invalid chunk algorithm";
 				goto loaderr;
@@ -102,6 +106,29 @@ void load_config_from_string(sds config) {
 			destor.chunk_max_size = atoi(argv[1]);
 		} else if (strcasecmp(argv[0], "chunk-min-size") == 0 && argc == 2) {
 			destor.chunk_min_size = atoi(argv[1]);
+		} else if (strcasecmp(argv[0], "chunk-thread-num") == 0
+				&& argc == 2) {
+			destor.chunk_thread_num = atoi(argv[1]);
+			if (destor.chunk_thread_num < 1) {
+				err = "Invalid chunk thread num";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "hash-thread-num") == 0
+				&& argc == 2) {
+			destor.hash_thread_num = atoi(argv[1]);
+			if (destor.hash_thread_num < 1) {
+				err = "Invalid hash thread num";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "fingerprint-algorithm") == 0 && argc == 2) {
+			if (strcasecmp(argv[1], "sha1") == 0) {
+				destor.fingerprint_algorithm = FINGERPRINT_SHA1;
+			} else if (strcasecmp(argv[1], "sha256") == 0) {
+				destor.fingerprint_algorithm = FINGERPRINT_SHA256;
+			} else {
+				err = "Invalid fingerprint algorithm";
+				goto loaderr;
+			}
 		} else if (strcasecmp(argv[0], "fingerprint-index") == 0 && argc >= 3) {
 			if (strcasecmp(argv[1], "exact") == 0) {
 				destor.index_category[0] = INDEX_CATEGORY_EXACT;
@@ -158,10 +185,26 @@ void load_config_from_string(sds config) {
 		} else if (strcasecmp(argv[0], "fingerprint-index-cache-size")
 				== 0 && argc == 2) {
 			destor.index_cache_size = atoi(argv[1]);
+		} else if (strcasecmp(argv[0], "fingerprint-index-prefetch-thread-num")
+				== 0 && argc == 2) {
+			destor.index_prefetch_thread_num = atoi(argv[1]);
+			if (destor.index_prefetch_thread_num < 0) {
+				err = "Invalid fingerprint index prefetch thread num";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "dedup-thread-num") == 0
+				&& argc == 2) {
+			destor.dedup_thread_num = atoi(argv[1]);
+			if (destor.dedup_thread_num < 1) {
+				err = "Invalid dedup thread num";
+				goto loaderr;
+			}
 		} else if (strcasecmp(argv[0], "fingerprint-index-key-value") == 0
 				&& argc == 2) {
 			if (strcasecmp(argv[1], "htable") == 0) {
 				destor.index_key_value_store = INDEX_KEY_VALUE_HTABLE;
+			} else if (strcasecmp(argv[1], "ssd") == 0) {
+				destor.index_key_value_store = INDEX_KEY_VALUE_SSD;
 			} else {
 				err = "Invalid key-value store";
 				goto loaderr;
@@ -207,6 +250,11 @@ void load_config_from_string(sds config) {
         else if (strcasecmp(argv[0], "fingerprint-index-bloom-filter") == 0
 				&& argc == 2) {
 			destor.index_bloom_filter_size = atoi(argv[1]);
+			if (destor.index_bloom_filter_size < 0
+					|| destor.index_bloom_filter_size > 40) {
+				err = "Invalid Bloom filter size (log2 of bits, up to 40)";
+				goto loaderr;
+			}
 		} else if (strcasecmp(argv[0], "fingerprint-index-sampling-method") == 0
 				&& argc >= 2) {
 			if (strcasecmp(argv[1], "optmin") == 0)
@@ -329,6 +377,10 @@ void load_config_from_string(sds config) {
             }else if (strcasecmp(argv[1], "forward assembly") == 0
 					|| strcasecmp(argv[1], "asm") == 0){
 				destor.restore_cache[0] = RESTORE_CACHE_ASM;
+            }else if (strcasecmp(argv[1], "chunk") == 0){
+				destor.restore_cache[0] = RESTORE_CACHE_CHUNK;
+            }else if (strcasecmp(argv[1], "alacc") == 0){
+				destor.restore_cache[0] = RESTORE_CACHE_ALACC;
             }else {
 				err = "Invalid restore cache";
 				goto loaderr;
@@ -338,6 +390,76 @@ void load_config_from_string(sds config) {
 		} else if (strcasecmp(argv[0], "restore-opt-window-size") == 0
 				&& argc == 2) {
 			destor.restore_opt_window_size = atoi(argv[1]);
+		} else if (strcasecmp(argv[0], "restore-asm-area-size") == 0
+				&& argc == 2) {
+			destor.restore_asm_area_size = atoi(argv[1]);
+			if (destor.restore_asm_area_size < 0) {
+				err = "Invalid restore asm area size";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "restore-read-thread-num") == 0
+				&& argc == 2) {
+			destor.restore_read_thread_num = atoi(argv[1]);
+			if (destor.restore_read_thread_num < 0) {
+				err = "Invalid restore read thread num";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "restore-readahead-window") == 0
+				&& argc == 2) {
+			destor.restore_readahead_window = atoi(argv[1]);
+			if (destor.restore_readahead_window < 1) {
+				err = "Invalid restore readahead window";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "restore-write-thread-num") == 0
+				&& argc == 2) {
+			destor.restore_write_thread_num = atoi(argv[1]);
+			if (destor.restore_write_thread_num < 1) {
+				err = "Invalid restore write thread num";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "container-direct-io") == 0
+				&& argc == 2) {
+			destor.container_direct_io = yesnotoi(argv[1]);
+			if (destor.container_direct_io < 0) {
+				err = "Invalid container direct io";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "container-pool-num") == 0
+				&& argc == 2) {
+			destor.container_pool_num = atoi(argv[1]);
+			if (destor.container_pool_num < 1) {
+				err = "Invalid container pool num";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "chunk-compression") == 0
+				&& (argc == 2 || argc == 3)) {
+			if (strcasecmp(argv[1], "none") == 0)
+				destor.chunk_compression[0] = CHUNK_CODEC_NONE;
+			else if (strcasecmp(argv[1], "lz4") == 0)
+				destor.chunk_compression[0] = CHUNK_CODEC_LZ4;
+			else if (strcasecmp(argv[1], "zstd") == 0)
+				destor.chunk_compression[0] = CHUNK_CODEC_ZSTD;
+			else {
+				err = "Invalid chunk compression";
+				goto loaderr;
+			}
+			if (argc == 3)
+				destor.chunk_compression[1] = atoi(argv[2]);
+		} else if (strcasecmp(argv[0], "compression-thread-num") == 0
+				&& argc == 2) {
+			destor.compression_thread_num = atoi(argv[1]);
+			if (destor.compression_thread_num < 1) {
+				err = "Invalid compression thread num";
+				goto loaderr;
+			}
+		} else if (strcasecmp(argv[0], "delta-compression") == 0
+				&& argc == 2) {
+			destor.delta_compression = yesnotoi(argv[1]);
+			if (destor.delta_compression < 0) {
+				err = "Invalid delta compression";
+				goto loaderr;
+			}
         } else if (strcasecmp(argv[0], "size-of-meta-cache") == 0
                     && argc == 2) {
             destor.size_of_meta_cache = atoi(argv[1]);
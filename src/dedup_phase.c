@@ -13,6 +13,15 @@
 #include "storage/containerstore.h"
 
 static pthread_t dedup_t;
+static pthread_t *dedup_workers;
+/* segments waiting for a worker */
+static SyncQueue *segment_queue;
+/*
+ * Looked-up segments in stream order,
+ * the send thread is the only producer of dedup_queue.
+ */
+static SyncQueue *send_queue;
+static pthread_t send_t;
 static int64_t chunk_num;
 static int64_t segment_num;
 
@@ -25,14 +34,21 @@ struct {
 	int wait_threshold;
 } index_lock;
 
-void send_segment(struct segment* s) {
+/* The workers look up segments in the order of their seq. */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int64_t next;
+} dedup_order;
+
+static void send_segment(struct segment* s) {
 	/*
 	 * CHUNK_SEGMENT_START and _END are used for
 	 * reconstructing the segment in filter phase.
 	 */
 	struct chunk* ss = new_chunk(0);
 	SET_CHUNK(ss, CHUNK_SEGMENT_START);
-	sync_queue_push(dedup_queue, ss);
+	spsc_ring_push(dedup_queue, ss);
 
 	GSequenceIter *end = g_sequence_get_end_iter(s->chunks);
 	GSequenceIter *begin = g_sequence_get_begin_iter(s->chunks);
@@ -52,27 +68,86 @@ void send_segment(struct segment* s) {
 			}
 
 		}
-		sync_queue_push(dedup_queue, c);
+		spsc_ring_push(dedup_queue, c);
 		g_sequence_remove(begin);
 		begin = g_sequence_get_begin_iter(s->chunks);
 	}
 
 	struct chunk* se = new_chunk(0);
 	SET_CHUNK(se, CHUNK_SEGMENT_END);
-	sync_queue_push(dedup_queue, se);
+	spsc_ring_push(dedup_queue, se);
 
 	s->chunk_num = 0;
 
 }
 
+/*
+ * Look up the segment in the index, and hand it to the send thread.
+ * Segments are processed in stream order here.
+ */
+static void dedup_segment(struct segment* s) {
+	if (s->chunk_num > 0) {
+		VERBOSE("Dedup phase: the %lldth segment of %lld chunks", segment_num++,
+				s->chunk_num);
+		/* Each duplicate chunk will be marked. */
+		pthread_mutex_lock(&index_lock.mutex);
+		while (index_lookup(s) == 0) {
+			pthread_cond_wait(&index_lock.cond, &index_lock.mutex);
+		}
+		pthread_mutex_unlock(&index_lock.mutex);
+	} else {
+		VERBOSE("Dedup phase: an empty segment");
+	}
+	sync_queue_push(send_queue, s);
+}
+
+static void *send_thread(void *arg) {
+	struct segment* s;
+	while ((s = sync_queue_pop(send_queue))) {
+		/* Send chunks in the segment to the next phase.
+		 * The segment will be cleared. */
+		send_segment(s);
+		free_segment(s);
+	}
+	spsc_ring_term(dedup_queue);
+	return NULL;
+}
+
+/*
+ * A worker prepares a segment in parallel with other workers,
+ * e.g., sampling features and prefetching its containers,
+ * and then waits for its turn to look it up.
+ */
+static void *dedup_worker(void *arg) {
+	struct segment* s;
+	while ((s = sync_queue_pop(segment_queue))) {
+		if (s->chunk_num > 0)
+			index_prepare(s);
+
+		pthread_mutex_lock(&dedup_order.mutex);
+		while (dedup_order.next != s->seq)
+			pthread_cond_wait(&dedup_order.cond, &dedup_order.mutex);
+		pthread_mutex_unlock(&dedup_order.mutex);
+
+		dedup_segment(s);
+
+		pthread_mutex_lock(&dedup_order.mutex);
+		dedup_order.next++;
+		pthread_cond_broadcast(&dedup_order.cond);
+		pthread_mutex_unlock(&dedup_order.mutex);
+	}
+	return NULL;
+}
+
 void *dedup_thread(void *arg) {
 	struct segment* s = NULL;
+	int64_t seq = 0;
 	while (1) {
 		struct chunk *c = NULL;
 		if (destor.simulation_level != SIMULATION_ALL)
-			c = sync_queue_pop(hash_queue);
+			c = spsc_ring_pop(hash_queue);
 		else
-			c = sync_queue_pop(trace_queue);
+			c = spsc_ring_pop(trace_queue);
 
 		/* Add the chunk to the segment. */
 		s = segmenting(c);
@@ -80,33 +155,23 @@ void *dedup_thread(void *arg) {
 			continue;
         /* In fact, this is a lazy way to determine a fingerprint unique or not: 
          all fingerprints are put into a segment. */
-        
-        
-		/* segmenting success */
-		if (s->chunk_num > 0) {
-			VERBOSE("Dedup phase: the %lldth segment of %lld chunks", segment_num++,
-					s->chunk_num);
-			/* Each duplicate chunk will be marked. */
-			pthread_mutex_lock(&index_lock.mutex);
-			while (index_lookup(s) == 0) {
-				pthread_cond_wait(&index_lock.cond, &index_lock.mutex);
-			}
-			pthread_mutex_unlock(&index_lock.mutex);
-		} else {
-			VERBOSE("Dedup phase: an empty segment");
-		}
-		/* Send chunks in the segment to the next phase.
-		 * The segment will be cleared. */
-		send_segment(s);
 
-		free_segment(s);
+		/* segmenting success */
+		s->seq = seq++;
+		sync_queue_push(segment_queue, s);
 		s = NULL;
 
 		if (c == NULL)
 			break;
 	}
 
-	sync_queue_term(dedup_queue);
+	sync_queue_term(segment_queue);
+	int i;
+	for (i = 0; i < destor.dedup_thread_num; i++)
+		pthread_join(dedup_workers[i], NULL);
+
+	sync_queue_term(send_queue);
+	pthread_join(send_t, NULL);
 
 	return NULL;
 }
@@ -123,13 +188,28 @@ void start_dedup_phase() {
 	pthread_mutex_init(&index_lock.mutex, NULL);
 	pthread_cond_init(&index_lock.cond, NULL);
 
-	dedup_queue = sync_queue_new(1000);
+	dedup_queue = spsc_ring_new(1000);
+
+	pthread_mutex_init(&dedup_order.mutex, NULL);
+	pthread_cond_init(&dedup_order.cond, NULL);
+	dedup_order.next = 0;
+	segment_queue = sync_queue_new(destor.dedup_thread_num);
+	send_queue = sync_queue_new(destor.dedup_thread_num);
+	pthread_create(&send_t, NULL, send_thread, NULL);
+
+	dedup_workers = malloc(sizeof(pthread_t) * destor.dedup_thread_num);
+	int i;
+	for (i = 0; i < destor.dedup_thread_num; i++)
+		pthread_create(&dedup_workers[i], NULL, dedup_worker, NULL);
 
 	pthread_create(&dedup_t, NULL, dedup_thread, NULL);
 }
 
 void stop_dedup_phase() {
 	pthread_join(dedup_t, NULL);
+	free(dedup_workers);
+	sync_queue_free(segment_queue, NULL);
+	sync_queue_free(send_queue, NULL);
 	NOTICE("dedup phase stops successfully: %d segments of %d chunks on average",
 			segment_num, segment_num ? chunk_num / segment_num : 0);
 }
@@ -30,8 +30,6 @@ struct option long_options[] = {
 		{ NULL, 0, NULL, 0 }
 };
 
-GHashTable *htable;
-GHashTable *cst;
 GHashTable *ht_last_segments;
 
 void usage() {
@@ -92,9 +90,23 @@ void destor_start() {
 	destor.chunk_min_size = 1024;
 	destor.chunk_avg_size = 8192;
 
+	destor.chunk_thread_num = 1;
+	destor.hash_thread_num = 1;
+	destor.fingerprint_algorithm = FINGERPRINT_SHA1;
+
 	destor.restore_cache[0] = RESTORE_CACHE_LRU;
 	destor.restore_cache[1] = 1024;
 	destor.restore_opt_window_size = 1000000;
+	destor.restore_asm_area_size = 0;
+	destor.restore_read_thread_num = 4;
+	destor.restore_readahead_window = 16;
+	destor.restore_write_thread_num = 4;
+	destor.container_direct_io = 0;
+	destor.container_pool_num = 1;
+	destor.chunk_compression[0] = CHUNK_CODEC_NONE;
+	destor.chunk_compression[1] = 3;
+	destor.compression_thread_num = 2;
+	destor.delta_compression = 0;
 
 	destor.index_category[0] = INDEX_CATEGORY_NEAR_EXACT;
 	destor.index_category[1] = INDEX_CATEGORY_PHYSICAL_LOCALITY;
@@ -105,6 +117,8 @@ void destor_start() {
  	destor.index_value_length = 1;
     
 	destor.index_cache_size = 4096;
+	destor.index_prefetch_thread_num = 2;
+	destor.dedup_thread_num = 1;
 
 	destor.index_segment_algorithm[0] = INDEX_SEGMENT_FIXED;
 	destor.index_segment_algorithm[1] = 1024;
@@ -298,6 +312,9 @@ int main(int argc, char **argv) {
 			return 0;
 		}
 	}
+	/* chunk headers and payloads up to chunk_max_size are pooled */
+	slab_init(destor.chunk_max_size);
+
 	sds path = NULL;
     
 
@@ -365,7 +382,7 @@ int main(int argc, char **argv) {
 }
 
 struct chunk* new_chunk(int32_t size) {
-	struct chunk* ck = (struct chunk*) malloc(sizeof(struct chunk));
+	struct chunk* ck = (struct chunk*) slab_alloc(sizeof(struct chunk));
 
 	ck->flag = CHUNK_UNIQUE;
 	ck->id = TEMPORARY_ID;
@@ -373,28 +390,67 @@ struct chunk* new_chunk(int32_t size) {
 	ck->size = size;
 
 	if (size > 0)
-		ck->data = malloc(size);
+		ck->data = slab_alloc(size);
 	else
 		ck->data = NULL;
+	ck->buf = NULL;
+	ck->zdata = NULL;
+	ck->zsize = 0;
+	ck->zcodec = CHUNK_CODEC_NONE;
+	ck->sf = NULL;
 
 	return ck;
 }
 
+/*
+ * A chunk of size bytes at data, which points into rb.
+ */
+struct chunk* new_chunk_view(struct readBuffer *rb, unsigned char *data,
+		int32_t size) {
+	struct chunk* ck = new_chunk(0);
+	ck->size = size;
+	ck->data = data;
+	ck->buf = rb;
+	read_buffer_ref(rb);
+	return ck;
+}
 
 void free_chunk(struct chunk* ck) {
-	if (ck->data) {
-		free(ck->data);
+	if (ck->buf) {
+		read_buffer_unref(ck->buf);
+		ck->buf = NULL;
+		ck->data = NULL;
+	} else if (ck->data) {
+		slab_free(ck->data);
 		ck->data = NULL;
 	}
-	free(ck);
+	if (ck->zdata)
+		free(ck->zdata);
+	if (ck->sf)
+		free(ck->sf);
+	slab_free(ck);
+}
+
+void read_buffer_ref(struct readBuffer *rb) {
+	__sync_fetch_and_add(&rb->ref, 1);
+}
+
+/* Chunks of a buffer are freed by different phases. */
+void read_buffer_unref(struct readBuffer *rb) {
+	if (__sync_sub_and_fetch(&rb->ref, 1) > 0)
+		return;
+	free(rb->data - rb->headroom);
+	free(rb);
 }
 
 struct segment* new_segment() {
 	struct segment * s = (struct segment*) malloc(sizeof(struct segment));
 	s->id = TEMPORARY_ID;
+	s->seq = 0;
 	s->chunk_num = 0;
 	s->chunks = g_sequence_new(NULL);
 	s->features = NULL;
+	s->ids = NULL;
 	return s;
 }
 
@@ -415,6 +471,8 @@ void free_segment(struct segment* s) {
 
 	if (s->features)
 		g_hash_table_destroy(s->features);
+	if (s->ids)
+		free(s->ids);
 
 	free(s);
 }
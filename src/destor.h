@@ -31,6 +31,7 @@
 #include <getopt.h>
 
 #include "utils/sds.h"
+#include "utils/slab.h"
 
 #define TIMER_DECLARE(n) struct timeval b##n,e##n
 #define TIMER_BEGIN(n) gettimeofday(&b##n, NULL)
@@ -68,6 +69,15 @@
 #define CHUNK_FILE 3 /* approximate file-level */
 #define CHUNK_AE 4 /* Asymmetric Extremum CDC */
 #define CHUNK_TTTD 5
+#define CHUNK_FASTCDC 6 /* Gear-based CDC with normalized chunking */
+
+/*
+ * Fingerprints are always 20 bytes on disk;
+ * SHA-256 digests are truncated to 160 bits.
+ * Do not mix algorithms in a single repository.
+ */
+#define FINGERPRINT_SHA1 0
+#define FINGERPRINT_SHA256 1
 
 /*
  * A global fingerprint index is required.
@@ -103,10 +113,11 @@
 
 /*
  * Supported key-value store,
- * including hash table, MySQL.
+ * including hash table, MySQL, and an on-disk hash table for SSD.
  */
 #define INDEX_KEY_VALUE_HTABLE 0
 #define INDEX_KEY_VALUE_MYSQL 1
+#define INDEX_KEY_VALUE_SSD 2
 /*
  * Feature is used for prefetching segments (similarity) or containers (locality).
  * For example, when we find a duplicate chunk,
@@ -168,6 +179,15 @@
 #define RESTORE_CACHE_OPT 1
 #define RESTORE_CACHE_ASM 2
 #define RESTORE_CACHE_PATTERN 3
+#define RESTORE_CACHE_CHUNK 4
+#define RESTORE_CACHE_ALACC 5
+
+/* How a chunk is compressed in its container. */
+#define CHUNK_CODEC_NONE 0
+#define CHUNK_CODEC_LZ4 1
+#define CHUNK_CODEC_ZSTD 2
+/* a delta against a base chunk in another place */
+#define CHUNK_CODEC_DELTA 3
 
 #define REWRITE_NO 0
 #define REWRITE_CFL_SELECTIVE_DEDUPLICATION 1
@@ -214,9 +234,36 @@ struct destor {
 	int chunk_min_size;
 	int chunk_avg_size;
 
+	/* the number of workers in chunk phase, each handling whole files */
+	int chunk_thread_num;
+	/* the number of workers in hash phase */
+	int hash_thread_num;
+	int fingerprint_algorithm;
+
 	/* the cache type and size */
 	int restore_cache[2];
 	int restore_opt_window_size;
+	/* the containers of the chunk restore cache used for forward assembly */
+	int restore_asm_area_size;
+	/* threads reading containers ahead for restore, 0 disables them */
+	int restore_read_thread_num;
+	/* the max number of containers being read or read ahead */
+	int restore_readahead_window;
+	/* threads writing restored files */
+	int restore_write_thread_num;
+	/* read container data with O_DIRECT, bypassing the page cache */
+	int container_direct_io;
+	/* the number of container pool files, each with an append thread */
+	int container_pool_num;
+	/*
+	 * [0] specifies the codec of chunks in containers,
+	 * and [1] specifies the level of Zstd.
+	 */
+	int chunk_compression[2];
+	/* the number of threads compressing chunks, including the filter phase */
+	int compression_thread_num;
+	/* delta compress unique chunks against resembling stored chunks */
+	int delta_compression;
     
     
 
@@ -229,6 +276,14 @@ struct destor {
 
 	/* in number of containers, for DDFS/ChunkStash/Sampled Index. */
 	int index_cache_size;
+	/* reader threads prefetching containers into the cache, 0 disables them */
+	int index_prefetch_thread_num;
+	/* threads preparing segments for the index lookup in the dedup phase */
+	int dedup_thread_num;
+	/*
+	 * The Bloom filter in front of the key-value store has
+	 * 2^index_bloom_filter_size bits, 0 disables it.
+	 */
 	int index_bloom_filter_size;
 
 	/*
@@ -335,26 +390,64 @@ typedef struct cst_entry_segment {
 //-------------------------------
 
 
+/*
+ * A reference-counted buffer holding a block of a file
+ * (see read_phase.c), read into the heap in one go.
+ * Backup chunks point into it instead of owning a copy,
+ * and the data is copied only when a chunk is packed into a container.
+ */
+struct readBuffer {
+	int ref;
+	unsigned char *data;
+	int64_t size;
+	/*
+	 * The bytes allocated in front of data,
+	 * where the chunk phase moves the tail of the previous block.
+	 */
+	int32_t headroom;
+};
+
 struct chunk {
 	int32_t size;
 	int flag;
 	containerid id;
 	fingerprint fp;
 	unsigned char *data;
+	/*
+	 * If not NULL, data points into buf and is not owned by the chunk.
+	 * Otherwise data is allocated by slab_alloc(), and freed by free_chunk().
+	 */
+	struct readBuffer *buf;
+	/* The compressed data to store, or NULL to store data as is. */
+	unsigned char *zdata;
+	int32_t zsize;
+	int32_t zcodec;
+	/* The super-features for delta compression, or NULL. */
+	uint64_t *sf;
 };
 
 /* struct segment only makes sense for index. */
 struct segment {
 	segmentid id;
+	/* the order in the stream, numbered by the dedup phase */
+	int64_t seq;
 	/* The actual number because there are signal chunks. */
 	int32_t chunk_num;
 	GSequence *chunks;
 	GHashTable* features;
+	/*
+	 * The IDs found in the key-value store by index_prepare,
+	 * one per chunk but signal chunks, or NULL.
+	 */
+	int64_t *ids;
 };
 
 
 struct chunk* new_chunk(int32_t);
+struct chunk* new_chunk_view(struct readBuffer*, unsigned char*, int32_t);
 void free_chunk(struct chunk*);
+void read_buffer_ref(struct readBuffer*);
+void read_buffer_unref(struct readBuffer*);
 
 struct segment* new_segment();
 struct segment* new_segment_full();
@@ -86,6 +86,9 @@ void do_backup(char *path) {
 	printf("total size(B): %" PRId64 "\n", jcr.data_size);
 	printf("stored data size(B): %" PRId64 "\n",
 			jcr.unique_data_size + jcr.rewritten_chunk_size);
+	printf("compressed data size(B): %" PRId64 "\n",
+			jcr.compressed_data_size);
+	printf("number of delta chunks: %" PRId32 "\n", jcr.delta_chunk_num);
 	printf("deduplication ratio: %.4f, %.4f\n",
 			jcr.data_size != 0 ?
 					(jcr.data_size - jcr.unique_data_size
@@ -133,6 +136,9 @@ void do_backup(char *path) {
 			jcr.filter_time / 1000000,
 			jcr.data_size * 1000000 / jcr.filter_time / 1024 / 1024);
 
+	printf("compress_time : %.3fs, %.2fMB/s\n", jcr.compress_time / 1000000,
+			jcr.data_size * 1000000 / jcr.compress_time / 1024 / 1024);
+
 	printf("write_time : %.3fs, %.2fMB/s\n", jcr.write_time / 1000000,
 			jcr.data_size * 1000000 / jcr.write_time / 1024 / 1024);
 
@@ -1,9 +1,14 @@
+/* for fallocate */
+#define _GNU_SOURCE
 #include "destor.h"
 #include "jcr.h"
 #include "recipe/recipestore.h"
 #include "storage/containerstore.h"
+#include "storage/readahead.h"
 #include "utils/lru_cache.h"
 #include "restore.h"
+#include <sys/uio.h>
+#include <limits.h>
 
 extern void init_segmenting_method();
 
@@ -33,17 +38,27 @@ void * thr_wait(void *arg)
 
 
 *********************fdl********************************************/
+static struct lruCache *cache;
+
+static int lru_cached(struct chunk *c) {
+	return lru_cache_lookup_without_update(cache, &c->fp) != NULL;
+}
+
 static void* lru_restore_thread(void *arg) {
-	struct lruCache *cache;
 	if (destor.simulation_level >= SIMULATION_RESTORE)
-		cache = new_lru_cache(destor.restore_cache[1], (void*)free_container_meta,
-				lookup_fingerprint_in_container_meta);
+		cache = new_indexed_lru_cache(destor.restore_cache[1],
+				(void*)free_container_meta, NULL,
+				(void*)container_meta_foreach_fingerprint,
+				g_int_hash, (GEqualFunc)g_fingerprint_equal);
 	else
-		cache = new_lru_cache(destor.restore_cache[1], (void*)free_container,
-				lookup_fingerprint_in_container);
+		cache = new_indexed_lru_cache(destor.restore_cache[1],
+				(void*)free_container, NULL,
+				(void*)container_foreach_fingerprint,
+				g_int_hash, (GEqualFunc)g_fingerprint_equal);
 
 	struct chunk* c;
-	while ((c = sync_queue_pop(restore_recipe_queue))) {
+	int64_t pos;
+	while ((c = readahead_pop(restore_recipe_queue, lru_cached, &pos))) {
 
 		if (CHECK_CHUNK(c, CHUNK_FILE_START) || CHECK_CHUNK(c, CHUNK_FILE_END)) {
 			sync_queue_push(restore_chunk_queue, c);
@@ -68,7 +83,7 @@ static void* lru_restore_thread(void *arg) {
 			struct container *con = lru_cache_lookup(cache, &c->fp);
 			if (!con) {
 				VERBOSE("Restore cache: container %lld is missed", c->id);
-				con = retrieve_container_by_id(c->id);
+				con = readahead_take(c->id, pos);
 				lru_cache_insert(cache, con, NULL, NULL);
 				jcr.read_container_num++;
 			}
@@ -92,15 +107,18 @@ static void* lru_restore_thread(void *arg) {
 
 static void* read_recipe_thread(void *arg) {
 
-	int i, j, k;
+	int i, j;
 	for (i = 0; i < jcr.bv->number_of_files; i++) {
 		TIMER_DECLARE(1);
 		TIMER_BEGIN(1);
 
 		struct fileRecipeMeta *r = read_next_file_recipe_meta(jcr.bv);
 
-		struct chunk *c = new_chunk(sdslen(r->filename) + 1);
+		/* The file name, followed by the file size for preallocation. */
+		int len = sdslen(r->filename) + 1;
+		struct chunk *c = new_chunk(len + sizeof(r->filesize));
 		strcpy(c->data, r->filename);
+		memcpy(c->data + len, &r->filesize, sizeof(r->filesize));
 		SET_CHUNK(c, CHUNK_FILE_START);
 
 		TIMER_END(1, jcr.read_recipe_time);
@@ -111,17 +129,20 @@ static void* read_recipe_thread(void *arg) {
 			TIMER_DECLARE(1);
 			TIMER_BEGIN(1);
 
-			struct chunkPointer* cp = read_next_n_chunk_pointers(jcr.bv, 1, &k);
+			struct chunkPointer cp;
+			if (!read_next_chunk_pointer(jcr.bv, &cp)) {
+				WARNING("The recipe ends before %s!", r->filename);
+				exit(1);
+			}
 
 			struct chunk* c = new_chunk(0);
-			memcpy(&c->fp, &cp->fp, sizeof(fingerprint));
-			c->size = cp->size;
-			c->id = cp->id;
+			memcpy(&c->fp, &cp.fp, sizeof(fingerprint));
+			c->size = cp.size;
+			c->id = cp.id;
 
 			TIMER_END(1, jcr.read_recipe_time);
 
 			sync_queue_push(restore_recipe_queue, c);
-			free(cp);
 		}
 
 		c = new_chunk(0);
@@ -135,28 +156,133 @@ static void* read_recipe_thread(void *arg) {
 	return NULL;
 }
 
-void* write_restore_data(void* arg) {
+/* Contiguous chunks of a file are written at once, up to the size. */
+#define RESTORE_WRITE_BATCH (1024 * 1024)
+
+/* A file being restored, closed when the last reference is dropped. */
+struct restoreFile {
+	int fd;
+	int refs;
+};
+
+/* Contiguous chunks of a file, written by a writer thread. */
+struct writeBatch {
+	struct restoreFile *file;
+	int64_t offset;
+	int64_t size;
+	GQueue *chunks;
+};
+
+static SyncQueue *write_queue;
+
+static void unref_restore_file(struct restoreFile *f) {
+	if (__sync_sub_and_fetch(&f->refs, 1) > 0)
+		return;
+	if (close(f->fd)) {
+		perror("Fail to close a restored file");
+		exit(1);
+	}
+	free(f);
+}
 
-	char *p, *q;
-	q = jcr.path + 1;/* ignore the first char*/
-	/*
-	 * recursively make directory
-	 */
-	while ((p = strchr(q, '/'))) {
-		if (*p == *(p - 1)) {
-			q++;
-			continue;
+static void pwritev_full(int fd, struct iovec *iov, int n, int64_t off) {
+	while (n > 0) {
+		ssize_t w = pwritev(fd, iov, n, off);
+		if (w <= 0) {
+			if (w < 0 && errno == EINTR)
+				continue;
+			perror("Fail to write a restored file");
+			exit(1);
 		}
-		*p = 0;
-		if (access(jcr.path, 0) != 0) {
-			mkdir(jcr.path, S_IRWXU | S_IRWXG | S_IRWXO);
+		off += w;
+		while (n > 0 && w >= iov->iov_len) {
+			w -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char*) iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+}
+
+static void* write_batch_thread(void *arg) {
+	struct writeBatch *b;
+	while ((b = sync_queue_pop(write_queue))) {
+		int n = g_queue_get_length(b->chunks), i = 0;
+		struct iovec iov[n];
+		GList *l;
+		for (l = g_queue_peek_head_link(b->chunks); l; l = l->next, i++) {
+			struct chunk *c = l->data;
+			iov[i].iov_base = c->data;
+			iov[i].iov_len = c->size;
+		}
+		pwritev_full(b->file->fd, iov, n, b->offset);
+
+		g_queue_free_full(b->chunks, (GDestroyNotify) free_chunk);
+		unref_restore_file(b->file);
+		free(b);
+	}
+	return NULL;
+}
+
+static void flush_write_batch(struct writeBatch **b) {
+	if (*b) {
+		sync_queue_push(write_queue, *b);
+		*b = NULL;
+	}
+}
+
+/*
+ * Make the directories in path up to its last '/',
+ * and remember them in dirs to avoid syscalls for later files.
+ */
+static void make_parent_dirs(GHashTable *dirs, char *path) {
+	char *last = strrchr(path, '/');
+	if (!last || last == path)
+		return;
+
+	*last = 0;
+	if (!g_hash_table_contains(dirs, path)) {
+		char *p = path + 1;/* ignore the first char*/
+		while (1) {
+			p = strchr(p, '/');
+			if (p)
+				*p = 0;
+			if (!g_hash_table_contains(dirs, path)) {
+				mkdir(path, S_IRWXU | S_IRWXG | S_IRWXO);
+				g_hash_table_add(dirs, strdup(path));
+			}
+			if (!p)
+				break;
+			*p++ = '/';
 		}
-		*p = '/';
-		q = p + 1;
 	}
+	*last = '/';
+}
+
+/*
+ * Files are opened here in the order of the stream,
+ * and their chunks are written at their offsets by writer threads,
+ * so several files are being written at once.
+ */
+void* write_restore_data(void* arg) {
+
+	GHashTable *dirs = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+			NULL);
+	make_parent_dirs(dirs, jcr.path);
+
+	write_queue = sync_queue_new(destor.restore_write_thread_num * 4);
+	pthread_t write_t[destor.restore_write_thread_num];
+	int i;
+	for (i = 0; i < destor.restore_write_thread_num; i++)
+		pthread_create(&write_t[i], NULL, write_batch_thread, NULL);
 
 	struct chunk *c = NULL;
-	FILE *fp = NULL;
+	struct restoreFile *file = NULL;
+	struct writeBatch *batch = NULL;
+	int64_t offset = 0;
 
 	while ((c = sync_queue_pop(restore_chunk_queue))) {
 
@@ -169,25 +295,27 @@ void* write_restore_data(void* arg) {
 			sds filepath = sdsdup(jcr.path);
 			filepath = sdscat(filepath, c->data);
 
-			int len = sdslen(jcr.path);
-			char *q = filepath + len;
-			char *p;
-			while ((p = strchr(q, '/'))) {
-				if (*p == *(p - 1)) {
-					q++;
-					continue;
-				}
-				*p = 0;
-				if (access(filepath, 0) != 0) {
-					mkdir(filepath, S_IRWXU | S_IRWXG | S_IRWXO);
-				}
-				*p = '/';
-				q = p + 1;
-			}
+			make_parent_dirs(dirs, filepath);
 
 			if (destor.simulation_level == SIMULATION_NO) {
-				assert(fp == NULL);
-				fp = fopen(filepath, "w");
+				assert(file == NULL);
+				int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if (fd < 0) {
+					WARNING("Can not create %s: %s", filepath, strerror(errno));
+					exit(1);
+				}
+
+				int64_t filesize;
+				memcpy(&filesize, c->data + strlen(c->data) + 1,
+						sizeof(filesize));
+				/* Only a hint, some file systems do not support it. */
+				if (filesize > 0)
+					fallocate(fd, 0, 0, filesize);
+
+				file = malloc(sizeof(struct restoreFile));
+				file->fd = fd;
+				file->refs = 1;
+				offset = 0;
 			}
 
 			sdsfree(filepath);
@@ -195,13 +323,32 @@ void* write_restore_data(void* arg) {
 		} else if (CHECK_CHUNK(c, CHUNK_FILE_END)) {
 		    jcr.file_num++;
 
-			if (fp)
-				fclose(fp);
-			fp = NULL;
+			if (file) {
+				flush_write_batch(&batch);
+				unref_restore_file(file);
+			}
+			file = NULL;
 		} else {
 			assert(destor.simulation_level == SIMULATION_NO);
 			VERBOSE("Restoring %d bytes", c->size);
-			fwrite(c->data, c->size, 1, fp);
+			if (!batch) {
+				batch = malloc(sizeof(struct writeBatch));
+				batch->file = file;
+				__sync_fetch_and_add(&file->refs, 1);
+				batch->offset = offset;
+				batch->size = 0;
+				batch->chunks = g_queue_new();
+			}
+			g_queue_push_tail(batch->chunks, c);
+			batch->size += c->size;
+			offset += c->size;
+			if (batch->size >= RESTORE_WRITE_BATCH
+					|| g_queue_get_length(batch->chunks) >= IOV_MAX)
+				flush_write_batch(&batch);
+
+			TIMER_END(1, jcr.write_chunk_time);
+			/* The chunk is freed by the writer thread. */
+			continue;
 		}
 
 		free_chunk(c);
@@ -209,6 +356,12 @@ void* write_restore_data(void* arg) {
 		TIMER_END(1, jcr.write_chunk_time);
 	}
 
+	sync_queue_term(write_queue);
+	for (i = 0; i < destor.restore_write_thread_num; i++)
+		pthread_join(write_t[i], NULL);
+	sync_queue_free(write_queue, NULL);
+	g_hash_table_destroy(dirs);
+
     jcr.status = JCR_STATUS_DONE;
     pthread_cond_signal(&cond);
     return NULL;
@@ -217,6 +370,7 @@ void* write_restore_data(void* arg) {
 void do_restore(int revision, char *path) {
 	init_recipe_store();
 	init_container_store();
+	init_readahead();
     
     pthread_mutex_init(&mutex, NULL);  
     pthread_cond_init(&cond, NULL);  
@@ -250,6 +404,12 @@ void do_restore(int revision, char *path) {
 	} else if (destor.restore_cache[0] == RESTORE_CACHE_ASM) {
 		destor_log(DESTOR_NOTICE, "restore cache is ASM");
 		pthread_create(&read_t, NULL, assembly_restore_thread, NULL);
+	} else if (destor.restore_cache[0] == RESTORE_CACHE_CHUNK) {
+		destor_log(DESTOR_NOTICE, "restore cache is CHUNK");
+		pthread_create(&read_t, NULL, chunk_restore_thread, NULL);
+	} else if (destor.restore_cache[0] == RESTORE_CACHE_ALACC) {
+		destor_log(DESTOR_NOTICE, "restore cache is ALACC");
+		pthread_create(&read_t, NULL, alacc_restore_thread, NULL);
     } else if (destor.restore_cache[0] == RESTORE_CACHE_PATTERN) {
         destor_log(DESTOR_NOTICE, "restore cache is PATTERN");
         pthread_create(&read_t, NULL, pattern_restore_plus_thread, NULL);
@@ -336,6 +496,7 @@ void do_restore(int revision, char *path) {
 
 	fclose(fp);
 
+	close_readahead();
 	close_container_store();
 	close_recipe_store();
 }
@@ -1,10 +1,12 @@
 #include "destor.h"
 #include "jcr.h"
 #include "storage/containerstore.h"
+#include "storage/compression.h"
 #include "recipe/recipestore.h"
 #include "rewrite_phase.h"
 #include "backup.h"
 #include "index/index.h"
+#include "index/sketch_index.h"
 
 static pthread_t filter_t;
 static int64_t chunk_num;
@@ -24,6 +26,26 @@ extern struct {
 	int wait_threshold;
 } index_lock;
 
+/*
+ * Delta compress a unique chunk against a resembling chunk
+ * in the container buffer, which compress_segment leaves to us.
+ * A base stored since compress_segment is not read here, under the lock.
+ */
+static void delta_compress_buffered(struct chunk *c) {
+	fingerprint base_fp;
+	containerid base_id;
+
+	if (c->zcodec == CHUNK_CODEC_DELTA || !storage_buffer.container_buffer
+			|| !sketch_index_lookup(c->sf, &base_fp, &base_id)
+			|| base_id != get_container_id(storage_buffer.container_buffer))
+		return;
+
+	struct chunk *base = get_chunk_in_container(
+			storage_buffer.container_buffer, &base_fp);
+	delta_compress_chunk(c, base, &base_fp, base_id);
+	free_chunk(base);
+}
+
 /*
  * When a container buffer is full, we push it into container_queue.
  */
@@ -32,7 +54,7 @@ static void* filter_thread(void *arg) {
     struct fileRecipeMeta* r = NULL;
 
     while (1) {
-        struct chunk* c = sync_queue_pop(rewrite_queue);
+        struct chunk* c = spsc_ring_pop(rewrite_queue);
 
         if (c == NULL)
             /* backup job finish */
@@ -45,14 +67,14 @@ static void* filter_thread(void *arg) {
         assert(CHECK_CHUNK(c, CHUNK_SEGMENT_START));
         free_chunk(c);
 
-        c = sync_queue_pop(rewrite_queue);
+        c = spsc_ring_pop(rewrite_queue);
         while (!(CHECK_CHUNK(c, CHUNK_SEGMENT_END))) {
             g_sequence_append(s->chunks, c);
             if (!CHECK_CHUNK(c, CHUNK_FILE_START)
                     && !CHECK_CHUNK(c, CHUNK_FILE_END))
                 s->chunk_num++;
 
-            c = sync_queue_pop(rewrite_queue);
+            c = spsc_ring_pop(rewrite_queue);
         }
         free_chunk(c);
 
@@ -64,6 +86,13 @@ static void* filter_thread(void *arg) {
         GHashTable *recently_unique_chunks = g_hash_table_new_full(g_int64_hash,
         			g_fingerprint_equal, NULL, free_chunk);
 
+        /* Out of the index lock, as it does not touch the index. */
+        TIMER_DECLARE(2);
+        TIMER_BEGIN(2);
+        compress_segment(s, storage_buffer.container_buffer ?
+        		get_container_id(storage_buffer.container_buffer) : TEMPORARY_ID);
+        TIMER_END(2, jcr.compress_time);
+
         pthread_mutex_lock(&index_lock.mutex);
 
         TIMER_DECLARE(1);
@@ -128,13 +157,22 @@ static void* filter_thread(void *arg) {
                  * we write it to a container.
                  * Fragmented indicates: sparse, or out of order and not in cache,
                  */
+                int delta = destor.delta_compression
+                		&& destor.simulation_level < SIMULATION_APPEND
+                		&& !CHECK_CHUNK(c, CHUNK_DUPLICATE);
+                if (delta) {
+                	assert(c->sf);
+                	delta_compress_buffered(c);
+                }
+
                 if (storage_buffer.container_buffer == NULL){
                 	storage_buffer.container_buffer = create_container();
                 	if(destor.index_category[1] == INDEX_CATEGORY_PHYSICAL_LOCALITY)
                 		storage_buffer.chunks = g_sequence_new(free_chunk);
                 }
 
-                if (container_overflow(storage_buffer.container_buffer, c->size)) {
+                if (container_overflow(storage_buffer.container_buffer,
+                		chunk_stored_size(c))) {
 
                     if(destor.index_category[1] == INDEX_CATEGORY_PHYSICAL_LOCALITY){
                         /*
@@ -159,6 +197,14 @@ static void* filter_thread(void *arg) {
                 	struct chunk* wc = new_chunk(0);
                 	memcpy(&wc->fp, &c->fp, sizeof(fingerprint));
                 	wc->id = c->id;
+                	jcr.compressed_data_size += chunk_stored_size(c);
+                	if (delta) {
+                		/* A delta is never a base, so no chain is formed. */
+                		if (c->zdata && c->zcodec == CHUNK_CODEC_DELTA)
+                			jcr.delta_chunk_num++;
+                		else
+                			sketch_index_insert(c->sf, &c->fp, c->id);
+                	}
                 	if (!CHECK_CHUNK(c, CHUNK_DUPLICATE)) {
                 		jcr.unique_chunk_num++;
                 		jcr.unique_data_size += c->size;
@@ -334,6 +380,7 @@ void start_filter_phase() {
 	storage_buffer.container_buffer = NULL;
 
     init_restore_aware();
+    init_compression();
 
     pthread_create(&filter_t, NULL, filter_thread, NULL);
 }
@@ -341,6 +388,7 @@ void start_filter_phase() {
 void stop_filter_phase() {
     pthread_join(filter_t, NULL);
     close_har();
+    close_compression();
 	NOTICE("filter phase stops successfully!");
 
 }
@@ -0,0 +1,506 @@
+/*
+ * fingerprint.c
+ *
+ *  SHA-1 is computed by one of the following kernels,
+ *  selected at runtime according to the CPU features:
+ *  1. SHA-NI, one chunk at a time;
+ *  2. AVX-512, 16 chunks interleaved in the lanes (multi-buffer);
+ *  3. AVX2, 8 chunks interleaved in the lanes (multi-buffer);
+ *  4. OpenSSL.
+ *  SHA-256 is computed by OpenSSL and truncated to the fingerprint width.
+ */
+#include "fingerprint.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define FINGERPRINT_X86
+#endif
+
+static void (*fingerprint_kernel)(struct chunk **chunks, int n);
+static const char *kernel_name;
+
+static inline int is_signal_chunk(struct chunk *c) {
+	return CHECK_CHUNK(c, CHUNK_FILE_START) || CHECK_CHUNK(c, CHUNK_FILE_END);
+}
+
+static void sha1_openssl(struct chunk **chunks, int n) {
+	int i;
+	for (i = 0; i < n; i++) {
+		if (is_signal_chunk(chunks[i]))
+			continue;
+		SHA_CTX ctx;
+		SHA1_Init(&ctx);
+		SHA1_Update(&ctx, chunks[i]->data, chunks[i]->size);
+		SHA1_Final(chunks[i]->fp, &ctx);
+	}
+}
+
+static void sha256_openssl(struct chunk **chunks, int n) {
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	int i;
+	for (i = 0; i < n; i++) {
+		if (is_signal_chunk(chunks[i]))
+			continue;
+		SHA256(chunks[i]->data, chunks[i]->size, md);
+		memcpy(chunks[i]->fp, md, sizeof(fingerprint));
+	}
+}
+
+#ifdef FINGERPRINT_X86
+
+static const uint32_t sha1_iv[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE,
+		0x10325476, 0xC3D2E1F0 };
+
+/*
+ * The padded tail of a message, one or two blocks.
+ */
+static int sha1_pad_tail(struct chunk *c, unsigned char tail[128]) {
+	int full = c->size / 64;
+	int rem = c->size % 64;
+	int blocks = rem + 9 <= 64 ? 1 : 2;
+	uint64_t bits = (uint64_t) c->size << 3;
+	int i;
+
+	memset(tail, 0, 128);
+	memcpy(tail, c->data + full * 64, rem);
+	tail[rem] = 0x80;
+	for (i = 0; i < 8; i++)
+		tail[blocks * 64 - 1 - i] = bits >> (i * 8);
+	return blocks;
+}
+
+static inline void sha1_store_digest(struct chunk *c, const uint32_t h[5]) {
+	int i;
+	for (i = 0; i < 5; i++) {
+		c->fp[i * 4] = h[i] >> 24;
+		c->fp[i * 4 + 1] = h[i] >> 16;
+		c->fp[i * 4 + 2] = h[i] >> 8;
+		c->fp[i * 4 + 3] = h[i];
+	}
+}
+
+/* ---------------------------- SHA-NI ---------------------------- */
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+/*
+ * Four rounds with the same group structure,
+ * g is the index of the 4-round group (0..19).
+ */
+#define SHANI_GROUP(g, E_CUR, E_NEXT, M0, M1, M2, M3) do { \
+		E_CUR = _mm_sha1nexte_epu32(E_CUR, M0); \
+		E_NEXT = ABCD; \
+		M1 = _mm_sha1msg2_epu32(M1, M0); \
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E_CUR, (g) / 5); \
+		M3 = _mm_sha1msg1_epu32(M3, M0); \
+		M2 = _mm_xor_si128(M2, M0); \
+	} while (0)
+
+SHANI_TARGET
+static void sha1_shani_blocks(uint32_t state[5], const unsigned char *data,
+		int blocks) {
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+			0x08090a0b0c0d0e0fULL);
+	__m128i ABCD, E0, E1, ABCD_SAVE, E0_SAVE;
+	__m128i MSG0, MSG1, MSG2, MSG3;
+
+	ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0x1B);
+	E0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	while (blocks-- > 0) {
+		ABCD_SAVE = ABCD;
+		E0_SAVE = E0;
+
+		/* Rounds 0-3 */
+		MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) data), mask);
+		E0 = _mm_add_epi32(E0, MSG0);
+		E1 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+		/* Rounds 4-7 */
+		MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 16)),
+				mask);
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+		/* Rounds 8-11 */
+		MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 32)),
+				mask);
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* Rounds 12-15 */
+		MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 48)),
+				mask);
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* Rounds 16-79 */
+		SHANI_GROUP(4, E0, E1, MSG0, MSG1, MSG2, MSG3);
+		SHANI_GROUP(5, E1, E0, MSG1, MSG2, MSG3, MSG0);
+		SHANI_GROUP(6, E0, E1, MSG2, MSG3, MSG0, MSG1);
+		SHANI_GROUP(7, E1, E0, MSG3, MSG0, MSG1, MSG2);
+		SHANI_GROUP(8, E0, E1, MSG0, MSG1, MSG2, MSG3);
+		SHANI_GROUP(9, E1, E0, MSG1, MSG2, MSG3, MSG0);
+		SHANI_GROUP(10, E0, E1, MSG2, MSG3, MSG0, MSG1);
+		SHANI_GROUP(11, E1, E0, MSG3, MSG0, MSG1, MSG2);
+		SHANI_GROUP(12, E0, E1, MSG0, MSG1, MSG2, MSG3);
+		SHANI_GROUP(13, E1, E0, MSG1, MSG2, MSG3, MSG0);
+		SHANI_GROUP(14, E0, E1, MSG2, MSG3, MSG0, MSG1);
+		SHANI_GROUP(15, E1, E0, MSG3, MSG0, MSG1, MSG2);
+		SHANI_GROUP(16, E0, E1, MSG0, MSG1, MSG2, MSG3);
+
+		/* Rounds 68-71 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* Rounds 72-75 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+		/* Rounds 76-79 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+
+		E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+
+		data += 64;
+	}
+
+	_mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(ABCD, 0x1B));
+	state[4] = _mm_extract_epi32(E0, 3);
+}
+
+SHANI_TARGET
+static void sha1_shani(struct chunk **chunks, int n) {
+	unsigned char tail[128];
+	uint32_t h[5];
+	int i;
+	for (i = 0; i < n; i++) {
+		struct chunk *c = chunks[i];
+		if (is_signal_chunk(c))
+			continue;
+		memcpy(h, sha1_iv, sizeof(h));
+		sha1_shani_blocks(h, c->data, c->size / 64);
+		sha1_shani_blocks(h, tail, sha1_pad_tail(c, tail));
+		sha1_store_digest(c, h);
+	}
+}
+
+/* ------------------------- multi-buffer ------------------------- */
+
+#define SHA1_MB_MAX_LANES 16
+
+struct sha1Lane {
+	struct chunk *c;
+	int32_t full_blocks;
+	int32_t total_blocks;
+	int32_t next_block;
+	unsigned char tail[128];
+};
+
+/* Idle lanes hash this block, and the result is discarded. */
+static const unsigned char idle_block[64];
+
+/*
+ * One compression of all lanes.
+ * state[i][l] is the i-th word of the l-th lane.
+ */
+typedef void (*sha1_mb_compress)(uint32_t state[5][SHA1_MB_MAX_LANES],
+		const unsigned char *blocks[SHA1_MB_MAX_LANES]);
+
+/*
+ * Chunks of different sizes are interleaved,
+ * and a lane is refilled by the next chunk once its chunk is finished.
+ */
+static void sha1_multi_buffer(struct chunk **chunks, int n, int lanes,
+		sha1_mb_compress compress) {
+	struct sha1Lane lane[SHA1_MB_MAX_LANES];
+	uint32_t state[5][SHA1_MB_MAX_LANES];
+	const unsigned char *blocks[SHA1_MB_MAX_LANES];
+	uint32_t h[5];
+	int next = 0, active = 0;
+	int l, i;
+
+	for (l = 0; l < lanes; l++)
+		lane[l].c = NULL;
+
+	while (1) {
+		for (l = 0; l < lanes; l++) {
+			if (lane[l].c)
+				continue;
+			while (next < n && is_signal_chunk(chunks[next]))
+				next++;
+			if (next == n)
+				continue;
+			struct sha1Lane *p = &lane[l];
+			p->c = chunks[next++];
+			p->full_blocks = p->c->size / 64;
+			p->total_blocks = p->full_blocks + sha1_pad_tail(p->c, p->tail);
+			p->next_block = 0;
+			for (i = 0; i < 5; i++)
+				state[i][l] = sha1_iv[i];
+			active++;
+		}
+
+		if (active == 0)
+			break;
+
+		for (l = 0; l < lanes; l++) {
+			struct sha1Lane *p = &lane[l];
+			if (p->c == NULL)
+				blocks[l] = idle_block;
+			else if (p->next_block < p->full_blocks)
+				blocks[l] = p->c->data + p->next_block * 64;
+			else
+				blocks[l] = p->tail + (p->next_block - p->full_blocks) * 64;
+		}
+
+		compress(state, blocks);
+
+		for (l = 0; l < lanes; l++) {
+			struct sha1Lane *p = &lane[l];
+			if (p->c == NULL || ++p->next_block < p->total_blocks)
+				continue;
+			for (i = 0; i < 5; i++)
+				h[i] = state[i][l];
+			sha1_store_digest(p->c, h);
+			p->c = NULL;
+			active--;
+		}
+	}
+}
+
+#define SHA1_K0 0x5A827999
+#define SHA1_K1 0x6ED9EBA1
+#define SHA1_K2 0x8F1BBCDC
+#define SHA1_K3 0xCA62C1D6
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+#define ROL256(x, n) \
+	_mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+AVX2_TARGET
+static inline __m256i avx2_load_words(const unsigned char *blocks[], int t,
+		__m256i bswap) {
+	__m256i lo = _mm256_set_epi64x((int64_t) (blocks[3] + t * 4),
+			(int64_t) (blocks[2] + t * 4), (int64_t) (blocks[1] + t * 4),
+			(int64_t) (blocks[0] + t * 4));
+	__m256i hi = _mm256_set_epi64x((int64_t) (blocks[7] + t * 4),
+			(int64_t) (blocks[6] + t * 4), (int64_t) (blocks[5] + t * 4),
+			(int64_t) (blocks[4] + t * 4));
+	__m256i w = _mm256_set_m128i(_mm256_i64gather_epi32(NULL, hi, 1),
+			_mm256_i64gather_epi32(NULL, lo, 1));
+	return _mm256_shuffle_epi8(w, bswap);
+}
+
+AVX2_TARGET
+static void sha1_avx2_compress(uint32_t state[5][SHA1_MB_MAX_LANES],
+		const unsigned char *blocks[SHA1_MB_MAX_LANES]) {
+	const __m256i bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5,
+			6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2,
+			3);
+	__m256i W[16];
+	__m256i a, b, c, d, e, f, k, tmp;
+	int t;
+
+	a = _mm256_loadu_si256((const __m256i*) state[0]);
+	b = _mm256_loadu_si256((const __m256i*) state[1]);
+	c = _mm256_loadu_si256((const __m256i*) state[2]);
+	d = _mm256_loadu_si256((const __m256i*) state[3]);
+	e = _mm256_loadu_si256((const __m256i*) state[4]);
+
+	for (t = 0; t < 16; t++)
+		W[t] = avx2_load_words(blocks, t, bswap);
+
+	for (t = 0; t < 80; t++) {
+		if (t >= 16) {
+			tmp = _mm256_xor_si256(
+					_mm256_xor_si256(W[(t - 3) & 15], W[(t - 8) & 15]),
+					_mm256_xor_si256(W[(t - 14) & 15], W[t & 15]));
+			W[t & 15] = ROL256(tmp, 1);
+		}
+
+		if (t < 20) {
+			f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+			k = _mm256_set1_epi32(SHA1_K0);
+		} else if (t < 40) {
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			k = _mm256_set1_epi32(SHA1_K1);
+		} else if (t < 60) {
+			f = _mm256_or_si256(_mm256_and_si256(b, c),
+					_mm256_and_si256(d, _mm256_or_si256(b, c)));
+			k = _mm256_set1_epi32(SHA1_K2);
+		} else {
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			k = _mm256_set1_epi32(SHA1_K3);
+		}
+
+		tmp = _mm256_add_epi32(_mm256_add_epi32(ROL256(a, 5), f),
+				_mm256_add_epi32(_mm256_add_epi32(e, k), W[t & 15]));
+		e = d;
+		d = c;
+		c = ROL256(b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	_mm256_storeu_si256((__m256i*) state[0],
+			_mm256_add_epi32(a, _mm256_loadu_si256((const __m256i*) state[0])));
+	_mm256_storeu_si256((__m256i*) state[1],
+			_mm256_add_epi32(b, _mm256_loadu_si256((const __m256i*) state[1])));
+	_mm256_storeu_si256((__m256i*) state[2],
+			_mm256_add_epi32(c, _mm256_loadu_si256((const __m256i*) state[2])));
+	_mm256_storeu_si256((__m256i*) state[3],
+			_mm256_add_epi32(d, _mm256_loadu_si256((const __m256i*) state[3])));
+	_mm256_storeu_si256((__m256i*) state[4],
+			_mm256_add_epi32(e, _mm256_loadu_si256((const __m256i*) state[4])));
+}
+
+static void sha1_avx2(struct chunk **chunks, int n) {
+	sha1_multi_buffer(chunks, n, 8, sha1_avx2_compress);
+}
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw")))
+
+AVX512_TARGET
+static inline __m512i avx512_load_words(const unsigned char *blocks[], int t,
+		__m512i bswap) {
+	__m512i lo = _mm512_set_epi64((int64_t) (blocks[7] + t * 4),
+			(int64_t) (blocks[6] + t * 4), (int64_t) (blocks[5] + t * 4),
+			(int64_t) (blocks[4] + t * 4), (int64_t) (blocks[3] + t * 4),
+			(int64_t) (blocks[2] + t * 4), (int64_t) (blocks[1] + t * 4),
+			(int64_t) (blocks[0] + t * 4));
+	__m512i hi = _mm512_set_epi64((int64_t) (blocks[15] + t * 4),
+			(int64_t) (blocks[14] + t * 4), (int64_t) (blocks[13] + t * 4),
+			(int64_t) (blocks[12] + t * 4), (int64_t) (blocks[11] + t * 4),
+			(int64_t) (blocks[10] + t * 4), (int64_t) (blocks[9] + t * 4),
+			(int64_t) (blocks[8] + t * 4));
+	__m512i w = _mm512_inserti64x4(
+			_mm512_castsi256_si512(_mm512_i64gather_epi32(lo, NULL, 1)),
+			_mm512_i64gather_epi32(hi, NULL, 1), 1);
+	return _mm512_shuffle_epi8(w, bswap);
+}
+
+AVX512_TARGET
+static void sha1_avx512_compress(uint32_t state[5][SHA1_MB_MAX_LANES],
+		const unsigned char *blocks[SHA1_MB_MAX_LANES]) {
+	const __m512i bswap = _mm512_broadcast_i32x4(
+			_mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+	__m512i W[16];
+	__m512i a, b, c, d, e, f, k, tmp;
+	int t;
+
+	a = _mm512_loadu_si512(state[0]);
+	b = _mm512_loadu_si512(state[1]);
+	c = _mm512_loadu_si512(state[2]);
+	d = _mm512_loadu_si512(state[3]);
+	e = _mm512_loadu_si512(state[4]);
+
+	for (t = 0; t < 16; t++)
+		W[t] = avx512_load_words(blocks, t, bswap);
+
+	for (t = 0; t < 80; t++) {
+		if (t >= 16) {
+			tmp = _mm512_ternarylogic_epi32(W[(t - 3) & 15], W[(t - 8) & 15],
+					W[(t - 14) & 15], 0x96);
+			W[t & 15] = _mm512_rol_epi32(_mm512_xor_si512(tmp, W[t & 15]), 1);
+		}
+
+		if (t < 20) {
+			f = _mm512_ternarylogic_epi32(b, c, d, 0xCA);
+			k = _mm512_set1_epi32(SHA1_K0);
+		} else if (t < 40) {
+			f = _mm512_ternarylogic_epi32(b, c, d, 0x96);
+			k = _mm512_set1_epi32(SHA1_K1);
+		} else if (t < 60) {
+			f = _mm512_ternarylogic_epi32(b, c, d, 0xE8);
+			k = _mm512_set1_epi32(SHA1_K2);
+		} else {
+			f = _mm512_ternarylogic_epi32(b, c, d, 0x96);
+			k = _mm512_set1_epi32(SHA1_K3);
+		}
+
+		tmp = _mm512_add_epi32(_mm512_add_epi32(_mm512_rol_epi32(a, 5), f),
+				_mm512_add_epi32(_mm512_add_epi32(e, k), W[t & 15]));
+		e = d;
+		d = c;
+		c = _mm512_rol_epi32(b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	_mm512_storeu_si512(state[0], _mm512_add_epi32(a, _mm512_loadu_si512(state[0])));
+	_mm512_storeu_si512(state[1], _mm512_add_epi32(b, _mm512_loadu_si512(state[1])));
+	_mm512_storeu_si512(state[2], _mm512_add_epi32(c, _mm512_loadu_si512(state[2])));
+	_mm512_storeu_si512(state[3], _mm512_add_epi32(d, _mm512_loadu_si512(state[3])));
+	_mm512_storeu_si512(state[4], _mm512_add_epi32(e, _mm512_loadu_si512(state[4])));
+}
+
+static void sha1_avx512(struct chunk **chunks, int n) {
+	sha1_multi_buffer(chunks, n, 16, sha1_avx512_compress);
+}
+
+static int cpu_has_sha_ni() {
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (ebx >> 29) & 1;
+}
+
+#endif /* FINGERPRINT_X86 */
+
+void init_fingerprint() {
+	if (destor.fingerprint_algorithm == FINGERPRINT_SHA256) {
+		fingerprint_kernel = sha256_openssl;
+		kernel_name = "sha256-openssl";
+		return;
+	}
+
+	fingerprint_kernel = sha1_openssl;
+	kernel_name = "sha1-openssl";
+
+#ifdef FINGERPRINT_X86
+	__builtin_cpu_init();
+	if (cpu_has_sha_ni() && __builtin_cpu_supports("sse4.1")
+			&& __builtin_cpu_supports("ssse3")) {
+		fingerprint_kernel = sha1_shani;
+		kernel_name = "sha1-shani";
+	} else if (__builtin_cpu_supports("avx512f")
+			&& __builtin_cpu_supports("avx512bw")) {
+		fingerprint_kernel = sha1_avx512;
+		kernel_name = "sha1-avx512-x16";
+	} else if (__builtin_cpu_supports("avx2")) {
+		fingerprint_kernel = sha1_avx2;
+		kernel_name = "sha1-avx2-x8";
+	}
+#endif
+}
+
+const char* fingerprint_kernel_name() {
+	return kernel_name;
+}
+
+void fingerprint_chunks(struct chunk **chunks, int n) {
+	if (fingerprint_kernel == NULL)
+		init_fingerprint();
+	fingerprint_kernel(chunks, n);
+}
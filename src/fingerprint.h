@@ -0,0 +1,28 @@
+/*
+ * fingerprint.h
+ *
+ *  Batched fingerprinting of chunks.
+ */
+
+#ifndef FINGERPRINT_H_
+#define FINGERPRINT_H_
+
+#include "destor.h"
+
+/* The max number of chunks hashed in a batch. */
+#define FINGERPRINT_BATCH 16
+
+/*
+ * Select a kernel according to destor.fingerprint_algorithm
+ * and the CPU features detected at runtime.
+ */
+void init_fingerprint();
+const char* fingerprint_kernel_name();
+
+/*
+ * Fingerprint n chunks.
+ * Signal chunks (FILE_START/END) in the vector are skipped.
+ */
+void fingerprint_chunks(struct chunk **chunks, int n);
+
+#endif /* FINGERPRINT_H_ */
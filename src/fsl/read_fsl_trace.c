@@ -118,7 +118,7 @@ void* read_fsl_trace(void *argv)
 
 		SET_CHUNK(c, CHUNK_FILE_START);
 
-		sync_queue_push(trace_queue, c);
+		spsc_ring_push(trace_queue, c);
 
 		/* Go over the chunks in the current file */
 		chunk_count = 0;
@@ -144,19 +144,19 @@ void* read_fsl_trace(void *argv)
             memset(c->fp, 0, sizeof(fingerprint));
             memcpy(c->fp, ci->hash, hashfile_hash_size(handle) / 8);
 
-			sync_queue_push(trace_queue, c);
+			spsc_ring_push(trace_queue, c);
 
 		}
 
 		c = new_chunk(0);
 		SET_CHUNK(c, CHUNK_FILE_END);
-		sync_queue_push(trace_queue, c);
+		spsc_ring_push(trace_queue, c);
 
 	}
 
 	hashfile_close(handle);
 
-	sync_queue_term(trace_queue);
+	spsc_ring_term(trace_queue);
 
     return NULL;
 }
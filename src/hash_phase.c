@@ -1,48 +1,173 @@
 #include "destor.h"
 #include "jcr.h"
 #include "backup.h"
+#include "fingerprint.h"
 
 static pthread_t hash_t;
 static int64_t chunk_num;
 
-static void* sha1_thread(void* arg) {
+/*
+ * With hash-thread-num > 1,
+ * a dispatcher deals batches of chunks round-robin to the workers,
+ * and a collector pops them back in the same order,
+ * so the stream order (including FILE_START/END) is kept.
+ */
+struct hashWorker {
+	pthread_t tid;
+	SpscRing *input;
+	SpscRing *output;
+	/* Accumulated locally to avoid racing on jcr.hash_time. */
+	double hash_time;
+};
+
+static struct hashWorker *workers;
+static pthread_t dispatch_t;
+
+/*
+ * Pop n chunks (including signal chunks) from the ring,
+ * or fewer at the end of the stream.
+ * Return 0 if the ring is terminated and empty.
+ */
+static int pop_batch(SpscRing *q, struct chunk **batch, int n) {
+	int num = 0, got;
+	while (num < n && (got = spsc_ring_pop_batch(q, (void**) batch + num,
+			n - num)) > 0)
+		num += got;
+	return num;
+}
+
+static void log_chunk(struct chunk *c) {
 	char code[41];
+	if (CHECK_CHUNK(c, CHUNK_FILE_START) || CHECK_CHUNK(c, CHUNK_FILE_END))
+		return;
+	hash2code(c->fp, code);
+	code[40] = 0;
+	VERBOSE("Hash phase: %ldth chunk identified by %s", chunk_num++, code);
+}
+
+static void* hash_thread(void* arg) {
+	struct chunk* batch[FINGERPRINT_BATCH];
+	int num, i;
+	while ((num = pop_batch(chunk_queue, batch, FINGERPRINT_BATCH)) > 0) {
+		TIMER_DECLARE(1);
+		TIMER_BEGIN(1);
+		fingerprint_chunks(batch, num);
+		TIMER_END(1, jcr.hash_time);
+
+		for (i = 0; i < num; i++)
+			log_chunk(batch[i]);
+		spsc_ring_push_batch(hash_queue, (void**) batch, num);
+	}
+	spsc_ring_term(hash_queue);
+	return NULL;
+}
+
+static void* hash_worker_thread(void* arg) {
+	struct hashWorker *w = arg;
+	struct chunk* batch[FINGERPRINT_BATCH];
+	int num, i;
+	while ((num = pop_batch(w->input, batch, FINGERPRINT_BATCH)) > 0) {
+		TIMER_DECLARE(1);
+		TIMER_BEGIN(1);
+		fingerprint_chunks(batch, num);
+		TIMER_END(1, w->hash_time);
+
+		spsc_ring_push_batch(w->output, (void**) batch, num);
+	}
+	spsc_ring_term(w->output);
+	return NULL;
+}
+
+/*
+ * Each worker is dealt FINGERPRINT_BATCH consecutive chunks in turn,
+ * so that it always pops a whole batch.
+ */
+static void* hash_dispatch_thread(void* arg) {
+	int next = 0, dealt = 0;
 	while (1) {
-		struct chunk* c = sync_queue_pop(chunk_queue);
+		struct chunk* c = spsc_ring_pop(chunk_queue);
 
 		if (c == NULL) {
-			sync_queue_term(hash_queue);
+			int i;
+			for (i = 0; i < destor.hash_thread_num; i++)
+				spsc_ring_term(workers[i].input);
 			break;
 		}
 
-		if (CHECK_CHUNK(c, CHUNK_FILE_START) || CHECK_CHUNK(c, CHUNK_FILE_END)) {
-			sync_queue_push(hash_queue, c);
-			continue;
+		spsc_ring_push(workers[next].input, c);
+		if (++dealt == FINGERPRINT_BATCH) {
+			dealt = 0;
+			next = (next + 1) % destor.hash_thread_num;
 		}
+	}
+	return NULL;
+}
 
-		TIMER_DECLARE(1);
-		TIMER_BEGIN(1);
-		SHA_CTX ctx;
-		SHA_Init(&ctx);
-		SHA_Update(&ctx, c->data, c->size);
-		SHA_Final(c->fp, &ctx);
-		TIMER_END(1, jcr.hash_time);
+/*
+ * Collect hashed chunks in the order they were dispatched.
+ * The first terminated worker in turn indicates the end of the stream.
+ */
+static void* hash_collect_thread(void* arg) {
+	int next = 0, collected = 0;
+	while (1) {
+		struct chunk* c = spsc_ring_pop(workers[next].output);
 
-		hash2code(c->fp, code);
-		code[40] = 0;
-		VERBOSE("Hash phase: %ldth chunk identified by %s", chunk_num++, code);
+		if (c == NULL) {
+			spsc_ring_term(hash_queue);
+			break;
+		}
+		if (++collected == FINGERPRINT_BATCH) {
+			collected = 0;
+			next = (next + 1) % destor.hash_thread_num;
+		}
 
-		sync_queue_push(hash_queue, c);
+		log_chunk(c);
+		spsc_ring_push(hash_queue, c);
 	}
 	return NULL;
 }
 
 void start_hash_phase() {
-	hash_queue = sync_queue_new(100);
-	pthread_create(&hash_t, NULL, sha1_thread, NULL);
+	hash_queue = spsc_ring_new(100);
+
+	init_fingerprint();
+	NOTICE("hash phase: fingerprint kernel %s", fingerprint_kernel_name());
+
+	if (destor.hash_thread_num <= 1) {
+		pthread_create(&hash_t, NULL, hash_thread, NULL);
+		return;
+	}
+
+	workers = malloc(sizeof(struct hashWorker) * destor.hash_thread_num);
+	int i;
+	for (i = 0; i < destor.hash_thread_num; i++) {
+		workers[i].input = spsc_ring_new(100);
+		workers[i].output = spsc_ring_new(100);
+		workers[i].hash_time = 0;
+		pthread_create(&workers[i].tid, NULL, hash_worker_thread, &workers[i]);
+	}
+	pthread_create(&dispatch_t, NULL, hash_dispatch_thread, NULL);
+	pthread_create(&hash_t, NULL, hash_collect_thread, NULL);
 }
 
 void stop_hash_phase() {
 	pthread_join(hash_t, NULL);
+
+	if (destor.hash_thread_num > 1) {
+		pthread_join(dispatch_t, NULL);
+		int i;
+		double hash_time = 0;
+		for (i = 0; i < destor.hash_thread_num; i++) {
+			pthread_join(workers[i].tid, NULL);
+			/* wall-clock estimate of the parallel hashing */
+			hash_time += workers[i].hash_time;
+			spsc_ring_free(workers[i].input, NULL);
+			spsc_ring_free(workers[i].output, NULL);
+		}
+		jcr.hash_time += hash_time / destor.hash_thread_num;
+		free(workers);
+		workers = NULL;
+	}
+
 	NOTICE("hash phase stops successfully!");
 }
@@ -9,8 +9,15 @@
 #include "../storage/containerstore.h"
 #include "../recipe/recipestore.h"
 #include "../utils/lru_cache.h"
+#include "prefetcher.h"
 
 static struct lruCache* lru_queue;
+/*
+ * The dedup workers check the cache while a segment is looked up,
+ * so every access to lru_queue holds the lock.
+ * Reading a unit is out of the lock.
+ */
+static pthread_mutex_t lru_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* defined in index.c */
 extern struct {
@@ -37,21 +44,36 @@ int lookup_fingerprint_in_cached_segment_recipe(struct cachedSegment *cs, finger
     return hit;
 }
 
+static void cached_segment_recipe_foreach_fingerprint(struct cachedSegment *cs,
+        void (*visit)(void* fp, void* arg), void* arg){
+    segment_recipe_foreach_fingerprint(cs->sr, visit, arg);
+}
 
 
+/*
+ * The caches are indexed by fingerprints,
+ * a lookup costs a hash probe instead of a probe per cached unit.
+ */
 void init_fingerprint_cache(){
 	switch(destor.index_category[1]){
 	case INDEX_CATEGORY_PHYSICAL_LOCALITY:
-		lru_queue = new_lru_cache(destor.index_cache_size,
-				free_container_meta, lookup_fingerprint_in_container_meta);
+		lru_queue = new_indexed_lru_cache(destor.index_cache_size,
+				free_container_meta, NULL,
+				container_meta_foreach_fingerprint,
+				g_int_hash, (GEqualFunc)g_fingerprint_equal);
+		init_prefetcher();
 		break;
 	case INDEX_CATEGORY_LOGICAL_LOCALITY:		
 		if(destor.index_specific == INDEX_SPECIFIC_LEARN)
-			lru_queue = new_lru_cache(destor.index_cache_size,
-				free_cached_segment_recipe, lookup_fingerprint_in_cached_segment_recipe);
+			lru_queue = new_indexed_lru_cache(destor.index_cache_size,
+				free_cached_segment_recipe, lookup_fingerprint_in_cached_segment_recipe,
+				cached_segment_recipe_foreach_fingerprint,
+				g_int_hash, (GEqualFunc)g_fingerprint_equal);
 		else
-			lru_queue = new_lru_cache(destor.index_cache_size,
-				free_segment_recipe, lookup_fingerprint_in_segment_recipe);
+			lru_queue = new_indexed_lru_cache(destor.index_cache_size,
+				free_segment_recipe, NULL,
+				segment_recipe_foreach_fingerprint,
+				g_int_hash, (GEqualFunc)g_fingerprint_equal);
 		break;
 	default:
 		WARNING("Invalid index category!");
@@ -60,9 +82,19 @@ void init_fingerprint_cache(){
 }
 
 void close_fingerprint_cache(){
+    if (destor.index_category[1] == INDEX_CATEGORY_PHYSICAL_LOCALITY)
+        close_prefetcher();
     free_lru_cache(lru_queue);
 }
 
+/* Whether fp is cached, without touching the cache. */
+int fingerprint_cache_contains(fingerprint *fp){
+	pthread_mutex_lock(&lru_mutex);
+	int ret = lru_cache_lookup_without_update(lru_queue, fp) != NULL;
+	pthread_mutex_unlock(&lru_mutex);
+	return ret;
+}
+
 
 
 
@@ -83,11 +115,13 @@ struct cachedSegment* new_cached_segment(struct segmentRecipe *sr, fingerprint *
 
 
 int64_t fingerprint_cache_lookup(fingerprint *fp){
+	int64_t id = TEMPORARY_ID;
+	pthread_mutex_lock(&lru_mutex);
 	switch(destor.index_category[1]){
 		case INDEX_CATEGORY_PHYSICAL_LOCALITY:{
 			struct containerMeta* cm = lru_cache_lookup(lru_queue, fp);
 			if (cm)
-				return cm->id;
+				id = cm->id;
 			break;
 		}
 		case INDEX_CATEGORY_LOGICAL_LOCALITY:{
@@ -98,21 +132,27 @@ int64_t fingerprint_cache_lookup(fingerprint *fp){
 					WARNING("expect > TEMPORARY_ID, but being %lld", cp->id);
 					assert(cp->id > TEMPORARY_ID);
 				}
-				return cp->id;
+				id = cp->id;
 			}
 			break;
 		}
 	}
-	return TEMPORARY_ID;
+	pthread_mutex_unlock(&lru_mutex);
+	return id;
 }
 
 void fingerprint_cache_prefetch(int64_t id){
 	switch(destor.index_category[1]){
 		case INDEX_CATEGORY_PHYSICAL_LOCALITY:{
-			struct containerMeta * cm = retrieve_container_meta_by_id(id);
+			/* It is usually submitted to the prefetcher ahead. */
+			struct containerMeta * cm = prefetcher_take(id);
+			if (!cm)
+				cm = retrieve_container_meta_by_id(id);
 			index_overhead.read_prefetching_units++;
 			if (cm) {
+				pthread_mutex_lock(&lru_mutex);
 				lru_cache_insert(lru_queue, cm, NULL, NULL);
+				pthread_mutex_unlock(&lru_mutex);
 			} else{
 				WARNING("Error! The container %lld has not been written!", id);
 				exit(1);
@@ -120,7 +160,10 @@ void fingerprint_cache_prefetch(int64_t id){
 			break;
 		}
 		case INDEX_CATEGORY_LOGICAL_LOCALITY:{
-			if (!lru_cache_hits(lru_queue, &id, segment_recipe_check_id)){
+			pthread_mutex_lock(&lru_mutex);
+			int hit = lru_cache_hits(lru_queue, &id, segment_recipe_check_id);
+			pthread_mutex_unlock(&lru_mutex);
+			if (!hit){
 				/*
 				 * If the segment we need is already in cache,
 				 * we do not need to read it.
@@ -134,6 +177,7 @@ void fingerprint_cache_prefetch(int64_t id){
 						destor.index_cache_size);
 
 				struct segmentRecipe* sr;
+				pthread_mutex_lock(&lru_mutex);
 				while ((sr = g_queue_pop_tail(segments))) {
 					/* From tail to head */
 					if (!lru_cache_hits(lru_queue, &sr->id, segment_recipe_check_id)) {
@@ -143,6 +187,7 @@ void fingerprint_cache_prefetch(int64_t id){
 						free_segment_recipe(sr);
 					}
 				}
+				pthread_mutex_unlock(&lru_mutex);
 				g_queue_free(segments);
 			}
 			break;
@@ -208,7 +253,10 @@ int learn_fingerprint_cache_prefetch(fingerprint *fp, cst_entry_segment* cst_seg
      * If the segment we need is already in cache,
      * we do not need to read it.
      */
-    if(lru_cache_hits(lru_queue, &cst_seg->id, cached_segment_recipe_check_id))
+    pthread_mutex_lock(&lru_mutex);
+    int hit = lru_cache_hits(lru_queue, &cst_seg->id, cached_segment_recipe_check_id);
+    pthread_mutex_unlock(&lru_mutex);
+    if(hit)
         return 0;
     //prefetch data of segment id and its subsequent segments from the lower storage
     GQueue* segments = prefetch_segments(cst_seg->id, cst_seg->prefetch_num);
@@ -218,6 +266,7 @@ int learn_fingerprint_cache_prefetch(fingerprint *fp, cst_entry_segment* cst_seg
     
     struct segmentRecipe* sr;
     int cnt = 0, is_last = 1;
+    pthread_mutex_lock(&lru_mutex);
     while ((sr = g_queue_pop_tail(segments))) {
         /* From tail to head */
         if (!lru_cache_hits(lru_queue, &sr->id, cached_segment_recipe_check_id)) {
@@ -237,6 +286,7 @@ int learn_fingerprint_cache_prefetch(fingerprint *fp, cst_entry_segment* cst_seg
             free_segment_recipe(sr);
         }
     }
+    pthread_mutex_unlock(&lru_mutex);
     g_queue_free(segments);
     
     //NOTICE("after prefetch return value: %d", cnt);
@@ -245,6 +295,8 @@ int learn_fingerprint_cache_prefetch(fingerprint *fp, cst_entry_segment* cst_seg
 }
 
 int64_t learn_fingerprint_cache_lookup(fingerprint *fp){
+    int64_t id = TEMPORARY_ID;
+    pthread_mutex_lock(&lru_mutex);
     struct cachedSegment* cs = lru_cache_lookup(lru_queue, fp);
     if(cs){
         struct chunkPointer* cp = g_hash_table_lookup(cs->sr->kvpairs, fp);
@@ -253,9 +305,10 @@ int64_t learn_fingerprint_cache_lookup(fingerprint *fp){
             assert(cp->id > TEMPORARY_ID);
         }
         cs->score++;
-        return cp->id;
+        id = cp->id;
     }
-    return TEMPORARY_ID;
+    pthread_mutex_unlock(&lru_mutex);
+    return id;
 }
 
 
@@ -12,5 +12,6 @@ void init_fingerprint_cache();
 void close_fingerprint_cache();
 int64_t fingerprint_cache_lookup(fingerprint *fp);
 void fingerprint_cache_prefetch(int64_t id);
+int fingerprint_cache_contains(fingerprint *fp);
 
 #endif /* FINGERPRINT_CACHE_H_ */
@@ -0,0 +1,354 @@
+/*
+ * fp_table.c
+ *
+ *  Control bytes:
+ *  EMPTY and DELETED have the sign bit set,
+ *  a full slot holds the low 7 bits of the hash (h2).
+ *  A probe starts at the slot indexed by the high bits (h1)
+ *  and visits groups of 16 slots in triangular order,
+ *  until a group with an EMPTY slot is met.
+ */
+#include "fp_table.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CTRL_EMPTY ((int8_t) -128)
+#define CTRL_DELETED ((int8_t) -2)
+
+/* The max load factor is 7/8, counting tombstones. */
+#define MAX_LOAD(cap) ((cap) - (cap) / 8)
+
+#define entry_at(t, i) ((t)->entries + (i) * (t)->entry_size)
+
+/*
+ * The image of a table in a file, which is mapped as it is:
+ * the header, ctrl at FP_TABLE_ALIGN, then entries at the next FP_TABLE_ALIGN.
+ */
+#define FP_TABLE_MAGIC "FPTABLE1"
+#define FP_TABLE_ALIGN 4096
+#define align_up(n) (((n) + FP_TABLE_ALIGN - 1) & ~(int64_t) (FP_TABLE_ALIGN - 1))
+
+struct fpTableImage {
+	char magic[8];
+	int32_t key_size;
+	int32_t entry_size;
+	int64_t capacity;
+	int64_t size;
+	int64_t deleted;
+	/* for the user of the image, e.g., which deltas it includes */
+	int64_t tag;
+};
+
+#define image_entries_offset(capacity) \
+	(FP_TABLE_ALIGN + align_up((capacity) + FP_TABLE_GROUP))
+
+uint64_t fp_table_hash(const char* key, int key_size) {
+	uint64_t h = 0, x = 0;
+	memcpy(&h, key, key_size < 8 ? key_size : 8);
+	if (key_size > 8) {
+		memcpy(&x, key + 8, key_size < 16 ? key_size - 8 : 8);
+		h ^= x * 0x9e3779b97f4a7c15ULL;
+	}
+	/* fmix64 of MurmurHash3, keys are not always fingerprints */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+#define fp_hash(t, key) fp_table_hash(key, (t)->key_size)
+
+/* Bit i is set if ctrl[pos + i] == v. */
+static inline uint32_t group_match(const int8_t* ctrl, int8_t v) {
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i*) ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(v)));
+#else
+	uint32_t m = 0;
+	int i;
+	for (i = 0; i < FP_TABLE_GROUP; i++)
+		if (ctrl[i] == v)
+			m |= 1u << i;
+	return m;
+#endif
+}
+
+/* Bit i is set if ctrl[pos + i] is EMPTY or DELETED. */
+static inline uint32_t group_match_free(const int8_t* ctrl) {
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) ctrl));
+#else
+	uint32_t m = 0;
+	int i;
+	for (i = 0; i < FP_TABLE_GROUP; i++)
+		if (ctrl[i] < 0)
+			m |= 1u << i;
+	return m;
+#endif
+}
+
+static inline void set_ctrl(struct fpTable* t, int64_t i, int8_t v) {
+	t->ctrl[i] = v;
+	if (i < FP_TABLE_GROUP)
+		t->ctrl[t->capacity + i] = v;
+}
+
+static void table_alloc(struct fpTable* t, int64_t capacity) {
+	t->capacity = capacity;
+	t->size = 0;
+	t->deleted = 0;
+	t->ctrl = malloc(capacity + FP_TABLE_GROUP);
+	memset(t->ctrl, CTRL_EMPTY, capacity + FP_TABLE_GROUP);
+	t->entries = malloc(capacity * t->entry_size);
+}
+
+/* Release the arrays, which are either in the heap or in a mapped image. */
+static void table_release(struct fpTable* t, int8_t *ctrl, char *entries) {
+	if (t->map) {
+		munmap(t->map, t->map_size);
+		t->map = NULL;
+		t->map_size = 0;
+	} else {
+		free(ctrl);
+		free(entries);
+	}
+}
+
+struct fpTable* fp_table_new(int key_size, int value_size, int64_t hint) {
+	struct fpTable* t = malloc(sizeof(struct fpTable));
+	t->key_size = key_size;
+	t->entry_size = key_size + value_size;
+	t->map = NULL;
+	t->map_size = 0;
+
+	int64_t capacity = FP_TABLE_GROUP;
+	while (MAX_LOAD(capacity) < hint)
+		capacity <<= 1;
+	table_alloc(t, capacity);
+	return t;
+}
+
+void fp_table_free(struct fpTable* t) {
+	table_release(t, t->ctrl, t->entries);
+	free(t);
+}
+
+static int64_t find(struct fpTable* t, const char* key, uint64_t h) {
+	int64_t mask = t->capacity - 1;
+	int64_t pos = (h >> 7) & mask;
+	int8_t h2 = h & 0x7f;
+	int64_t step = 0;
+
+	while (1) {
+		uint32_t m = group_match(t->ctrl + pos, h2);
+		while (m) {
+			int64_t i = (pos + __builtin_ctz(m)) & mask;
+			if (memcmp(entry_at(t, i), key, t->key_size) == 0)
+				return i;
+			m &= m - 1;
+		}
+		if (group_match(t->ctrl + pos, CTRL_EMPTY))
+			return -1;
+		step += FP_TABLE_GROUP;
+		pos = (pos + step) & mask;
+	}
+}
+
+/* The first EMPTY or DELETED slot in the probe sequence of h. */
+static int64_t find_free(struct fpTable* t, uint64_t h) {
+	int64_t mask = t->capacity - 1;
+	int64_t pos = (h >> 7) & mask;
+	int64_t step = 0;
+
+	while (1) {
+		uint32_t m = group_match_free(t->ctrl + pos);
+		if (m)
+			return (pos + __builtin_ctz(m)) & mask;
+		step += FP_TABLE_GROUP;
+		pos = (pos + step) & mask;
+	}
+}
+
+static void rehash(struct fpTable* t, int64_t capacity) {
+	int8_t *old_ctrl = t->ctrl;
+	char *old_entries = t->entries;
+	int64_t old_capacity = t->capacity, i;
+
+	table_alloc(t, capacity);
+
+	for (i = 0; i < old_capacity; i++) {
+		if (old_ctrl[i] < 0)
+			continue;
+		char *e = old_entries + i * t->entry_size;
+		uint64_t h = fp_hash(t, e);
+		int64_t j = find_free(t, h);
+		set_ctrl(t, j, h & 0x7f);
+		memcpy(entry_at(t, j), e, t->entry_size);
+		t->size++;
+	}
+
+	table_release(t, old_ctrl, old_entries);
+}
+
+char* fp_table_lookup(struct fpTable* t, const char* key) {
+	return fp_table_lookup_hashed(t, key, fp_hash(t, key));
+}
+
+char* fp_table_lookup_hashed(struct fpTable* t, const char* key, uint64_t h) {
+	int64_t i = find(t, key, h);
+	return i < 0 ? NULL : entry_at(t, i);
+}
+
+void fp_table_prefetch(struct fpTable* t, uint64_t h) {
+	int64_t pos = (h >> 7) & (t->capacity - 1);
+	__builtin_prefetch(t->ctrl + pos);
+	/* The key is usually in the first slots of the group. */
+	__builtin_prefetch(entry_at(t, pos));
+}
+
+char* fp_table_insert(struct fpTable* t, const char* key, int *inserted) {
+	uint64_t h = fp_hash(t, key);
+	int64_t i = find(t, key, h);
+	if (i >= 0) {
+		if (inserted)
+			*inserted = 0;
+		return entry_at(t, i);
+	}
+
+	if (t->size + t->deleted + 1 > MAX_LOAD(t->capacity)) {
+		/* grow, or only purge tombstones if they are many */
+		if (t->size + 1 > MAX_LOAD(t->capacity) / 2)
+			rehash(t, t->capacity * 2);
+		else
+			rehash(t, t->capacity);
+	}
+
+	i = find_free(t, h);
+	if (t->ctrl[i] == CTRL_DELETED)
+		t->deleted--;
+	set_ctrl(t, i, h & 0x7f);
+	memcpy(entry_at(t, i), key, t->key_size);
+	t->size++;
+
+	if (inserted)
+		*inserted = 1;
+	return entry_at(t, i);
+}
+
+void fp_table_remove(struct fpTable* t, const char* key) {
+	int64_t i = find(t, key, fp_hash(t, key));
+	if (i < 0)
+		return;
+	set_ctrl(t, i, CTRL_DELETED);
+	t->size--;
+	t->deleted++;
+}
+
+char* fp_table_next(struct fpTable* t, int64_t *pos) {
+	for (; *pos < t->capacity; (*pos)++) {
+		if (t->ctrl[*pos] >= 0)
+			return entry_at(t, (*pos)++);
+	}
+	return NULL;
+}
+
+int64_t fp_table_memory(struct fpTable* t) {
+	return t->capacity * (t->entry_size + 1) + FP_TABLE_GROUP;
+}
+
+/*
+ * The mapping is private: pages are read in on demand,
+ * and modified pages are copied, never written back to the file.
+ */
+struct fpTable* fp_table_map(const char* path, int key_size, int value_size,
+		int64_t *tag) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	struct fpTableImage *img = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= FP_TABLE_ALIGN)
+		img = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+				0);
+	close(fd);
+	if (img == MAP_FAILED)
+		return NULL;
+
+	if (memcmp(img->magic, FP_TABLE_MAGIC, sizeof(img->magic))
+			|| img->key_size != key_size
+			|| img->entry_size != key_size + value_size
+			|| image_entries_offset(img->capacity)
+					+ img->capacity * img->entry_size != st.st_size) {
+		munmap(img, st.st_size);
+		return NULL;
+	}
+	madvise(img, st.st_size, MADV_RANDOM);
+
+	struct fpTable* t = malloc(sizeof(struct fpTable));
+	t->key_size = key_size;
+	t->entry_size = img->entry_size;
+	t->capacity = img->capacity;
+	t->size = img->size;
+	t->deleted = img->deleted;
+	t->ctrl = (int8_t*) img + FP_TABLE_ALIGN;
+	t->entries = (char*) img + image_entries_offset(img->capacity);
+	t->map = img;
+	t->map_size = st.st_size;
+	if (tag)
+		*tag = img->tag;
+	return t;
+}
+
+static int write_padded(FILE *fp, const void *p, int64_t n, int64_t padded) {
+	static const char zeros[FP_TABLE_ALIGN];
+	if (n && fwrite(p, n, 1, fp) != 1)
+		return -1;
+	for (; padded > n; n += FP_TABLE_ALIGN)
+		if (fwrite(zeros, padded - n < FP_TABLE_ALIGN ? padded - n : FP_TABLE_ALIGN,
+				1, fp) != 1)
+			return -1;
+	return 0;
+}
+
+/* The image is written aside and renamed, so a mapping of path stays valid. */
+int fp_table_save(struct fpTable* t, const char* path, int64_t tag) {
+	char tmp[strlen(path) + 5];
+	sprintf(tmp, "%s.tmp", path);
+
+	FILE *fp = fopen(tmp, "w");
+	if (!fp)
+		return -1;
+
+	struct fpTableImage img;
+	memset(&img, 0, sizeof(img));
+	memcpy(img.magic, FP_TABLE_MAGIC, sizeof(img.magic));
+	img.key_size = t->key_size;
+	img.entry_size = t->entry_size;
+	img.capacity = t->capacity;
+	img.size = t->size;
+	img.deleted = t->deleted;
+	img.tag = tag;
+
+	int64_t ctrl_size = t->capacity + FP_TABLE_GROUP;
+	int ret = write_padded(fp, &img, sizeof(img), FP_TABLE_ALIGN)
+			|| write_padded(fp, t->ctrl, ctrl_size, align_up(ctrl_size))
+			|| write_padded(fp, t->entries, t->capacity * t->entry_size, 0)
+			|| fflush(fp) || fsync(fileno(fp));
+	if (fclose(fp) || ret || rename(tmp, path)) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
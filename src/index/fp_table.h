@@ -0,0 +1,76 @@
+/*
+ * fp_table.h
+ *
+ *  An open-addressing hash table of fixed-width entries,
+ *  used as the in-memory fingerprint index.
+ *  Each entry is a key of key_size bytes followed by value_size bytes,
+ *  stored inline in a flat array (Swiss-table layout):
+ *  a control byte per slot holds 7 bits of the hash,
+ *  and 16 control bytes are matched at once with SSE2.
+ */
+
+#ifndef FP_TABLE_H_
+#define FP_TABLE_H_
+
+#include <stdint.h>
+
+struct fpTable {
+	int key_size;
+	int entry_size;
+	int64_t capacity; /* a power of two, >= FP_TABLE_GROUP */
+	int64_t size;
+	int64_t deleted;
+	/* capacity + FP_TABLE_GROUP bytes; the tail mirrors the head */
+	int8_t *ctrl;
+	char *entries;
+	/* the image file mapped by fp_table_map, or NULL */
+	void *map;
+	int64_t map_size;
+};
+
+#define FP_TABLE_GROUP 16
+
+struct fpTable* fp_table_new(int key_size, int value_size, int64_t hint);
+void fp_table_free(struct fpTable* t);
+
+/* Return the entry of key, or NULL. */
+char* fp_table_lookup(struct fpTable* t, const char* key);
+/* fp_table_lookup of a key whose fp_table_hash is h. */
+char* fp_table_lookup_hashed(struct fpTable* t, const char* key, uint64_t h);
+/*
+ * Prefetch the first probed group of hash h into the CPU cache,
+ * some lookups ahead of its fp_table_lookup_hashed.
+ */
+void fp_table_prefetch(struct fpTable* t, uint64_t h);
+/*
+ * Return the entry of key, inserting it if absent.
+ * *inserted tells whether it is new; the value of a new entry is undefined.
+ * Entries may move on insertion.
+ */
+char* fp_table_insert(struct fpTable* t, const char* key, int *inserted);
+void fp_table_remove(struct fpTable* t, const char* key);
+
+/*
+ * Iterate the entries: *pos starts from 0.
+ * Return NULL at the end.
+ */
+char* fp_table_next(struct fpTable* t, int64_t *pos);
+
+/* The hash of a key, shared with the on-disk index. */
+uint64_t fp_table_hash(const char* key, int key_size);
+
+/*
+ * Save the table into path in a position-independent layout,
+ * which fp_table_map maps back without parsing.
+ * tag is kept in the image for the caller.
+ * Return 0, or -1 on failure.
+ */
+int fp_table_save(struct fpTable* t, const char* path, int64_t tag);
+/* Return NULL if path is missing or not an image of such a table. */
+struct fpTable* fp_table_map(const char* path, int key_size, int value_size,
+		int64_t *tag);
+
+/* Memory used by the table in bytes. */
+int64_t fp_table_memory(struct fpTable* t);
+
+#endif /* FP_TABLE_H_ */
@@ -2,6 +2,8 @@
 #include "kvstore.h"
 #include "fingerprint_cache.h"
 #include "index_buffer.h"
+#include "prefetcher.h"
+#include "sketch_index.h"
 #include "../storage/containerstore.h"
 #include "../recipe/recipestore.h"
 #include "../jcr.h"
@@ -133,6 +135,8 @@ void init_index() {
     else
         init_kvstore();
     init_fingerprint_cache();
+    if (destor.delta_compression)
+        init_sketch_index();
 
     index_overhead.lookup_requests = 0;
     index_overhead.update_requests = 0;
@@ -144,6 +148,8 @@ void init_index() {
 
 void close_index() {
     close_fingerprint_cache();
+    if (destor.delta_compression)
+        close_sketch_index();
     if(destor.index_specific == INDEX_SPECIFIC_LEARN)
         close_cst();
     else
@@ -159,7 +165,60 @@ extern struct{
     GSequence *chunks;
 } storage_buffer;
 
+int index_lookup_batch(fingerprint* fps, int n, int64_t* ids_out){
+    return kvstore_lookup_batch((char*)fps, sizeof(fingerprint), n, ids_out);
+}
+
+/*
+ * Look up the chunks of the segment in the key-value store in a batch,
+ * and submit the containers they will prefetch,
+ * so that they are read while earlier segments are being processed.
+ * It runs out of order in the dedup workers, so the index buffer is
+ * not checked; a needless prefetch is discarded by index_lookup_base.
+ * The IDs are kept in s->ids for index_lookup_base.
+ */
+static void index_lookahead_base(struct segment *s){
+    fingerprint *fps = malloc(sizeof(fingerprint) * s->chunk_num);
+    int *pos = malloc(sizeof(int) * s->chunk_num);
+    int64_t *ids = malloc(sizeof(int64_t) * s->chunk_num);
+    int n = 0, k = 0, i;
+
+    s->ids = malloc(sizeof(int64_t) * s->chunk_num);
+
+    GSequenceIter *iter = g_sequence_get_begin_iter(s->chunks);
+    GSequenceIter *end = g_sequence_get_end_iter(s->chunks);
+    for (; iter != end; iter = g_sequence_iter_next(iter)) {
+        struct chunk* c = g_sequence_get(iter);
+
+        if (CHECK_CHUNK(c, CHUNK_FILE_START) || CHECK_CHUNK(c, CHUNK_FILE_END))
+            continue;
+
+        s->ids[k] = TEMPORARY_ID;
+        if (!fingerprint_cache_contains(&c->fp)) {
+            pos[n] = k;
+            memcpy(&fps[n++], &c->fp, sizeof(fingerprint));
+        }
+        k++;
+    }
+
+    index_lookup_batch(fps, n, ids);
+
+    containerid last = TEMPORARY_ID;
+    for (i = 0; i < n; i++) {
+        s->ids[pos[i]] = ids[i];
+        if (ids[i] != TEMPORARY_ID && ids[i] != last) {
+            prefetcher_submit(ids[i], s->seq);
+            last = ids[i];
+        }
+    }
+
+    free(fps);
+    free(pos);
+    free(ids);
+}
+
 static void index_lookup_base(struct segment *s){
+    int k = 0;
 
     GSequenceIter *iter = g_sequence_get_begin_iter(s->chunks);
     GSequenceIter *end = g_sequence_get_end_iter(s->chunks);
@@ -169,6 +228,8 @@ static void index_lookup_base(struct segment *s){
         if (CHECK_CHUNK(c, CHUNK_FILE_START) || CHECK_CHUNK(c, CHUNK_FILE_END))
             continue;
 
+        int64_t first = s->ids ? s->ids[k++] : TEMPORARY_ID;
+
         /* First check it in the storage buffer */
         if(storage_buffer.container_buffer
                 && lookup_fingerprint_in_container(storage_buffer.container_buffer, &c->fp)){
@@ -200,13 +261,22 @@ static void index_lookup_base(struct segment *s){
             }
         }
 
-        if (!CHECK_CHUNK(c, CHUNK_DUPLICATE)) {
+        /*
+         * Only a chunk not resolved by the containers prefetched so far
+         * reaches the key-value store, and reuses the ID of index_prepare.
+         * A miss there is probed again, as earlier segments may have
+         * updated the store since; a unique chunk is usually ruled out
+         * by the Bloom filter.
+         */
+        if (!CHECK_CHUNK(c, CHUNK_DUPLICATE)
+                && (first != TEMPORARY_ID || kvstore_may_contain((char*)&c->fp))) {
             /* Searching in key-value store */
-            int64_t* ids = kvstore_lookup((char*)&c->fp);
-            if(ids){
+            if (first == TEMPORARY_ID)
+                first = kvstore_lookup_first((char*)&c->fp);
+            if(first != TEMPORARY_ID){
                 index_overhead.lookup_requests++;
                 /* prefetch the target unit */
-                fingerprint_cache_prefetch(ids[0]);
+                fingerprint_cache_prefetch(first);
                 int64_t id = fingerprint_cache_lookup(&c->fp);
                 if(id != TEMPORARY_ID){
                     /*
@@ -235,6 +305,8 @@ static void index_lookup_base(struct segment *s){
         index_buffer.chunk_num++;
     }
 
+    /* Containers covered by an earlier prefetch are not needed. */
+    prefetcher_discard(s->seq);
 }
 
 extern void index_lookup_similarity_detection(struct segment *s);
@@ -251,6 +323,20 @@ extern struct {
     int wait_threshold;
 } index_lock;
 
+/*
+ * Do the work of index_lookup that does not depend on earlier segments,
+ * so that the dedup workers run it in parallel and without index_lock.
+ */
+void index_prepare(struct segment* s) {
+    if (destor.index_specific == INDEX_SPECIFIC_LEARN
+            || (destor.index_category[1] == INDEX_CATEGORY_LOGICAL_LOCALITY
+            && destor.index_segment_selection_method[0] != INDEX_SEGMENT_SELECT_BASE))
+        s->features = sampling(s->chunks, s->chunk_num);
+    else if (destor.index_category[1] == INDEX_CATEGORY_PHYSICAL_LOCALITY
+            && destor.index_prefetch_thread_num > 0)
+        index_lookahead_base(s);
+}
+
 /*
  * return 1: indicates lookup is successful.
  * return 0: indicates the index buffer is full.
@@ -268,14 +354,16 @@ int index_lookup(struct segment* s) {
     TIMER_BEGIN(1);
     
     if (destor.index_specific == INDEX_SPECIFIC_LEARN) {
-        s->features = sampling(s->chunks, s->chunk_num);
+        if (!s->features)
+            s->features = sampling(s->chunks, s->chunk_num);
         //NOTICE("there are %d chunks in the segment (id=%lld) to sample features", s->chunk_num, s->id);
         index_lookup_learning(s);
     }
     else if(destor.index_category[1] == INDEX_CATEGORY_LOGICAL_LOCALITY
             && destor.index_segment_selection_method[0] != INDEX_SEGMENT_SELECT_BASE){
         /* Similarity-based */
-        s->features = sampling(s->chunks, s->chunk_num);
+        if (!s->features)
+            s->features = sampling(s->chunks, s->chunk_num);
         index_lookup_similarity_detection(s);
     }
     else {
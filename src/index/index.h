@@ -19,10 +19,21 @@ void init_index();
  * Free memory structures and flush them into disks.
  */
 void close_index();
+/*
+ * Prepare a segment for index_lookup, e.g., sample its features.
+ * It can be called for several segments concurrently.
+ */
+void index_prepare(struct segment*);
 /*
  * lookup fingerprints in a segment in index.
  */
 int index_lookup(struct segment*);
+/*
+ * Look up n fingerprints in the key-value store at once,
+ * ids_out[i] is the latest ID of fps[i], or TEMPORARY_ID.
+ * Return the number of fingerprints probed past the Bloom filter.
+ */
+int index_lookup_batch(fingerprint* fps, int n, int64_t* ids_out);
 /*
  * Insert/update fingerprints.
  */
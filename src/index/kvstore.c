@@ -8,13 +8,55 @@
 #include "../destor.h"
 #include "kvstore.h"
 #include "index.h"
+#include "fp_table.h"
+#include "../utils/blocked_bloom.h"
 
 #define get_key(kv) (kv)
 #define get_value(kv) ((int64_t*)(kv+destor.index_key_size))
 
-//storage table
-extern GHashTable *htable;
-static int32_t kvpair_size;
+//storage table, entries are kvpairs stored inline
+static struct fpTable *htable;
+
+/*
+ * The key-value store backend.
+ * insert returns the existing kvpair if any, which may then be modified.
+ */
+static kvpair (*kv_lookup)(char *key);
+static kvpair (*kv_insert)(char *key, int *inserted);
+static void (*kv_remove)(char *key);
+static kvpair (*kv_next)(int64_t *pos);
+static void (*kv_close)();
+/*
+ * For batched lookups, h is fp_table_hash of key.
+ * kv_prefetch is a hint some lookups ahead, and
+ * lookups in the order of kv_locality share I/O; either can be NULL.
+ */
+static kvpair (*kv_lookup_hashed)(char *key, uint64_t h);
+static void (*kv_prefetch)(uint64_t h);
+static int64_t (*kv_locality)(uint64_t h);
+
+/*
+ * The Bloom filter in front of the store (the summary vector of DDFS),
+ * saved in index/bloom, or NULL if fingerprint-index-bloom-filter is 0.
+ * As keys cannot be removed from it,
+ * it is rebuilt at close if any key is removed from the store.
+ */
+static struct blockedBloom *bloom;
+static int bloom_stale;
+
+/*
+ * The dedup workers look up the store while the filter phase updates it.
+ * A lookup of the SSD store modifies its page cache,
+ * so it takes the write lock as well.
+ */
+static pthread_rwlock_t kv_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void kv_lock_lookup() {
+	if (destor.index_key_value_store == INDEX_KEY_VALUE_SSD)
+		pthread_rwlock_wrlock(&kv_rwlock);
+	else
+		pthread_rwlock_rdlock(&kv_rwlock);
+}
 
 
 typedef char* cst_kvpair;
@@ -22,35 +64,11 @@ typedef char* cst_kvpair;
 #define get_cst_value(kv) ((cst_entry_segment*)(kv+destor.index_key_size))
 
 
-// context table
-extern GHashTable *cst;
+// context table, saved in index/cst.snap which is mapped at startup
+static struct fpTable *cst;
 extern GHashTable *ht_last_segments;
 static int32_t cst_entry_size;
 
-/*
- * Create a new kv pair.
- */
-static kvpair new_kvpair_full(char* key){
-    kvpair kvp = malloc(kvpair_size);
-    memcpy(get_key(kvp), key, destor.index_key_size);
-    int64_t* values = get_value(kvp);
-    int i;
-    for(i = 0; i<destor.index_value_length; i++){
-    	values[i] = TEMPORARY_ID;
-    }
-    return kvp;
-}
-
-static kvpair new_kvpair(){
-	 kvpair kvp = malloc(kvpair_size);
-	 int64_t* values = get_value(kvp);
-	 int i;
-	 for(i = 0; i<destor.index_value_length; i++){
-		 values[i] = TEMPORARY_ID;
-	 }
-	 return kvp;
-}
-
 /*
  * IDs in value are in FIFO order.
  * value[0] keeps the latest ID.
@@ -63,12 +81,6 @@ static void kv_update(kvpair kv, int64_t id){
 }
 
 
-static inline void free_kvpair(kvpair kvp){
-    free(kvp);
-}
-
-
-
 /*creat random numbers from 0 to 1*/
 static double get_random01() {
     return (double)rand()/(RAND_MAX+1.0);
@@ -79,13 +91,10 @@ static int get_random(int max){
 }
 
 /*
- * Create a new context table entry pair.
+ * Initialize the value of a new context table entry pair.
  */
-static kvpair new_cst_entry_pair_full(char* key, segmentid id){
-    kvpair kvp = malloc(cst_entry_size);
-    memcpy(get_key(kvp), key, destor.index_key_size);
+static void init_cst_entry_pair(kvpair kvp){
     cst_entry_segment* segs = get_cst_value(kvp);
-    
     int i;
     for(i = 0; i<destor.cst_value_length; i++){
         segs[i].id = TEMPORARY_ID;
@@ -93,23 +102,6 @@ static kvpair new_cst_entry_pair_full(char* key, segmentid id){
         segs[i].score = 0;
         segs[i].num = 0;
     }
-    segs[0].id = id;
-	
-    return kvp;
-}
-
-static kvpair new_cst_entry_pair(){
-    kvpair kvp = malloc(cst_entry_size);
-    cst_entry_segment* segs = get_cst_value(kvp);
-    int i;
-    for(i = 0; i<destor.cst_value_length; i++){
-        segs[i].id = TEMPORARY_ID;
-        segs[i].prefetch_num = destor.index_segment_prefech;
-        segs[i].score = 0;
-        segs[i].num = 0;
-    }
-    
-    return kvp;
 }
 
 static int find_segment_to_prefetch(cst_entry_segment* list){
@@ -206,7 +198,7 @@ static void cst_entry_update(kvpair kv, int64_t id ){
 
 kvpair cst_lookup(char *key){
     assert(cst);
-	return g_hash_table_lookup(cst, key);
+	return fp_table_lookup(cst, key);
 }
 
 //mark the pos-th segment is in cache and
@@ -243,7 +235,7 @@ void  cst_entry_update_from_cache_evict(struct cachedSegment *cs){
         is_last = 1;
     }
     
-	kvpair kv = g_hash_table_lookup(cst, cs->fp);
+	kvpair kv = fp_table_lookup(cst, cs->fp);
 	//determine a proper segment
 	if(kv){
 		cst_entry_segment* segs = get_cst_value(kv);
@@ -282,10 +274,11 @@ cst_entry_segment* cst_lookup_segment_to_prefetch(char* key, kvpair kv) {
  * insert a new kv pair into cst and an entry may be replaced.
  */
 void cst_update(char *key, int64_t id){
-	kvpair kv = g_hash_table_lookup(cst, key);
-	if (!kv) {
-		kv = new_cst_entry_pair_full(key, id);
-		g_hash_table_replace(cst, get_key(kv), kv);
+	int inserted;
+	kvpair kv = fp_table_insert(cst, key, &inserted);
+	if (inserted) {
+		init_cst_entry_pair(kv);
+		get_cst_value(kv)[0].id = id;
 	}
 	cst_entry_update(kv, id);
 }
@@ -294,7 +287,7 @@ void cst_update(char *key, int64_t id){
  * Remove the segment 'id' from the context entry identified by 'key' 
  */
 void cst_delete(char* key, cst_entry_segment c){
-    kvpair kv = g_hash_table_lookup(cst, key);
+    kvpair kv = fp_table_lookup(cst, key);
     if(!kv)
         return;
     
@@ -328,7 +321,7 @@ void cst_delete(char* key, cst_entry_segment c){
      */
     if(value[0].id == TEMPORARY_ID){
         /* This kvpair can be removed. */
-        g_hash_table_remove(cst, key);
+        fp_table_remove(cst, key);
     }
 }
 
@@ -339,28 +332,29 @@ void cst_delete(char* key, cst_entry_segment c){
 void init_cst(){
     cst_entry_size = destor.index_key_size + destor.cst_value_length * sizeof(cst_entry_segment) ;
     
-    if(destor.index_key_size >=4)
-        cst = g_hash_table_new_full((GHashFunc)g_int_hash, (GEqualFunc)g_feature_equal,
-                                       (GDestroyNotify)free_kvpair, NULL);
-    else
-        cst = g_hash_table_new_full((GHashFunc)g_feature_hash, (GEqualFunc)g_feature_equal,
-                                       (GDestroyNotify)free_kvpair, NULL);
-    
     sds indexpath = sdsdup(destor.working_directory);
-    indexpath = sdscat(indexpath, "index/cst");
+    indexpath = sdscat(indexpath, "index/cst.snap");
+    
+    cst = fp_table_map(indexpath, destor.index_key_size,
+                       destor.cst_value_length * sizeof(cst_entry_segment), NULL);
     
-    /* Initialize the context table from the dump file. */
+    /* Initialize the context table from the dump file in the old format. */
     FILE *fp;
-    if ((fp = fopen(indexpath, "r"))) {
+    sdsrange(indexpath, 0, -6);
+    if (!cst && (fp = fopen(indexpath, "r"))) {
         /* The number of contexts */
         int key_num;
         fread(&key_num, sizeof(int), 1, fp);
         NOTICE("there are %d keys loaded from cst file", key_num);
+        cst = fp_table_new(destor.index_key_size,
+                           destor.cst_value_length * sizeof(cst_entry_segment), key_num);
         
+        char key[destor.index_key_size];
         for (; key_num > 0; key_num--) {
             /* Read a key */
-            kvpair kv = new_cst_entry_pair();
-            fread(get_key(kv), destor.index_key_size, 1, fp);
+            fread(key, destor.index_key_size, 1, fp);
+            kvpair kv = fp_table_insert(cst, key, NULL);
+            init_cst_entry_pair(kv);
             
             /* The number of segments the key refers to. */
             int id_num, i;
@@ -376,9 +370,11 @@ void init_cst(){
                 
                 DEBUG("Read: the prefetch number of segment is %d", value[i].prefetch_num);
             }
-            g_hash_table_insert(cst, get_key(kv), kv);
         }
         fclose(fp);
+    } else if (!cst) {
+        cst = fp_table_new(destor.index_key_size,
+                           destor.cst_value_length * sizeof(cst_entry_segment), 0);
     }
     
     ht_last_segments = g_hash_table_new_full((GHashFunc)g_int64_hash,
@@ -391,54 +387,36 @@ void init_cst(){
 
 void close_cst() {
     sds indexpath = sdsdup(destor.working_directory);
-    indexpath = sdscat(indexpath, "index/cst");
-    
-    FILE *fp;
-    if ((fp = fopen(indexpath, "w")) == NULL) {
-        perror("Can not open index/htable for write because:");
-        exit(1);
-    }
+    indexpath = sdscat(indexpath, "index/cst.snap");
     
     NOTICE("flushing context table!");
-    int key_num = g_hash_table_size(cst);
-    fwrite(&key_num, sizeof(int), 1, fp);
     
-    GHashTableIter iter;
-    gpointer key, value;
-    g_hash_table_iter_init(&iter, cst);
-    while (g_hash_table_iter_next(&iter, &key, &value)) {
-        /* Write a key. */
-        kvpair kv = value;
-        if(fwrite(get_key(kv), destor.index_key_size, 1, fp) != 1){
-            perror("Fail to write a key!");
-            exit(1);
-        }
-        
-        /* Write the number of segments */
-        if(fwrite(&destor.cst_value_length, sizeof(int), 1, fp) != 1){
-            perror("Fail to write a length!");
-            exit(1);
-        }
-        
+    /* No segment is in cache in the next run. */
+    int64_t pos = 0;
+    kvpair kv;
+    while ((kv = fp_table_next(cst, &pos))) {
         cst_entry_segment* value = (cst_entry_segment*)get_value(kv);
         int i;
-        for (i = 0; i < destor.cst_value_length; i++){
-            DEBUG("Write: the prefetch number of segments is %d", value[i].prefetch_num);
-            if(fwrite(&value[i], sizeof(cst_entry_segment), 1, fp) != 1){
-                perror("Fail to write a value!");
-                exit(1);
-            }
-        }
+        for (i = 0; i < destor.cst_value_length; i++)
+            value[i].num = 0;
     }
     
+    if (fp_table_save(cst, indexpath, 0)) {
+        perror("Can not write index/cst.snap because:");
+        exit(1);
+    }
+    /* The dump in the old format is replaced. */
+    sdsrange(indexpath, 0, -6);
+    unlink(indexpath);
+    
     /* It is a rough estimation */
-    destor.index_memory_footprint = g_hash_table_size(cst) * cst_entry_size;
+    destor.index_memory_footprint = fp_table_memory(cst);
     
-    fclose(fp);
     NOTICE("flushing context hash table successfully!");
     
     sdsfree(indexpath);
-    g_hash_table_destroy(cst);
+    fp_table_free(cst);
+    cst = NULL;
     g_hash_table_destroy(ht_last_segments);
 }
 
@@ -447,112 +425,340 @@ void close_cst() {
 /*------------------------------------------------------------------------------------*/
 
 
-static void init_kvstore_htable(){
-    kvpair_size = destor.index_key_size + destor.index_value_length * 8;
+/*
+ * The hash table is saved in index/htable.snap, which is mapped at startup
+ * and paged in on demand.
+ * A run touching few keys only writes a delta, index/htable.delta.<n>,
+ * the touched entries (or their removal) to be applied on the snapshot.
+ * The snapshot is tagged with the first delta it does not include,
+ * and rewritten once the deltas exceed 1/HTABLE_DELTA_RATIO of its size.
+ * index/htable in the old format is read if there is no snapshot.
+ */
+#define HTABLE_DELTA_RATIO 8
+
+/* The keys updated or deleted in this run. */
+static struct fpTable *touched;
+static int64_t first_delta, next_delta;
+static int64_t delta_size;
+/* 0 if there is no snapshot */
+static int64_t snapshot_size;
+
+static sds htable_delta_path(int64_t n) {
+	sds path = sdsdup(destor.working_directory);
+	return sdscatprintf(path, "index/htable.delta.%" PRId64, n);
+}
 
-    if(destor.index_key_size >=4)
-    	htable = g_hash_table_new_full((GHashFunc)g_int_hash, (GEqualFunc)g_feature_equal,
-			(GDestroyNotify)free_kvpair, NULL);
-    else
-    	htable = g_hash_table_new_full((GHashFunc)g_feature_hash, (GEqualFunc)g_feature_equal,
-			(GDestroyNotify)free_kvpair, NULL);
+static void load_htable_dump(FILE *fp) {
+	/* The number of features */
+	int key_num;
+	fread(&key_num, sizeof(int), 1, fp);
+	htable = fp_table_new(destor.index_key_size,
+			destor.index_value_length * sizeof(int64_t), key_num);
+	char key[destor.index_key_size];
+	for (; key_num > 0; key_num--) {
+		/* Read a feature */
+		fread(key, destor.index_key_size, 1, fp);
+		kvpair kv = fp_table_insert(htable, key, NULL);
+
+		/* The number of segments/containers the feature refers to. */
+		int id_num, i;
+		fread(&id_num, sizeof(int), 1, fp);
+		assert(id_num <= destor.index_value_length);
 
-	sds indexpath = sdsdup(destor.working_directory);
-	indexpath = sdscat(indexpath, "index/htable");
+		for (i = 0; i < destor.index_value_length; i++)
+			get_value(kv)[i] = TEMPORARY_ID;
+		for (i = 0; i < id_num; i++)
+			/* Read an ID */
+			fread(&get_value(kv)[i], sizeof(int64_t), 1, fp);
+	}
+}
+
+/*
+ * A delta is the number of records,
+ * and each record is a flag (0 if removed) followed by the kvpair.
+ */
+static int apply_htable_delta(sds path) {
+	FILE *fp;
+	if ((fp = fopen(path, "r")) == NULL)
+		return 0;
+
+	int64_t num;
+	char rec[1 + htable->entry_size];
+	if (fread(&num, sizeof(num), 1, fp) != 1)
+		num = 0;
+	for (; num > 0; num--) {
+		if (fread(rec, sizeof(rec), 1, fp) != 1) {
+			WARNING("%s is truncated!", path);
+			exit(1);
+		}
+		if (rec[0])
+			memcpy(fp_table_insert(htable, &rec[1], NULL), &rec[1],
+					htable->entry_size);
+		else
+			fp_table_remove(htable, &rec[1]);
+	}
+	delta_size += ftell(fp);
+	fclose(fp);
+	return 1;
+}
+
+static void write_htable_delta() {
+	sds path = htable_delta_path(next_delta);
+	sds tmppath = sdscat(sdsdup(path), ".tmp");
 
-	/* Initialize the feature index from the dump file. */
 	FILE *fp;
-	if ((fp = fopen(indexpath, "r"))) {
-		/* The number of features */
-		int key_num;
-		fread(&key_num, sizeof(int), 1, fp);
-		for (; key_num > 0; key_num--) {
-			/* Read a feature */
-			kvpair kv = new_kvpair();
-			fread(get_key(kv), destor.index_key_size, 1, fp);
-
-			/* The number of segments/containers the feature refers to. */
-			int id_num, i;
-			fread(&id_num, sizeof(int), 1, fp);
-			assert(id_num <= destor.index_value_length);
-
-			for (i = 0; i < id_num; i++)
-				/* Read an ID */
-				fread(&get_value(kv)[i], sizeof(int64_t), 1, fp);
-
-			g_hash_table_insert(htable, get_key(kv), kv);
+	if ((fp = fopen(tmppath, "w")) == NULL) {
+		perror("Can not open the delta of index/htable for write because:");
+		exit(1);
+	}
+
+	char rec[1 + htable->entry_size];
+	int64_t num = touched->size, pos = 0;
+	kvpair key;
+	fwrite(&num, sizeof(num), 1, fp);
+	while ((key = fp_table_next(touched, &pos))) {
+		kvpair kv = fp_table_lookup(htable, key);
+		memset(rec, 0, sizeof(rec));
+		rec[0] = kv != NULL;
+		memcpy(&rec[1], kv ? kv : key, kv ? htable->entry_size : touched->key_size);
+		if (fwrite(rec, sizeof(rec), 1, fp) != 1) {
+			perror("Fail to write a delta record!");
+			exit(1);
 		}
-		fclose(fp);
 	}
 
+	if (fflush(fp) || fsync(fileno(fp)) || fclose(fp)
+			|| rename(tmppath, path)) {
+		perror("Fail to write the delta of index/htable because:");
+		exit(1);
+	}
+	NOTICE("%" PRId64 " kvpairs are written into %s", num, path);
+	next_delta++;
+
+	sdsfree(tmppath);
+	sdsfree(path);
+}
+
+static void init_kvstore_htable(){
+	sds indexpath = sdsdup(destor.working_directory);
+	indexpath = sdscat(indexpath, "index/htable.snap");
+
+	htable = fp_table_map(indexpath, destor.index_key_size,
+			destor.index_value_length * sizeof(int64_t), &next_delta);
+	if (htable) {
+		snapshot_size = htable->map_size;
+		/* A crash can leave the deltas included in the snapshot behind. */
+		int64_t n;
+		for (n = next_delta - 1; n > 0; n--) {
+			sds path = htable_delta_path(n);
+			int ret = unlink(path);
+			sdsfree(path);
+			if (ret)
+				break;
+		}
+	} else {
+		/* Initialize the feature index from the dump file. */
+		sdsrange(indexpath, 0, -6);
+		FILE *fp;
+		if ((fp = fopen(indexpath, "r"))) {
+			load_htable_dump(fp);
+			fclose(fp);
+		} else {
+			htable = fp_table_new(destor.index_key_size,
+					destor.index_value_length * sizeof(int64_t), 0);
+		}
+		snapshot_size = 0;
+		next_delta = 1;
+	}
+	first_delta = next_delta;
+
+	delta_size = 0;
+	for (;; next_delta++) {
+		sds path = htable_delta_path(next_delta);
+		int applied = apply_htable_delta(path);
+		sdsfree(path);
+		if (!applied)
+			break;
+	}
+
+	touched = fp_table_new(destor.index_key_size, 0, 0);
+
 	sdsfree(indexpath);
 }
 
+static kvpair htable_lookup(char *key) {
+	return fp_table_lookup(htable, key);
+}
+
+static kvpair htable_insert(char *key, int *inserted) {
+	fp_table_insert(touched, key, NULL);
+	return fp_table_insert(htable, key, inserted);
+}
+
+static void htable_remove(char *key) {
+	fp_table_insert(touched, key, NULL);
+	fp_table_remove(htable, key);
+}
+
+static kvpair htable_next(int64_t *pos) {
+	return fp_table_next(htable, pos);
+}
+
+static kvpair htable_lookup_hashed(char *key, uint64_t h) {
+	return fp_table_lookup_hashed(htable, key, h);
+}
+
+static void htable_prefetch(uint64_t h) {
+	fp_table_prefetch(htable, h);
+}
+
+static void bloom_fill() {
+	int64_t pos = 0;
+	kvpair kv;
+	blocked_bloom_clear(bloom);
+	while ((kv = kv_next(&pos)))
+		blocked_bloom_insert(bloom,
+				fp_table_hash(get_key(kv), destor.index_key_size));
+	bloom_stale = 0;
+}
+
+/*
+ * index/bloom is removed once loaded,
+ * so a crash before it is saved again leads to a rebuild.
+ */
+static void init_bloom() {
+	if (destor.index_bloom_filter_size <= 0)
+		return;
+
+	sds bloompath = sdsdup(destor.working_directory);
+	bloompath = sdscat(bloompath, "index/bloom");
+
+	bloom = blocked_bloom_load(bloompath, destor.index_bloom_filter_size);
+	if (bloom) {
+		unlink(bloompath);
+	} else {
+		NOTICE("building the Bloom filter of the fingerprint index");
+		bloom = blocked_bloom_new(destor.index_bloom_filter_size);
+		if (!bloom) {
+			WARNING("Fail to allocate the Bloom filter!");
+			exit(1);
+		}
+		bloom_fill();
+	}
+	bloom_stale = 0;
+
+	sdsfree(bloompath);
+}
+
+static void close_kvstore_htable();
+
 void init_kvstore() {
 
     switch(destor.index_key_value_store){
     	case INDEX_KEY_VALUE_HTABLE:
     		init_kvstore_htable();
+    		kv_lookup = htable_lookup;
+    		kv_insert = htable_insert;
+    		kv_remove = htable_remove;
+    		kv_next = htable_next;
+    		kv_close = close_kvstore_htable;
+    		kv_lookup_hashed = htable_lookup_hashed;
+    		kv_prefetch = htable_prefetch;
+    		kv_locality = NULL;
+    		break;
+    	case INDEX_KEY_VALUE_SSD:
+    		init_kvstore_ssd();
+    		kv_lookup = kvstore_ssd_lookup;
+    		kv_insert = kvstore_ssd_insert;
+    		kv_remove = kvstore_ssd_remove;
+    		kv_next = kvstore_ssd_next;
+    		kv_close = close_kvstore_ssd;
+    		kv_lookup_hashed = kvstore_ssd_lookup_hashed;
+    		kv_prefetch = NULL;
+    		kv_locality = kvstore_ssd_bucket;
     		break;
     	default:
     		WARNING("Invalid key-value store!");
     		exit(1);
     }
+
+    init_bloom();
 }
 
 
 
-void close_kvstore() {
+static void close_kvstore_htable() {
 	sds indexpath = sdsdup(destor.working_directory);
-	indexpath = sdscat(indexpath, "index/htable");
+	indexpath = sdscat(indexpath, "index/htable.snap");
 
-	FILE *fp;
-	if ((fp = fopen(indexpath, "w")) == NULL) {
-		perror("Can not open index/htable for write because:");
-		exit(1);
+	int64_t size = touched->size * (1 + htable->entry_size) + delta_size;
+	if (!snapshot_size || size * HTABLE_DELTA_RATIO > snapshot_size) {
+		NOTICE("flushing kvstore hash table!");
+		if (fp_table_save(htable, indexpath, next_delta)) {
+			perror("Can not write index/htable.snap because:");
+			exit(1);
+		}
+		for (; first_delta < next_delta; first_delta++) {
+			sds path = htable_delta_path(first_delta);
+			unlink(path);
+			sdsfree(path);
+		}
+		/* The dump in the old format is replaced. */
+		sdsrange(indexpath, 0, -6);
+		unlink(indexpath);
+		NOTICE("flushing kvstore hash table successfully!");
+	} else if (touched->size) {
+		write_htable_delta();
 	}
 
-	NOTICE("flushing kvstore hash table!");
-	int key_num = g_hash_table_size(htable);
-	fwrite(&key_num, sizeof(int), 1, fp);
+	destor.index_memory_footprint = fp_table_memory(htable);
 
-	GHashTableIter iter;
-	gpointer key, value;
-	g_hash_table_iter_init(&iter, htable);
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-
-		/* Write a feature. */
-		kvpair kv = value;
-		if(fwrite(get_key(kv), destor.index_key_size, 1, fp) != 1){
-			perror("Fail to write a key!");
-			exit(1);
-		}
+	sdsfree(indexpath);
 
-		/* Write the number of segments/containers */
-		if(fwrite(&destor.index_value_length, sizeof(int), 1, fp) != 1){
-			perror("Fail to write a length!");
-			exit(1);
-		}
-		int i;
-		for (i = 0; i < destor.index_value_length; i++)
-			if(fwrite(&get_value(kv)[i], sizeof(int64_t), 1, fp) != 1){
-				perror("Fail to write a value!");
-				exit(1);
-			}
+	fp_table_free(touched);
+	fp_table_free(htable);
+	touched = NULL;
+	htable = NULL;
+}
 
+void close_kvstore() {
+	if (bloom && bloom_stale) {
+		NOTICE("rebuilding the Bloom filter of the fingerprint index");
+		bloom_fill();
 	}
 
-	/* It is a rough estimation */
-	destor.index_memory_footprint = g_hash_table_size(htable)
-			* (destor.index_key_size + sizeof(int64_t) * destor.index_value_length + 4);
+	kv_close();
 
-	fclose(fp);
-
-	NOTICE("flushing kvstore hash table successfully!");
+	if (bloom) {
+		sds bloompath = sdsdup(destor.working_directory);
+		bloompath = sdscat(bloompath, "index/bloom");
+		if (blocked_bloom_save(bloom, bloompath)) {
+			perror("Can not write index/bloom because:");
+			exit(1);
+		}
+		destor.index_memory_footprint += bloom->block_num
+				* sizeof(*bloom->blocks);
+		sdsfree(bloompath);
+		blocked_bloom_free(bloom);
+		bloom = NULL;
+	}
+}
 
-	sdsfree(indexpath);
+/*
+ * Return 0 if key is surely not in the store,
+ * to save a lookup for each unique chunk.
+ */
+static int bloom_may_contain(char* key) {
+	return !bloom
+			|| blocked_bloom_lookup(bloom,
+					fp_table_hash(key, destor.index_key_size));
+}
 
-	g_hash_table_destroy(htable);
+int kvstore_may_contain(char* key) {
+	pthread_rwlock_rdlock(&kv_rwlock);
+	int ret = bloom_may_contain(key);
+	pthread_rwlock_unlock(&kv_rwlock);
+	return ret;
 }
 
 
@@ -561,27 +767,116 @@ void close_kvstore() {
 
 /*
  * For top-k selection method.
+ * The value is valid until the next call to the store.
  */
 int64_t* kvstore_lookup(char* key) {
-	kvpair kv = g_hash_table_lookup(htable, key);
+	kv_lock_lookup();
+	kvpair kv = kv_lookup(key);
+	pthread_rwlock_unlock(&kv_rwlock);
 	return kv ? get_value(kv) : NULL;
 }
 
+/*
+ * Return the latest ID of key, or TEMPORARY_ID if key is not in the store.
+ * It is safe to call concurrently with other calls.
+ */
+int64_t kvstore_lookup_first(char* key) {
+	int64_t id = TEMPORARY_ID;
+	kv_lock_lookup();
+	if (bloom_may_contain(key)) {
+		kvpair kv = kv_lookup(key);
+		if (kv)
+			id = get_value(kv)[0];
+	}
+	pthread_rwlock_unlock(&kv_rwlock);
+	return id;
+}
+
+/* How many lookups ahead a batch prefetches. */
+#define KV_PREFETCH_DISTANCE 8
+
+struct kvProbe {
+	uint64_t h;
+	int64_t locality;
+	/* the index in the batch */
+	int i;
+};
+
+static int kv_probe_cmp(const void *a, const void *b) {
+	const struct kvProbe *x = a, *y = b;
+	if (x->locality != y->locality)
+		return x->locality < y->locality ? -1 : 1;
+	return x->i - y->i;
+}
+
+/*
+ * Look up n keys, stride bytes apart, under one lock,
+ * and set ids[i] to the latest ID of key i, or TEMPORARY_ID.
+ * The probes are issued in the order of the backend
+ * (e.g., buckets of the SSD store) and prefetched ahead.
+ * Return the number of keys not ruled out by the Bloom filter.
+ */
+int kvstore_lookup_batch(char* keys, int stride, int n, int64_t* ids) {
+	struct kvProbe *probes = malloc(sizeof(struct kvProbe) * (n ? n : 1));
+	int m = 0, i;
+
+	kv_lock_lookup();
+	for (i = 0; i < n; i++) {
+		ids[i] = TEMPORARY_ID;
+		uint64_t h = fp_table_hash(keys + (int64_t) i * stride,
+				destor.index_key_size);
+		if (bloom && !blocked_bloom_lookup(bloom, h))
+			continue;
+		probes[m].h = h;
+		probes[m].locality = kv_locality ? kv_locality(h) : 0;
+		probes[m].i = i;
+		m++;
+	}
+
+	if (kv_locality)
+		qsort(probes, m, sizeof(struct kvProbe), kv_probe_cmp);
+
+	if (kv_prefetch)
+		for (i = 0; i < m && i < KV_PREFETCH_DISTANCE; i++)
+			kv_prefetch(probes[i].h);
+	for (i = 0; i < m; i++) {
+		if (kv_prefetch && i + KV_PREFETCH_DISTANCE < m)
+			kv_prefetch(probes[i + KV_PREFETCH_DISTANCE].h);
+		kvpair kv = kv_lookup_hashed(keys + (int64_t) probes[i].i * stride,
+				probes[i].h);
+		if (kv)
+			ids[probes[i].i] = get_value(kv)[0];
+	}
+	pthread_rwlock_unlock(&kv_rwlock);
+
+	free(probes);
+	return m;
+}
 
 void kvstore_update(char* key, int64_t id) {
-	kvpair kv = g_hash_table_lookup(htable, key);
-	if (!kv) {
-		kv = new_kvpair_full(key);
-		g_hash_table_replace(htable, get_key(kv), kv);
+	pthread_rwlock_wrlock(&kv_rwlock);
+	int inserted;
+	kvpair kv = kv_insert(key, &inserted);
+	if (inserted) {
+		if (bloom)
+			blocked_bloom_insert(bloom,
+					fp_table_hash(key, destor.index_key_size));
+		int i;
+		for (i = 0; i < destor.index_value_length; i++)
+			get_value(kv)[i] = TEMPORARY_ID;
 	}
 	kv_update(kv, id);
+	pthread_rwlock_unlock(&kv_rwlock);
 }
 
 /* Remove the 'id' from the kvpair identified by 'key' */
 void kvstore_delete(char* key, int64_t id){
-	kvpair kv = g_hash_table_lookup(htable, key);
-	if(!kv)
+	pthread_rwlock_wrlock(&kv_rwlock);
+	if(!kv_lookup(key)){
+		pthread_rwlock_unlock(&kv_rwlock);
 		return;
+	}
+	kvpair kv = kv_insert(key, NULL);
 
 	int64_t *value = get_value(kv);
 	int i;
@@ -610,6 +905,8 @@ void kvstore_delete(char* key, int64_t id){
 	 */
 	if(value[0] == TEMPORARY_ID){
 		/* This kvpair can be removed. */
-		g_hash_table_remove(htable, key);
+		kv_remove(key);
+		bloom_stale = 1;
 	}
+	pthread_rwlock_unlock(&kv_rwlock);
 }
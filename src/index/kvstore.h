@@ -19,8 +19,21 @@ void close_cst() ;
 void init_kvstore();
 void close_kvstore();
 int64_t* kvstore_lookup(char* key) ;
+int64_t kvstore_lookup_first(char* key);
+int kvstore_lookup_batch(char* keys, int stride, int n, int64_t* ids);
 void kvstore_update(char* key, int64_t id) ;
 void kvstore_delete(char* key, int64_t id);
+int kvstore_may_contain(char* key);
+
+/* kvstore_ssd.c */
+void init_kvstore_ssd();
+void close_kvstore_ssd();
+kvpair kvstore_ssd_lookup(char *key);
+kvpair kvstore_ssd_lookup_hashed(char *key, uint64_t h);
+int64_t kvstore_ssd_bucket(uint64_t h);
+kvpair kvstore_ssd_insert(char *key, int *inserted);
+void kvstore_ssd_remove(char *key);
+kvpair kvstore_ssd_next(int64_t *pos);
 
 #endif
 
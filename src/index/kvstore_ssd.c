@@ -0,0 +1,422 @@
+/*
+ * kvstore_ssd.c
+ *
+ * An on-disk bucketized hash index, in the spirit of ChunkStash/SkimpyStash.
+ *
+ * index/ssd_index is an array of SSD_BUCKET_SIZE-byte buckets,
+ * a key lives in bucket (hash & (bucket_num - 1)).
+ * Once a bucket overflows, every bucket is split in two (bucket_num doubles),
+ * which reads and writes the file sequentially.
+ *
+ * For each slot of each bucket, memory keeps a 16-bit signature of its key,
+ * taken from other bits of the hash (about 2 bytes per key).
+ * A bucket is read only if a signature in it matches,
+ * so a unique key rarely costs a read and any key costs at most one.
+ * Recently used buckets are kept in a write-back cache,
+ * so duplicates of recent chunks usually cost none.
+ *
+ * The signatures are saved in index/ssd_summary at close,
+ * and rebuilt by scanning the buckets if it is missing (e.g., after a crash).
+ */
+#include "../destor.h"
+#include "kvstore.h"
+#include "fp_table.h"
+
+#define SSD_BUCKET_SIZE 4096
+/* uint32_t count, then the entries */
+#define SSD_BUCKET_HEADER 8
+#define SSD_INIT_BUCKETS 1024
+/* The bucket cache, 16 MB */
+#define SSD_CACHE_PAGES 4096
+
+#define bucket_count(page) (*(uint32_t*)(page))
+#define bucket_entry(page, i) ((kvpair)(page) + SSD_BUCKET_HEADER + (i) * entry_size)
+#define hash_sig(h) ((uint16_t)((h) >> 48))
+
+struct ssdPage {
+	int64_t bucket; /* -1 if free */
+	int dirty;
+	unsigned char *data;
+};
+
+static int fd = -1;
+static int64_t bucket_num;
+static int64_t key_num;
+/* entries per bucket */
+static int slot_num;
+static int entry_size;
+
+/* the memory-resident summary */
+static uint16_t *counts;
+static uint16_t *sigs;
+
+static struct ssdPage cache[SSD_CACHE_PAGES];
+static unsigned char *cache_mem;
+
+static int64_t read_num, write_num;
+
+static void bucket_read(int64_t b, unsigned char *page) {
+	if (pread(fd, page, SSD_BUCKET_SIZE, b * SSD_BUCKET_SIZE)
+			!= SSD_BUCKET_SIZE) {
+		perror("Fail to read a bucket of index/ssd_index");
+		exit(1);
+	}
+	read_num++;
+}
+
+static void bucket_write(int64_t b, unsigned char *page) {
+	if (pwrite(fd, page, SSD_BUCKET_SIZE, b * SSD_BUCKET_SIZE)
+			!= SSD_BUCKET_SIZE) {
+		perror("Fail to write a bucket of index/ssd_index");
+		exit(1);
+	}
+	write_num++;
+}
+
+static void cache_flush(int invalidate) {
+	int i;
+	for (i = 0; i < SSD_CACHE_PAGES; i++) {
+		if (cache[i].bucket >= 0 && cache[i].dirty)
+			bucket_write(cache[i].bucket, cache[i].data);
+		cache[i].dirty = 0;
+		if (invalidate)
+			cache[i].bucket = -1;
+	}
+}
+
+/*
+ * The cache is direct-mapped,
+ * bucket numbers are already uniformly distributed.
+ */
+static struct ssdPage* get_bucket(int64_t b) {
+	struct ssdPage *p = &cache[b % SSD_CACHE_PAGES];
+	if (p->bucket == b)
+		return p;
+
+	if (p->bucket >= 0 && p->dirty)
+		bucket_write(p->bucket, p->data);
+	p->bucket = b;
+	p->dirty = 0;
+	if (counts[b] == 0)
+		memset(p->data, 0, SSD_BUCKET_SIZE);
+	else
+		bucket_read(b, p->data);
+	return p;
+}
+
+/*
+ * Return the slot of key in its bucket, or -1.
+ * The bucket is loaded into *page only if a signature matches.
+ */
+static int find_slot(char *key, uint64_t h, struct ssdPage **page) {
+	int64_t b = h & (bucket_num - 1);
+	uint16_t sig = hash_sig(h);
+	uint16_t *s = &sigs[b * slot_num];
+	int i;
+
+	*page = NULL;
+	for (i = 0; i < counts[b]; i++) {
+		if (s[i] != sig)
+			continue;
+		if (!*page)
+			*page = get_bucket(b);
+		if (memcmp(bucket_entry((*page)->data, i), key,
+				destor.index_key_size) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* Split each bucket b into b and b + bucket_num. */
+static void grow() {
+	int64_t n = bucket_num, b;
+	unsigned char *old = malloc(SSD_BUCKET_SIZE);
+	unsigned char *lo = malloc(SSD_BUCKET_SIZE);
+	unsigned char *hi = malloc(SSD_BUCKET_SIZE);
+
+	cache_flush(1);
+	counts = realloc(counts, 2 * n * sizeof(uint16_t));
+	sigs = realloc(sigs, 2 * n * slot_num * sizeof(uint16_t));
+	memset(&counts[n], 0, n * sizeof(uint16_t));
+	if (ftruncate(fd, 2 * n * SSD_BUCKET_SIZE)) {
+		perror("Fail to extend index/ssd_index");
+		exit(1);
+	}
+
+	for (b = 0; b < n; b++) {
+		if (counts[b] == 0)
+			continue;
+		bucket_read(b, old);
+		memset(lo, 0, SSD_BUCKET_SIZE);
+		memset(hi, 0, SSD_BUCKET_SIZE);
+
+		int i;
+		for (i = 0; i < counts[b]; i++) {
+			kvpair kv = bucket_entry(old, i);
+			uint64_t h = fp_table_hash(kv, destor.index_key_size);
+			int64_t nb = h & (2 * n - 1);
+			unsigned char *page = nb == b ? lo : hi;
+			int j = bucket_count(page)++;
+			memcpy(bucket_entry(page, j), kv, entry_size);
+			sigs[nb * slot_num + j] = hash_sig(h);
+		}
+
+		counts[b] = bucket_count(lo);
+		counts[b + n] = bucket_count(hi);
+		if (counts[b + n]) {
+			bucket_write(b, lo);
+			bucket_write(b + n, hi);
+		}
+	}
+
+	bucket_num = 2 * n;
+	NOTICE("index/ssd_index grows to %" PRId64 " buckets", bucket_num);
+
+	free(old);
+	free(lo);
+	free(hi);
+}
+
+static int load_summary(sds path) {
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+
+	int32_t key_size, value_length;
+	int ok = fread(&bucket_num, sizeof(bucket_num), 1, fp) == 1
+			&& fread(&key_num, sizeof(key_num), 1, fp) == 1
+			&& fread(&key_size, sizeof(key_size), 1, fp) == 1
+			&& fread(&value_length, sizeof(value_length), 1, fp) == 1;
+	if (ok && (key_size != destor.index_key_size
+			|| value_length != destor.index_value_length)) {
+		WARNING("index/ssd_summary does not match the key size/value length!");
+		exit(1);
+	}
+
+	if (ok) {
+		counts = malloc(bucket_num * sizeof(uint16_t));
+		sigs = malloc(bucket_num * slot_num * sizeof(uint16_t));
+		ok = fread(counts, sizeof(uint16_t), bucket_num, fp) == bucket_num
+				&& fread(sigs, sizeof(uint16_t) * slot_num, bucket_num, fp)
+						== bucket_num;
+		if (!ok) {
+			free(counts);
+			free(sigs);
+			counts = sigs = NULL;
+		}
+	}
+	fclose(fp);
+
+	/* A stale summary must not survive a crash. */
+	unlink(path);
+	return ok;
+}
+
+static void rebuild_summary(int64_t size) {
+	bucket_num = size / SSD_BUCKET_SIZE;
+	if (bucket_num < SSD_INIT_BUCKETS) {
+		bucket_num = SSD_INIT_BUCKETS;
+		if (ftruncate(fd, bucket_num * SSD_BUCKET_SIZE)) {
+			perror("Fail to create index/ssd_index");
+			exit(1);
+		}
+	}
+	assert((bucket_num & (bucket_num - 1)) == 0);
+
+	counts = calloc(bucket_num, sizeof(uint16_t));
+	sigs = malloc(bucket_num * slot_num * sizeof(uint16_t));
+	key_num = 0;
+	if (size == 0)
+		return;
+
+	NOTICE("rebuilding the summary of index/ssd_index");
+	unsigned char *page = malloc(SSD_BUCKET_SIZE);
+	int64_t b;
+	for (b = 0; b < bucket_num; b++) {
+		bucket_read(b, page);
+		counts[b] = bucket_count(page);
+		assert(counts[b] <= slot_num);
+		int i;
+		for (i = 0; i < counts[b]; i++)
+			sigs[b * slot_num + i] = hash_sig(
+					fp_table_hash(bucket_entry(page, i), destor.index_key_size));
+		key_num += counts[b];
+	}
+	free(page);
+}
+
+void init_kvstore_ssd() {
+	entry_size = destor.index_key_size
+			+ destor.index_value_length * sizeof(int64_t);
+	slot_num = (SSD_BUCKET_SIZE - SSD_BUCKET_HEADER) / entry_size;
+	assert(slot_num > 0);
+
+	sds indexpath = sdsdup(destor.working_directory);
+	indexpath = sdscat(indexpath, "index/ssd_index");
+	if ((fd = open(indexpath, O_RDWR | O_CREAT, S_IRWXU)) < 0) {
+		perror("Can not open index/ssd_index because");
+		exit(1);
+	}
+
+	struct stat st;
+	fstat(fd, &st);
+
+	sds summarypath = sdsdup(destor.working_directory);
+	summarypath = sdscat(summarypath, "index/ssd_summary");
+	if (load_summary(summarypath)
+			&& bucket_num * SSD_BUCKET_SIZE != st.st_size) {
+		free(counts);
+		free(sigs);
+		counts = sigs = NULL;
+	}
+	if (!counts)
+		rebuild_summary(st.st_size);
+
+	cache_mem = malloc((int64_t) SSD_CACHE_PAGES * SSD_BUCKET_SIZE);
+	int i;
+	for (i = 0; i < SSD_CACHE_PAGES; i++) {
+		cache[i].bucket = -1;
+		cache[i].dirty = 0;
+		cache[i].data = cache_mem + (int64_t) i * SSD_BUCKET_SIZE;
+	}
+	read_num = write_num = 0;
+
+	NOTICE("index/ssd_index: %" PRId64 " keys in %" PRId64 " buckets",
+			key_num, bucket_num);
+
+	sdsfree(summarypath);
+	sdsfree(indexpath);
+}
+
+void close_kvstore_ssd() {
+	cache_flush(1);
+	fsync(fd);
+	close(fd);
+	fd = -1;
+
+	sds summarypath = sdsdup(destor.working_directory);
+	summarypath = sdscat(summarypath, "index/ssd_summary");
+
+	FILE *fp;
+	if ((fp = fopen(summarypath, "w")) == NULL) {
+		perror("Can not open index/ssd_summary for write because:");
+		exit(1);
+	}
+
+	int32_t key_size = destor.index_key_size;
+	int32_t value_length = destor.index_value_length;
+	if (fwrite(&bucket_num, sizeof(bucket_num), 1, fp) != 1
+			|| fwrite(&key_num, sizeof(key_num), 1, fp) != 1
+			|| fwrite(&key_size, sizeof(key_size), 1, fp) != 1
+			|| fwrite(&value_length, sizeof(value_length), 1, fp) != 1
+			|| fwrite(counts, sizeof(uint16_t), bucket_num, fp) != bucket_num
+			|| fwrite(sigs, sizeof(uint16_t) * slot_num, bucket_num, fp)
+					!= bucket_num) {
+		perror("Fail to write index/ssd_summary");
+		exit(1);
+	}
+	fclose(fp);
+
+	NOTICE("index/ssd_index: %" PRId64 " keys, %" PRId64 " bucket reads, %"
+			PRId64 " bucket writes", key_num, read_num, write_num);
+
+	destor.index_memory_footprint = bucket_num
+			* (slot_num + 1) * sizeof(uint16_t)
+			+ (int64_t) SSD_CACHE_PAGES * SSD_BUCKET_SIZE;
+
+	sdsfree(summarypath);
+	free(counts);
+	free(sigs);
+	free(cache_mem);
+	counts = sigs = NULL;
+	cache_mem = NULL;
+}
+
+/*
+ * The returned kvpair stays valid until the next call into the store.
+ */
+kvpair kvstore_ssd_lookup(char *key) {
+	return kvstore_ssd_lookup_hashed(key,
+			fp_table_hash(key, destor.index_key_size));
+}
+
+kvpair kvstore_ssd_lookup_hashed(char *key, uint64_t h) {
+	struct ssdPage *page;
+	int i = find_slot(key, h, &page);
+	return i >= 0 ? bucket_entry(page->data, i) : NULL;
+}
+
+/*
+ * Lookups in the order of their buckets read each bucket once,
+ * in the order of the file.
+ */
+int64_t kvstore_ssd_bucket(uint64_t h) {
+	return h & (bucket_num - 1);
+}
+
+/*
+ * Return the kvpair of key, which is added if absent,
+ * and written back once evicted from the cache.
+ * A new kvpair has its value uninitialized.
+ */
+kvpair kvstore_ssd_insert(char *key, int *inserted) {
+	uint64_t h = fp_table_hash(key, destor.index_key_size);
+	struct ssdPage *page;
+	int i = find_slot(key, h, &page);
+
+	if (inserted)
+		*inserted = i < 0;
+	if (i < 0) {
+		int64_t b = h & (bucket_num - 1);
+		while (counts[b] == slot_num) {
+			grow();
+			b = h & (bucket_num - 1);
+		}
+		page = get_bucket(b);
+		i = counts[b]++;
+		bucket_count(page->data) = counts[b];
+		sigs[b * slot_num + i] = hash_sig(h);
+		memcpy(bucket_entry(page->data, i), key, destor.index_key_size);
+		key_num++;
+	}
+	page->dirty = 1;
+	return bucket_entry(page->data, i);
+}
+
+void kvstore_ssd_remove(char *key) {
+	uint64_t h = fp_table_hash(key, destor.index_key_size);
+	struct ssdPage *page;
+	int i = find_slot(key, h, &page);
+	if (i < 0)
+		return;
+
+	/* Move the last entry of the bucket into the hole. */
+	int64_t b = h & (bucket_num - 1);
+	int last = --counts[b];
+	if (i != last) {
+		memcpy(bucket_entry(page->data, i), bucket_entry(page->data, last),
+				entry_size);
+		sigs[b * slot_num + i] = sigs[b * slot_num + last];
+	}
+	bucket_count(page->data) = counts[b];
+	page->dirty = 1;
+	key_num--;
+}
+
+/*
+ * Iterate the kvpairs bucket by bucket, *pos starts from 0.
+ * Return NULL at the end.
+ */
+kvpair kvstore_ssd_next(int64_t *pos) {
+	int64_t b = *pos / slot_num;
+	int i = *pos % slot_num;
+
+	for (; b < bucket_num; b++, i = 0) {
+		if (i < counts[b]) {
+			*pos = b * slot_num + i + 1;
+			return bucket_entry(get_bucket(b)->data, i);
+		}
+	}
+	*pos = b * slot_num;
+	return NULL;
+}
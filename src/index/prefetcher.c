@@ -0,0 +1,46 @@
+/*
+ * prefetcher.c
+ *
+ *  The dedup workers submit the containers their segments will need,
+ *  and each is taken when fingerprint_cache_prefetch reaches it.
+ *  A request is tagged with the last segment that submitted it.
+ */
+#include "prefetcher.h"
+#include "../storage/containerstore.h"
+#include "../utils/async_reader.h"
+
+static struct asyncReader *prefetcher;
+
+static void* read_container_meta(int64_t id) {
+	return retrieve_container_meta_by_id(id);
+}
+
+void init_prefetcher() {
+	prefetcher = new_async_reader(destor.index_prefetch_thread_num,
+			read_container_meta, (void (*)(void*)) free_container_meta);
+}
+
+void close_prefetcher() {
+	free_async_reader(prefetcher);
+	prefetcher = NULL;
+}
+
+void prefetcher_submit(containerid id, int64_t seq) {
+	if (prefetcher)
+		async_reader_submit(prefetcher, id, seq, 0);
+}
+
+struct containerMeta* prefetcher_take(containerid id) {
+	if (!prefetcher)
+		return NULL;
+	return async_reader_take(prefetcher, id, NULL, NULL);
+}
+
+static int submitted_by_seq(int64_t tag, void *seq) {
+	return tag <= *(int64_t*) seq;
+}
+
+void prefetcher_discard(int64_t seq) {
+	if (prefetcher)
+		async_reader_drop(prefetcher, submitted_by_seq, &seq);
+}
@@ -0,0 +1,29 @@
+/*
+ * prefetcher.h
+ *
+ *  Reads container metadata for the fingerprint cache in reader threads,
+ *  so the reads of a segment overlap each other and the dedup phase.
+ */
+
+#ifndef PREFETCHER_H_
+#define PREFETCHER_H_
+
+#include "../destor.h"
+
+void init_prefetcher();
+void close_prefetcher();
+
+/*
+ * Start reading the metadata of container id for the segment seq,
+ * unless it is being read.
+ */
+void prefetcher_submit(containerid id, int64_t seq);
+/*
+ * Return the metadata of container id, waiting for it if being read,
+ * or NULL if it was never submitted.
+ */
+struct containerMeta* prefetcher_take(containerid id);
+/* Drop the metadata never taken, submitted by no segment after seq. */
+void prefetcher_discard(int64_t seq);
+
+#endif /* PREFETCHER_H_ */
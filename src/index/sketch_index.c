@@ -0,0 +1,114 @@
+/*
+ * sketch_index.c
+ *
+ *  Super-features follow Finesse:
+ *  a chunk is divided into 12 sub-chunks,
+ *  and the max gear hash in each sub-chunk is a feature.
+ *  The features are grouped by 3 neighbouring sub-chunks and sorted,
+ *  and a super-feature combines the features of the same rank in 4 groups,
+ *  so it survives an edit that shifts the sub-chunk boundaries.
+ *
+ *  The index keeps the latest base of each super-feature.
+ */
+#include "sketch_index.h"
+#include "fp_table.h"
+
+#define SKETCH_FEATURE_NUM 12
+#define SKETCH_GROUP_SIZE (SKETCH_FEATURE_NUM / 4)
+
+/* super-feature (with its rank mixed in) -> fingerprint, container id */
+static struct fpTable *sketch;
+static uint64_t gear[256];
+
+#define SKETCH_VALUE_SIZE (sizeof(fingerprint) + sizeof(containerid))
+
+void init_sketch_index() {
+	uint64_t x = 0x5ce7c4ed5ce7c4edULL;
+	int i;
+	for (i = 0; i < 256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+
+	sds indexpath = sdsdup(destor.working_directory);
+	indexpath = sdscat(indexpath, "index/sketch.snap");
+
+	sketch = fp_table_map(indexpath, sizeof(uint64_t), SKETCH_VALUE_SIZE,
+			NULL);
+	if (!sketch)
+		sketch = fp_table_new(sizeof(uint64_t), SKETCH_VALUE_SIZE, 0);
+
+	sdsfree(indexpath);
+}
+
+void close_sketch_index() {
+	sds indexpath = sdsdup(destor.working_directory);
+	indexpath = sdscat(indexpath, "index/sketch.snap");
+
+	if (fp_table_save(sketch, indexpath, 0)) {
+		perror("Can not write index/sketch.snap because:");
+		exit(1);
+	}
+
+	sdsfree(indexpath);
+	fp_table_free(sketch);
+	sketch = NULL;
+}
+
+static int uint64_cmp(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+void chunk_super_features(struct chunk* c, uint64_t *sf) {
+	uint64_t feature[SKETCH_FEATURE_NUM];
+	memset(feature, 0, sizeof(feature));
+
+	int sub = c->size / SKETCH_FEATURE_NUM + 1;
+	uint64_t h = 0;
+	int i, j;
+	for (i = 0; i < c->size; i++) {
+		h = (h << 1) + gear[c->data[i]];
+		if (h > feature[i / sub])
+			feature[i / sub] = h;
+	}
+
+	for (i = 0; i < SKETCH_FEATURE_NUM; i += SKETCH_GROUP_SIZE)
+		qsort(&feature[i], SKETCH_GROUP_SIZE, sizeof(uint64_t), uint64_cmp);
+
+	for (j = 0; j < SKETCH_SF_NUM; j++) {
+		/* The rank is mixed in, as each rank has its own entry. */
+		uint64_t x = j;
+		for (i = j; i < SKETCH_FEATURE_NUM; i += SKETCH_GROUP_SIZE) {
+			x = (x ^ feature[i]) * 0x9e3779b97f4a7c15ULL;
+			x ^= x >> 29;
+		}
+		sf[j] = x;
+	}
+}
+
+int sketch_index_lookup(uint64_t *sf, fingerprint *fp, containerid *id) {
+	int j;
+	for (j = 0; j < SKETCH_SF_NUM; j++) {
+		char *entry = fp_table_lookup(sketch, (char*) &sf[j]);
+		if (entry) {
+			memcpy(fp, entry + sizeof(uint64_t), sizeof(fingerprint));
+			memcpy(id, entry + sizeof(uint64_t) + sizeof(fingerprint),
+					sizeof(containerid));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void sketch_index_insert(uint64_t *sf, fingerprint *fp, containerid id) {
+	int j;
+	for (j = 0; j < SKETCH_SF_NUM; j++) {
+		char *entry = fp_table_insert(sketch, (char*) &sf[j], NULL);
+		memcpy(entry + sizeof(uint64_t), fp, sizeof(fingerprint));
+		memcpy(entry + sizeof(uint64_t) + sizeof(fingerprint), &id,
+				sizeof(containerid));
+	}
+}
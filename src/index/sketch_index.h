@@ -0,0 +1,29 @@
+/*
+ * sketch_index.h
+ *
+ *  Maps the super-features of stored chunks to the chunks,
+ *  so a unique chunk can be delta compressed against a resembling one.
+ */
+
+#ifndef SKETCH_INDEX_H_
+#define SKETCH_INDEX_H_
+
+#include "../destor.h"
+
+/* Two chunks sharing a super-feature are likely to resemble. */
+#define SKETCH_SF_NUM 3
+
+void init_sketch_index();
+void close_sketch_index();
+
+void chunk_super_features(struct chunk* c, uint64_t *sf);
+
+/*
+ * Find a base chunk sharing a super-feature with sf.
+ * Return 1 and set fp and id if found.
+ */
+int sketch_index_lookup(uint64_t *sf, fingerprint *fp, containerid *id);
+/* The chunk fp in container id is a base of the later chunks. */
+void sketch_index_insert(uint64_t *sf, fingerprint *fp, containerid id);
+
+#endif /* SKETCH_INDEX_H_ */
@@ -35,6 +35,8 @@ void init_jcr(char *path) {
 	jcr.zero_chunk_size = 0;
 	jcr.rewritten_chunk_num = 0;
 	jcr.rewritten_chunk_size = 0;
+	jcr.compressed_data_size = 0;
+	jcr.delta_chunk_num = 0;
 
 	jcr.sparse_container_num = 0;
 	jcr.inherited_sparse_num = 0;
@@ -50,6 +52,7 @@ void init_jcr(char *path) {
 	jcr.dedup_time = 0;
 	jcr.rewrite_time = 0;
 	jcr.filter_time = 0;
+	jcr.compress_time = 0;
 	jcr.write_time = 0;
 
 	/*
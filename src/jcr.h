@@ -34,6 +34,10 @@ struct jcr{
 	int64_t zero_chunk_size;
 	int32_t rewritten_chunk_num;
 	int64_t rewritten_chunk_size;
+	/* the bytes of written chunks in containers, after compression */
+	int64_t compressed_data_size;
+	/* the unique chunks stored as deltas */
+	int32_t delta_chunk_num;
 
 	int32_t sparse_container_num;
 	int32_t inherited_sparse_num;
@@ -51,6 +55,7 @@ struct jcr{
 	double dedup_time;
 	double rewrite_time;
 	double filter_time;
+	double compress_time;
 	double write_time;
 
 	double read_recipe_time;
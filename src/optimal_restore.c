@@ -8,6 +8,7 @@
 #include "jcr.h"
 #include "recipe/recipestore.h"
 #include "storage/containerstore.h"
+#include "storage/readahead.h"
 #include "restore.h"
 #include "utils/lru_cache.h"
 
@@ -103,11 +104,13 @@ void init_optimal_cache() {
 	optimal_cache.sorted_records_of_cached_containers = g_sequence_new(NULL);
 
 	if (destor.simulation_level == SIMULATION_NO)
-		optimal_cache.lru_queue = new_lru_cache(destor.restore_cache[1],
-				free_container, lookup_fingerprint_in_container);
+		optimal_cache.lru_queue = new_indexed_lru_cache(destor.restore_cache[1],
+				free_container, NULL, container_foreach_fingerprint,
+				g_int_hash, (GEqualFunc)g_fingerprint_equal);
 	else
-		optimal_cache.lru_queue = new_lru_cache(destor.restore_cache[1],
-				free_container_meta, lookup_fingerprint_in_container_meta);
+		optimal_cache.lru_queue = new_indexed_lru_cache(destor.restore_cache[1],
+				free_container_meta, NULL, container_meta_foreach_fingerprint,
+				g_int_hash, (GEqualFunc)g_fingerprint_equal);
 
 	optimal_cache_window_fill();
 }
@@ -179,7 +182,7 @@ static int find_kicked_container_meta(struct containerMeta* cm, GHashTable *ht)
 	return 0;
 }
 
-static void optimal_cache_insert(containerid id) {
+static void optimal_cache_insert(containerid id, int64_t pos) {
 
 	if (lru_cache_is_full(optimal_cache.lru_queue)) {
 		GHashTable* ht = g_hash_table_new(g_int64_hash, g_int64_equal);
@@ -233,7 +236,7 @@ static void optimal_cache_insert(containerid id) {
 
 	jcr.read_container_num++;
 	if (destor.simulation_level == SIMULATION_NO) {
-		struct container* con = retrieve_container_by_id(id);
+		struct container* con = readahead_take(id, pos);
 		lru_cache_insert(optimal_cache.lru_queue, con, NULL, NULL);
 	} else {
 		struct containerMeta *cm = retrieve_container_meta_by_id(id);
@@ -248,11 +251,18 @@ static void optimal_cache_insert(containerid id) {
 
 }
 
+/* Whether a container of the chunk is cached, without touching the cache. */
+static int optimal_cached(struct chunk *c) {
+	return lru_cache_lookup_without_update(optimal_cache.lru_queue, &c->fp)
+			!= NULL;
+}
+
 void* optimal_restore_thread(void *arg) {
 	init_optimal_cache();
 
 	struct chunk* c;
-	while ((c = sync_queue_pop(restore_recipe_queue))) {
+	int64_t pos;
+	while ((c = readahead_pop(restore_recipe_queue, optimal_cached, &pos))) {
 
 		if (CHECK_CHUNK(c, CHUNK_FILE_START) || CHECK_CHUNK(c, CHUNK_FILE_END)) {
 			sync_queue_push(restore_chunk_queue, c);
@@ -264,7 +274,7 @@ void* optimal_restore_thread(void *arg) {
 
 		if (!optimal_cache_hits(c->id)) {
 			VERBOSE("Restore cache: container %lld is missed", c->id);
-			optimal_cache_insert(c->id);
+			optimal_cache_insert(c->id, pos);
 		}
 
 		if (destor.simulation_level == SIMULATION_NO) {
@@ -3,6 +3,7 @@
 #include "jcr.h"
 #include "recipe/recipestore.h"
 #include "storage/containerstore.h"
+#include "storage/compression.h"
 #include "index/index.h"
 #include "restore.h"
 #include "utils/lru_cache.h"
@@ -42,9 +43,10 @@ unsigned char* allocate_data_buffer(int *pattern, GList* b, int len){
 
 
 static struct chunk* dup_chunk(struct chunk* ch){
-    struct chunk *dup = malloc(sizeof(struct chunk));
-    memcpy(dup, ch, sizeof(struct chunk));
-    dup->data = malloc(ch->size);
+    struct chunk *dup = new_chunk(ch->size);
+    dup->flag = ch->flag;
+    dup->id = ch->id;
+    memcpy(dup->fp, ch->fp, sizeof(fingerprint));
     memcpy(dup->data, ch->data, ch->size);
     return dup;
 }
@@ -57,7 +59,7 @@ void dump_hash_table_for_debug(GHashTable *ht){
     NOTICE("-----------dump hash table---------");
     g_hash_table_iter_init(&iter, ht);
     while(g_hash_table_iter_next(&iter, &key, &value)){
-        GList *le = (GList*) value;
+        struct lruNode *le = value;
         struct chunk* ch = (struct chunk*) le->data;
         
         char code[41];
@@ -80,7 +82,7 @@ static void insert_chunk_into_data_cache(struct chunk *ch){
 
     if (g_hash_table_lookup(ht_dataCache, &ch->fp) == NULL) {
         struct chunk *cached_ch = dup_chunk(ch);
-        GList *ch_list = lru_cache_insert(dataCache, cached_ch,
+        struct lruNode *ch_list = lru_cache_insert(dataCache, cached_ch,
                                           remove_chunk_from_ht_data_cache,
                                           ht_dataCache);
         assert(ch_list);
@@ -156,10 +158,10 @@ void read_data_by_pattern(int *pattern, GSequence *a, GList *b, int a_len, int b
         struct pattern_chunk *pch = g_hash_table_lookup(ht_pattern_chunks, &ch->fp);
         if (pch) {
             //copy data of chunks into the segment
-            assert(ch->size == pch->me->len);
-            ch->data = malloc(ch->size);
+            assert(ch->size == pch->me->size);
+            ch->data = slab_alloc(ch->size);
             assert(pch->data);
-            memcpy(ch->data, pch->data, ch->size);
+            decompress_chunk_data(pch->me, pch->data, ch->data);
             
             //insert the new chunk into data cache
             if (destor.restore_cache[1])
@@ -303,10 +305,10 @@ void read_data_by_merged_pattern(int *pattern, GSequence *a1, GSequence *a2, GLi
         struct pattern_chunk *pch = g_hash_table_lookup(ht_pattern_chunks, &ch->fp);
         if (pch) {
             //copy data of chunks into the segment
-            assert(ch->size == pch->me->len);
-            ch->data = malloc(ch->size);
+            assert(ch->size == pch->me->size);
+            ch->data = slab_alloc(ch->size);
             assert(pch->data);
-            memcpy(ch->data, pch->data, ch->size);
+            decompress_chunk_data(pch->me, pch->data, ch->data);
             
             //insert the new chunk into data cache
             if (destor.restore_cache[1])
@@ -465,12 +467,12 @@ void remove_cached_chunks_in_unread_list(GSequence* s_list, int32_t* s_len){
     while(s_iter != s_end){
         struct chunk* ch = (struct chunk*)g_sequence_get(s_iter);
         //lookup chunk in data cache
-        GList *ch_list = g_hash_table_lookup(ht_dataCache, &ch->fp);
+        struct lruNode *ch_list = g_hash_table_lookup(ht_dataCache, &ch->fp);
         if (ch_list) {
             struct chunk *cached_ch = (struct chunk*)ch_list->data;
             assert(cached_ch->data);
             assert(ch->size == cached_ch->size);
-            ch->data = malloc(ch->size);
+            ch->data = slab_alloc(ch->size);
             memcpy(ch->data, cached_ch->data, ch->size);
             
             GSequenceIter *t = g_sequence_iter_next(s_iter);
@@ -3,46 +3,38 @@
 #include "jcr.h"
 #include "recipe/recipestore.h"
 #include "storage/containerstore.h"
+#include "storage/compression.h"
 #include "index/index.h"
 #include "restore.h"
 #include "utils/lru_cache.h"
 
 
-struct pattern_chunk{
-    struct metaEntry *me;
-    unsigned char* data;
+/*
+ * A pattern marks, one bit per entry, the entries of a container
+ * from the first unread chunk on that are to be read.
+ * The entries are in the order of offsets,
+ * so a run of marked entries is a contiguous range of the container.
+ */
+struct pattern {
+    struct containerMeta *cm;
+    /* the index of the first entry */
+    int start;
+    int len;
+    uint64_t *bits;
 };
-//to store all chunks of s1_chunk_list
-static GHashTable *ht_pattern_chunks;
+
+#define PATTERN_WORDS(len) (((len) + 63) >> 6)
+#define PATTERN_TEST(p, j) (((p)->bits[(j) >> 6] >> ((j) & 63)) & 1)
+#define PATTERN_SET(p, j) ((p)->bits[(j) >> 6] |= 1ULL << ((j) & 63))
 
 static struct lruCache *dataCache;
 static struct lruCache *metaCache;
 
-unsigned char* allocate_data_buffer(int *pattern, GList* b, int len){
-    //allocate the buffer space
-    int i;
-    unsigned char* write_buf;
-    int buf_len = 0;
-    struct metaEntry *me;
-    
-    GList* b_iter = b;
-    for (i=0; i<len; i++) {
-        if (pattern[i]) {
-            me = (struct metaEntry*)b_iter->data;
-            buf_len += me->len;
-        }
-        b_iter = g_list_next(b_iter);
-    }
-    write_buf = (unsigned char*)malloc(buf_len);
-    
-    return write_buf;
-}
-
-
 static struct chunk* dup_chunk(struct chunk* ch){
-    struct chunk *dup = malloc(sizeof(struct chunk));
-    memcpy(dup, ch, sizeof(struct chunk));
-    dup->data = malloc(ch->size);
+    struct chunk *dup = new_chunk(ch->size);
+    dup->flag = ch->flag;
+    dup->id = ch->id;
+    memcpy(dup->fp, ch->fp, sizeof(fingerprint));
     memcpy(dup->data, ch->data, ch->size);
     return dup;
 }
@@ -71,7 +63,8 @@ static void read_data_by_pattern_in_data_cache(GSequence *a, int a_len, struct c
         if (ch->id == con->meta.id) {
             struct chunk *rc = get_chunk_in_container(con, &ch->fp);
             ch->data = rc->data;
-            free(rc);
+            rc->data = NULL;
+            free_chunk(rc);
             
             GSequenceIter *t = g_sequence_iter_next(a_iter);
             g_sequence_remove(a_iter);
@@ -82,259 +75,143 @@ static void read_data_by_pattern_in_data_cache(GSequence *a, int a_len, struct c
 }
 
 
-//read data according to the pattern
-static void read_data_by_pattern(int *pattern, GSequence *a, GList *b, int a_len, int b_len, unsigned char*write_buf){
-    int i, j=0;
-    GList* b_iter=b;
-    int read_off, read_len=0;
-    int buff_off=0, flag=0;
-    
-    //read data according to patterns
-    GSequenceIter *a_iter = g_sequence_get_begin_iter(a);
-    struct chunk *a_first = (struct chunk*)g_sequence_get(a_iter);
-    containerid cid = a_first->id;
-    
-    while (j<b_len) {
-        struct metaEntry* me = (struct metaEntry*)b_iter->data;
-        //need to read chunks
-        if (pattern[j]) {
-            struct pattern_chunk *ch = malloc(sizeof(struct pattern_chunk));
-            ch->me = me;
-            ch->data = write_buf+read_len;
-            g_hash_table_insert(ht_pattern_chunks, &me->fp, ch);
-            if (flag==0) {
-                read_off = me->off;
-                read_len = me->len;
-                flag = 1;
-            }else
-            read_len += me->len;
-        }else if (flag==1) {
-            flag = 0;
-            read_data_in_container(cid, read_off, read_len, write_buf+buff_off);
-            DEBUG("read %d data at offset %d ", read_len, read_off);
-            buff_off += read_len;
-        }
-        
-        j++;
-        b_iter = g_list_next(b_iter);
-    }
-    if (flag==1) {
-        read_data_in_container(cid, read_off, read_len, write_buf+buff_off);
-        DEBUG("read %d data at offset %d ", read_len, read_off);
-    }
-    
-    //assign data for each chunk in recipe list
-    a_iter = g_sequence_get_begin_iter(a);
-    for (i=0; i<a_len; i++) {
-        struct chunk *ch = (struct chunk*)g_sequence_get(a_iter);
-        //data has already read index by pattern hash table
-        struct pattern_chunk *pch = g_hash_table_lookup(ht_pattern_chunks, &ch->fp);
-        if (pch) {
-            //copy data of chunks into the segment
-            assert(ch->size == pch->me->len);
-            ch->data = malloc(ch->size);
-            assert(pch->data);
-            memcpy(ch->data, pch->data, ch->size);
-            
-            GSequenceIter *t = g_sequence_iter_next(a_iter);
-            g_sequence_remove(a_iter);
-            a_iter = t;
-        }
-        else
-        a_iter = g_sequence_iter_next(a_iter);
-    }
-    g_hash_table_remove_all(ht_pattern_chunks);
+static void init_pattern(struct pattern *p, struct containerMeta *cm, struct metaEntry *first){
+    p->cm = cm;
+    p->start = first - cm->entries;
+    p->len = cm->chunk_num - p->start;
+    p->bits = calloc(PATTERN_WORDS(p->len), sizeof(uint64_t));
 }
 
-static int* generate_pattern(GSequence *a, GList *b, int a_len, int b_len){
-    int i, j, k, d;
-    int val = 1;
-    
-    //assert(a_len == g_sequence_get_length(a));
-    //generate the pattern
-    int *pattern = (int*)malloc(sizeof(int)*b_len);
-    memset(pattern, 0, sizeof(int)*b_len);
-    
-    GHashTable *ht = g_hash_table_new(g_int_hash, (GEqualFunc)g_fingerprint_equal);
-    
+//the index of the chunk in the pattern, or -1 if it is not in
+static int pattern_index(struct pattern *p, fingerprint *fp){
+    struct metaEntry *me = g_hash_table_lookup(p->cm->map, fp);
+    if (!me || me - p->cm->entries < p->start)
+        return -1;
+    return me - p->cm->entries - p->start;
+}
+
+//mark the chunks of the unread list, through the index of the container
+static void mark_pattern(struct pattern *p, GSequence *a){
     GSequenceIter *a_iter = g_sequence_get_begin_iter(a);
-    for (i=0; i<a_len; i++) {
+    GSequenceIter *a_end = g_sequence_get_end_iter(a);
+    for (; a_iter != a_end; a_iter = g_sequence_iter_next(a_iter)) {
         struct chunk *ch = (struct chunk*)g_sequence_get(a_iter);
-        g_hash_table_insert(ht, &ch->fp, &val);
-        a_iter = g_sequence_iter_next(a_iter);
+        int j = pattern_index(p, &ch->fp);
+        if (j >= 0)
+            PATTERN_SET(p, j);
     }
-    GList *b_iter = b;
-    for (j=0; j<b_len; j++) {
-        struct metaEntry *me = (struct metaEntry*)b_iter->data;
-        if (g_hash_table_lookup(ht, &me->fp)){
-            pattern[j] = 1;
-        }
-        b_iter = g_list_next(b_iter);
+}
+
+//mark the entries [from, to) a word at a time
+static void set_pattern_range(struct pattern *p, int from, int to){
+    while (from < to) {
+        int b = from & 63;
+        int n = to - from < 64 - b ? to - from : 64 - b;
+        uint64_t mask = n == 64 ? ~0ULL : ((1ULL << n) - 1) << b;
+        p->bits[from >> 6] |= mask;
+        from += n;
     }
-    g_hash_table_destroy(ht);
-    
-    
-    //wild match the pattern
-    for (j=0; j<b_len; j+=d) {
-        while (pattern[j]) j++;
-        if (j>=b_len)
-        break;
-        d=0;
-        while (pattern[j+d] == 0) d++;
-        if (j+d >=b_len)
-        break;
-        if (d<=destor.wildcard_length) {
-            for (i=0; i<d; i++)
-            pattern[j+i] = 2;
+}
+
+/*
+ * Wild match the pattern: a gap of at most wildcard_length entries
+ * between two marked ones is read too, rather than split the range.
+ * Only the marked bits are visited, whole words of zeros are skipped.
+ */
+static void wildcard_pattern(struct pattern *p){
+    int w, prev = -1;
+    for (w = 0; w < PATTERN_WORDS(p->len); w++) {
+        uint64_t word = p->bits[w];
+        while (word) {
+            int j = (w << 6) + __builtin_ctzll(word);
+            word &= word - 1;
+            if (prev >= 0 && j - prev > 1 && j - prev - 1 <= destor.wildcard_length)
+                set_pattern_range(p, prev + 1, j);
+            prev = j;
         }
     }
-    //    //output the pattern
-    //    printf("the pattern as follows: \n");
-    //    for (i=0; i<b_len; i++) {
-    //        printf("%d", pattern[i]);
-    //    }
-    //    printf("\n");
-    
-    return pattern;
 }
 
+static int pattern_count(struct pattern *p){
+    int w, cnt = 0;
+    for (w = 0; w < PATTERN_WORDS(p->len); w++)
+        cnt += __builtin_popcountll(p->bits[w]);
+    return cnt;
+}
 
-
-
-
-//read data according to the pattern
-static void read_data_by_merged_pattern(int *pattern, GSequence *a1, GSequence *a2, GList *b, int a1_len, int a2_len, int b_len, unsigned char*write_buf){
-    int i, j=0;
-    GList* b_iter=b;
-    int read_off, read_len=0;
-    int buff_off=0, flag=0;
-    
-    //read data according to patterns
-    GSequenceIter *a_iter = g_sequence_get_begin_iter(a1);
-    GSequenceIter *a1_end = g_sequence_get_end_iter(a1);
-    struct chunk *a_first = (struct chunk*)g_sequence_get(a_iter);
-    containerid cid = a_first->id;
-    
-    while (j<b_len) {
-        struct metaEntry* me = (struct metaEntry*)b_iter->data;
-        //need to read chunks
-        if (pattern[j]) {
-            struct pattern_chunk *ch = malloc(sizeof(struct pattern_chunk));
-            ch->me = me;
-            ch->data = write_buf+read_len;
-            g_hash_table_insert(ht_pattern_chunks, &me->fp, ch);
-            if (flag==0) {
-                read_off = me->off;
-                read_len = me->len;
-                flag = 1;
-            }else
-            read_len += me->len;
-        }else if (flag==1) {
-            flag = 0;
-            read_data_in_container(cid, read_off, read_len, write_buf+buff_off);
-            DEBUG("read %d data at offset %d ", read_len, read_off);
-            buff_off += read_len;
-        }
-        
-        j++;
-        b_iter = g_list_next(b_iter);
-    }
-    if (flag==1) {
-        read_data_in_container(cid, read_off, read_len, write_buf+buff_off);
-        DEBUG("read %d data at offset %d ", read_len, read_off);
-    }
-    
-    //assign data for each chunk in recipe list
-    a_iter = g_sequence_get_begin_iter(a1);
-    
-    for (i=0; i<a1_len+a2_len; i++) {
-        if (a_iter == a1_end)
-        a_iter = g_sequence_get_begin_iter(a2);
-        
+//assign the data read by the pattern to the chunks of the unread list
+static void assign_data_by_pattern(struct pattern *p, GSequence *a, unsigned char *buf, int32_t *buf_off){
+    GSequenceIter *a_iter = g_sequence_get_begin_iter(a);
+    GSequenceIter *a_end = g_sequence_get_end_iter(a);
+    while (a_iter != a_end) {
         struct chunk *ch = (struct chunk*)g_sequence_get(a_iter);
-        //data has already read index by pattern hash table
-        struct pattern_chunk *pch = g_hash_table_lookup(ht_pattern_chunks, &ch->fp);
-        if (pch) {
-            //copy data of chunks into the segment
-            assert(ch->size == pch->me->len);
-            ch->data = malloc(ch->size);
-            assert(pch->data);
-            memcpy(ch->data, pch->data, ch->size);
+        int j = pattern_index(p, &ch->fp);
+        if (j >= 0 && PATTERN_TEST(p, j)) {
+            struct metaEntry *me = &p->cm->entries[p->start + j];
+            assert(ch->size == me->size);
+            if (destor.simulation_level == SIMULATION_NO) {
+                ch->data = slab_alloc(ch->size);
+                decompress_chunk_data(me, buf + buf_off[j], ch->data);
+            }
             
             GSequenceIter *t = g_sequence_iter_next(a_iter);
             g_sequence_remove(a_iter);
             a_iter = t;
         }
         else
-        a_iter = g_sequence_iter_next(a_iter);
+            a_iter = g_sequence_iter_next(a_iter);
     }
-    g_hash_table_remove_all(ht_pattern_chunks);
 }
 
-
-
-static int* generate_merged_pattern(GSequence *a1, GSequence *a2, GList *b, int a1_len, int a2_len, int b_len){
-    int i, j, k, d;
-    int val;
-    //assert(a1_len == g_sequence_get_length(a1) && a2_len == g_sequence_get_length(a2));
-    
-    //generate the pattern
-    int *pattern = (int*)malloc(sizeof(int)*b_len);
-    memset(pattern, 0, sizeof(int)*b_len);
-    
-    GHashTable *ht = g_hash_table_new(g_int_hash, (GEqualFunc)g_fingerprint_equal);
-    
-    val = 2;
-    GSequenceIter *a_iter = g_sequence_get_begin_iter(a2);
-    for (i=0; i<a2_len; i++) {
-        struct chunk *ch = (struct chunk*)g_sequence_get(a_iter);
-        g_hash_table_insert(ht, &ch->fp, &val);
-        a_iter = g_sequence_iter_next(a_iter);
-    }
-    
-    val = 1;
-    a_iter = g_sequence_get_begin_iter(a1);
-    for (i=0; i<a1_len; i++) {
-        struct chunk *ch = (struct chunk*)g_sequence_get(a_iter);
-        g_hash_table_insert(ht, &ch->fp, &val);
-        a_iter = g_sequence_iter_next(a_iter);
-    }
-    
-    GList *b_iter = b;
-    for (j=0; j<b_len; j++) {
-        struct metaEntry *me = (struct metaEntry*)b_iter->data;
-        int *pv = g_hash_table_lookup(ht, &me->fp);
-        if (pv)
-        pattern[j] = *pv;
-        b_iter = g_list_next(b_iter);
+/*
+ * Read data according to the pattern, and assign it to the chunks of a1 and a2 (if any).
+ * The runs of marked entries are coalesced into ranges,
+ * which are read by one vectored read.
+ */
+static void read_data_by_pattern(struct pattern *p, GSequence *a1, GSequence *a2){
+    int n = pattern_count(p);
+    struct containerRange *ranges = malloc(sizeof(struct containerRange) * n);
+    int32_t *buf_off = malloc(sizeof(int32_t) * p->len);
+    int32_t buf_len = 0;
+    int w, r = 0;
+    
+    for (w = 0; w < PATTERN_WORDS(p->len); w++) {
+        uint64_t word = p->bits[w];
+        while (word) {
+            int j = (w << 6) + __builtin_ctzll(word);
+            word &= word - 1;
+            buf_off[j] = buf_len;
+            buf_len += p->cm->entries[p->start + j].len;
+        }
     }
-    g_hash_table_destroy(ht);
-    
-    
-    
-    //wild match the pattern
-    for (j=0; j<b_len; j+=d) {
-        while (pattern[j]) j++;
-        if (j>=b_len)
-        break;
-        d=0;
-        while (pattern[j+d] == 0) d++;
-        if (j+d >=b_len)
-        break;
-        if (d<=destor.wildcard_length) {
-            for (i=0; i<d; i++)
-            pattern[j+i] = 3;
+    unsigned char *buf = malloc(buf_len);
+    
+    for (w = 0; w < PATTERN_WORDS(p->len); w++) {
+        uint64_t word = p->bits[w];
+        while (word) {
+            int j = (w << 6) + __builtin_ctzll(word);
+            word &= word - 1;
+            struct metaEntry *me = &p->cm->entries[p->start + j];
+            if (r > 0 && ranges[r-1].off + ranges[r-1].len == me->off)
+                ranges[r-1].len += me->len;
+            else {
+                ranges[r].off = me->off;
+                ranges[r].len = me->len;
+                ranges[r].buf = buf + buf_off[j];
+                r++;
+            }
         }
     }
-    //
-    //        //output the pattern
-    //        printf("the merged pattern as follows: \n");
-    //        for (i=0; i<b_len; i++) {
-    //            printf("%d", pattern[i]);
-    //        }
-    //        printf("\n");
+    read_ranges_in_container(p->cm->id, ranges, r);
+    DEBUG("read %d data in %d ranges of container %lld", buf_len, r, p->cm->id);
     
-    return pattern;
+    assign_data_by_pattern(p, a1, buf, buf_off);
+    if (a2)
+        assign_data_by_pattern(p, a2, buf, buf_off);
+    
+    free(buf);
+    free(buf_off);
+    free(ranges);
 }
 
 static void send_segment_to_restore (struct segment *s){
@@ -435,21 +312,6 @@ static void remove_cached_chunks_in_unread_list(GSequence* s_list, int32_t* s_le
 
 
 
-static int is_prefetch_container(int *pattern, int len, int chunk_num){
-    int i, cnt=0;
-    for (i=0; i<len; i++) {
-        if (pattern[i]) {
-            cnt++;
-        }
-    }
-    
-    if (cnt > destor.prefetch_container_percent*chunk_num){
-        //NOTICE("cnt=%d;chunk_num=%d",cnt,chunk_num);
-        return 1;
-        
-    }
-    return 0;
-}
 
 
 
@@ -457,15 +319,15 @@ void* pattern_restore_plus_thread(void *arg) {
     struct segment *s1 = NULL, *s2 = NULL;
     GSequence *s1_chunk_list, *s2_chunk_list;
     int32_t s1_cur_len, s2_cur_len;
-    int32_t t_num;
     
     //# of meta data of containers
     metaCache = new_lru_cache(destor.size_of_meta_cache, (void*)free_container_meta, container_meta_check_id);
     //data cache
     
     if (destor.restore_cache[1]){
-        dataCache = new_lru_cache(destor.restore_cache[1], (void*)free_container,
-                              lookup_fingerprint_in_container);
+        dataCache = new_indexed_lru_cache(destor.restore_cache[1], (void*)free_container,
+                              NULL, (void*)container_foreach_fingerprint,
+                              g_int_hash, (GEqualFunc)g_fingerprint_equal);
     }
     
     struct chunk *c = NULL;
@@ -477,9 +339,6 @@ void* pattern_restore_plus_thread(void *arg) {
     s1_chunk_list = generate_unread_list(s1, &s1_cur_len);
     
     
-    //index the pattern by hash table
-    ht_pattern_chunks = g_hash_table_new_full(g_int_hash, (GEqualFunc)g_fingerprint_equal, NULL, free);
-    
     while (1) {
         TIMER_DECLARE(1);
         TIMER_BEGIN(1);
@@ -536,60 +395,27 @@ void* pattern_restore_plus_thread(void *arg) {
             }
             assert(me);
             
-            //locate the start position of chunk list of the container
-            GList *t_chunk_list = g_hash_table_lookup(me->map, &ch->fp);
-            assert(t_chunk_list);
-            t_num = g_list_length(t_chunk_list);
-            DEBUG("the found chunk list length is %d in the container (%d)", t_num, ch->id);
-            assert(t_num);
+            //locate the start position of the chunk in the entries of the container
+            struct metaEntry *first = g_hash_table_lookup(me->map, &ch->fp);
+            assert(first);
+            struct pattern pattern;
+            init_pattern(&pattern, me, first);
+            DEBUG("the found chunk list length is %d in the container (%d)", pattern.len, ch->id);
+            assert(pattern.len);
             
-
-            int *pattern;
-            unsigned char* buff=NULL;
-            if (s1_cur_len >= s1->chunk_num / 2|| s2_cur_len == 0) {
-                //NOTICE("go s1 way---0");
-                //generate patterns in seqence s1 and t
-                pattern = generate_pattern(s1_chunk_list, t_chunk_list, s1_cur_len, t_num);
-                
-                
-                if (destor.restore_cache[1]&&is_prefetch_container(pattern, t_num, me->chunk_num)) {
-                    struct container* con = retrieve_container_by_id(ch->id);
-                    //NOTICE("hello thread1!\n");
-                    lru_cache_insert(dataCache, con, NULL, NULL);
-                    //jcr.read_container_num++;
-                    //NOTICE("s1 insert into dataCache,dataCache.size=%d",dataCache->size);
-                    read_data_by_pattern_in_data_cache(s1_chunk_list,s1_cur_len, con);
-                }else{
-                    //NOTICE("go s1 way---1");
-                    //allocate data space
-                    buff = allocate_data_buffer(pattern, t_chunk_list, t_num);
-                    //NOTICE("go s1 way---2");
-                    //read data
-                    read_data_by_pattern(pattern, s1_chunk_list, t_chunk_list, s1_cur_len, t_num, buff);
-                    //NOTICE("go s1 way---3");
-                }
-                //^^^^^^^^^^^^^^^^TIMER_END(1,jcr.read_chunk_time);
-            }else {
-                //NOTICE("go s1 and s2 way---0");
-                //generate the merged patterns in seqence s1, s2 and t
-                pattern = generate_merged_pattern(s1_chunk_list, s2_chunk_list, t_chunk_list, s1_cur_len, s2_cur_len, t_num);
-                //NOTICE("go s1 and s2 way---1");
-                if (destor.restore_cache[1]&&is_prefetch_container(pattern, t_num, me->chunk_num)) {
-                    struct container* con = retrieve_container_by_id(ch->id);
-                    //NOTICE("hello thread2!\n");
-                    lru_cache_insert(dataCache, con, NULL, NULL);
-                    //NOTICE("s2 insert into dataCache,dataCache.size=%d",dataCache->size);
-                    //jcr.read_container_num++;
-                    read_data_by_pattern_in_data_cache(s1_chunk_list,s1_cur_len, con);
-                }else{
-                    //allocate data space
-                    buff = allocate_data_buffer(pattern, t_chunk_list, t_num);
-                    //NOTICE("go s1 and s2 way---2");
-                    //read data
-                    read_data_by_merged_pattern(pattern, s1_chunk_list, s2_chunk_list, t_chunk_list, s1_cur_len, s2_cur_len, t_num, buff);
-                    //NOTICE("go s1 and s2 way---3");
-                }
-                //^^^^^^^^^^^^^^TIMER_END(1,jcr.read_chunk_time);
+            //generate the pattern in seqence s1 (and s2) and the container
+            int merged = !(s1_cur_len >= s1->chunk_num / 2 || s2_cur_len == 0);
+            mark_pattern(&pattern, s1_chunk_list);
+            if (merged)
+                mark_pattern(&pattern, s2_chunk_list);
+            wildcard_pattern(&pattern);
+            
+            if (destor.restore_cache[1] && pattern_count(&pattern) > destor.prefetch_container_percent * me->chunk_num) {
+                struct container* con = retrieve_container_by_id(ch->id);
+                lru_cache_insert(dataCache, con, NULL, NULL);
+                read_data_by_pattern_in_data_cache(s1_chunk_list, s1_cur_len, con);
+            }else{
+                read_data_by_pattern(&pattern, s1_chunk_list, merged ? s2_chunk_list : NULL);
             }
             
             assert(s1_chunk_list);
@@ -598,10 +424,7 @@ void* pattern_restore_plus_thread(void *arg) {
             s2_cur_len = g_sequence_get_length(s2_chunk_list);
             DEBUG("the remained length of s1 is %d and s2 is %d", s1_cur_len, s2_cur_len);
             
-            if (buff) {
-                free(buff);
-            }
-            free(pattern);
+            free(pattern.bits);
         }
         TIMER_END(1,jcr.read_chunk_time);
 
@@ -636,7 +459,6 @@ void* pattern_restore_plus_thread(void *arg) {
     }
     
     
-    g_hash_table_destroy(ht_pattern_chunks);
     free_lru_cache(metaCache);
     if (destor.restore_cache[1]) {
         free_lru_cache(dataCache);
@@ -40,9 +40,10 @@ unsigned char* allocate_data_buffer(int *pattern, GList* b, int len){
 
 
 static struct chunk* dup_chunk(struct chunk* ch){
-    struct chunk *dup = malloc(sizeof(struct chunk));
-    memcpy(dup, ch, sizeof(struct chunk));
-    dup->data = malloc(ch->size);
+    struct chunk *dup = new_chunk(ch->size);
+    dup->flag = ch->flag;
+    dup->id = ch->id;
+    memcpy(dup->fp, ch->fp, sizeof(fingerprint));
     memcpy(dup->data, ch->data, ch->size);
     return dup;
 }
@@ -71,7 +72,8 @@ static void read_data_by_pattern_in_data_cache(GSequence *a, int a_len, struct c
         if (ch->id == con->meta.id) {
             struct chunk *rc = get_chunk_in_container(con, &ch->fp);
             ch->data = rc->data;
-            free(rc);
+            rc->data = NULL;
+            free_chunk(rc);
             
             GSequenceIter *t = g_sequence_iter_next(a_iter);
             g_sequence_remove(a_iter);
@@ -132,7 +134,7 @@ static void read_data_by_pattern(int *pattern, GSequence *a, GList *b, int a_len
         if (pch) {
             //copy data of chunks into the segment
             assert(ch->size == pch->me->len);
-            ch->data = malloc(ch->size);
+            ch->data = slab_alloc(ch->size);
             assert(pch->data);
             memcpy(ch->data, pch->data, ch->size);
             
@@ -257,7 +259,7 @@ static void read_data_by_merged_pattern(int *pattern, GSequence *a1, GSequence *
         if (pch) {
             //copy data of chunks into the segment
             assert(ch->size == pch->me->len);
-            ch->data = malloc(ch->size);
+            ch->data = slab_alloc(ch->size);
             assert(pch->data);
             memcpy(ch->data, pch->data, ch->size);
             
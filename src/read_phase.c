@@ -4,9 +4,43 @@
 
 static pthread_t read_t;
 
-static void read_file(sds path) {
-	static unsigned char buf[DEFAULT_BLOCK_SIZE];
+/*
+ * A file is read in blocks of up to this size,
+ * each in a read buffer of its own,
+ * to bound the memory held by a file in the pipeline.
+ * The file is not mapped, since a file truncated during the backup
+ * would raise SIGBUS when the chunkers touch the missing pages.
+ */
+#define READ_BLOCK_SIZE (8 * 1024 * 1024)
+
+/*
+ * Read the next block of the file, of up to size bytes.
+ * A block but the first has room for a chunk in front of it,
+ * where the chunk phase moves the tail of the previous block.
+ * Return NULL at the end of the file.
+ */
+static struct readBuffer* read_block(int fd, int64_t size, int first) {
+	struct readBuffer *rb = malloc(sizeof(struct readBuffer));
+	rb->ref = 1;
+	rb->headroom = first ? 0 : destor.chunk_max_size;
+	rb->data = (unsigned char*) malloc(rb->headroom + size) + rb->headroom;
+	rb->size = 0;
+	while (rb->size < size) {
+		ssize_t n = read(fd, rb->data + rb->size, size - rb->size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		rb->size += n;
+	}
+	if (rb->size == 0) {
+		read_buffer_unref(rb);
+		return NULL;
+	}
+	return rb;
+}
 
+static void read_file(sds path) {
 	sds filename = sdsdup(path);
 
 	if (jcr.path[sdslen(jcr.path) - 1] == '/') {
@@ -34,28 +68,47 @@ static void read_file(sds path) {
 
 	SET_CHUNK(c, CHUNK_FILE_START);
 
-	sync_queue_push(read_queue, c);
+	spsc_ring_push(read_queue, c);
 
 	TIMER_DECLARE(1);
 	TIMER_BEGIN(1);
-	int size = 0;
 
-	while ((size = fread(buf, 1, DEFAULT_BLOCK_SIZE, fp)) != 0) {
+	/*
+	 * A regular file is read up to its size at the open,
+	 * and a shorter read means it was truncated.
+	 * Other files are read to the end.
+	 */
+	struct stat st;
+	int regular = fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
+	int64_t left = regular ? st.st_size : INT64_MAX;
+
+	struct readBuffer *rb;
+	int first = 1;
+	while (left > 0 && (rb = read_block(fileno(fp),
+			left > READ_BLOCK_SIZE ? READ_BLOCK_SIZE : left, first))) {
 		TIMER_END(1, jcr.read_time);
-
-		VERBOSE("Read phase: read %d bytes", size);
-
-		c = new_chunk(size);
-		memcpy(c->data, buf, size);
-
-		sync_queue_push(read_queue, c);
-
+		/*
+		 * Zero-copy: the block is pushed as views of DEFAULT_BLOCK_SIZE,
+		 * which the chunk phase cuts in place.
+		 */
+		int64_t off = 0;
+		while (off < rb->size) {
+			int size = rb->size - off > DEFAULT_BLOCK_SIZE ?
+					DEFAULT_BLOCK_SIZE : rb->size - off;
+			VERBOSE("Read phase: read %d bytes", size);
+			spsc_ring_push(read_queue, new_chunk_view(rb, rb->data + off, size));
+			off += size;
+		}
+		left -= rb->size;
+		first = 0;
+		read_buffer_unref(rb);
 		TIMER_BEGIN(1);
 	}
+	TIMER_END(1, jcr.read_time);
 
 	c = new_chunk(0);
 	SET_CHUNK(c, CHUNK_FILE_END);
-	sync_queue_push(read_queue, c);
+	spsc_ring_push(read_queue, c);
 
 	fclose(fp);
 
@@ -101,14 +154,14 @@ static void find_one_file(sds path) {
 static void* read_thread(void *argv) {
 	/* Each file will be processed separately */
 	find_one_file(jcr.path);
-	sync_queue_term(read_queue);
+	spsc_ring_term(read_queue);
 	return NULL;
 }
 
 void start_read_phase() {
     /* running job */
     jcr.status = JCR_STATUS_RUNNING;
-	read_queue = sync_queue_new(10);
+	read_queue = spsc_ring_new(10);
 	pthread_create(&read_t, NULL, read_thread, NULL);
 }
 
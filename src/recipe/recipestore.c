@@ -56,6 +56,12 @@ static int metabufsize = 64*1024;
 /* the write buffer of records */
 static int recordbufsize = 64*1024;
 
+/* the read buffer of the recipe */
+static int recipebufsize = 4*1024*1024;
+
+/* A chunk pointer is packed in the recipe. */
+#define CHUNK_POINTER_SIZE (sizeof(fingerprint) + sizeof(containerid) + sizeof(int32_t))
+
 /*
  * Create a new backupVersion structure for a backup run.
  */
@@ -118,6 +124,10 @@ struct backupVersion* create_backup_version(const char *path) {
 	b->recordbuf = malloc(recordbufsize);
 	b->recordbufoff = 0;
 
+	b->recipebuf = 0;
+	b->recipebufoff = b->recipebuflen = 0;
+	b->read_chunk_num = 0;
+
 	fname = sdscpy(fname, b->fname_prefix);
 	fname = sdscat(fname, ".records");
 	if ((b->record_fp = fopen(fname, "w")) <= 0) {
@@ -202,6 +212,7 @@ struct backupVersion* open_backup_version(int number) {
 		fprintf(stderr, "Can not open bv%d.recipe!\n", b->bv_num);
 		exit(1);
 	}
+	posix_fadvise(fileno(b->recipe_fp), 0, 0, POSIX_FADV_SEQUENTIAL);
 
 	fname = sdscpy(fname, b->fname_prefix);
 	fname = sdscat(fname, ".records");
@@ -216,6 +227,10 @@ struct backupVersion* open_backup_version(int number) {
 	b->recordbuf = 0;
 	b->recordbufoff = 0;
 
+	b->recipebuf = 0;
+	b->recipebufoff = b->recipebuflen = 0;
+	b->read_chunk_num = 0;
+
 	sdsfree(fname);
 
 	return b;
@@ -268,6 +283,10 @@ void free_backup_version(struct backupVersion *b) {
 		free(b->recordbuf);
 		b->recordbuf = 0;
 	}
+	if(b->recipebuf){
+		free(b->recipebuf);
+		b->recipebuf = 0;
+	}
 
 	if (b->metadata_fp)
 		fclose(b->metadata_fp);
@@ -422,6 +441,63 @@ struct fileRecipeMeta* read_next_file_recipe_meta(struct backupVersion* b) {
 	return r;
 }
 
+/*
+ * Move the unread bytes to the head of the buffer, and fill the rest.
+ * The kernel is asked to read the next block ahead.
+ * Return the number of unread bytes.
+ */
+static int fill_recipe_buffer(struct backupVersion* b) {
+	if (!b->recipebuf)
+		b->recipebuf = malloc(recipebufsize);
+
+	int left = b->recipebuflen - b->recipebufoff;
+	memmove(b->recipebuf, b->recipebuf + b->recipebufoff, left);
+	b->recipebufoff = 0;
+	b->recipebuflen = left
+			+ fread(b->recipebuf + left, 1, recipebufsize - left, b->recipe_fp);
+
+	posix_fadvise(fileno(b->recipe_fp), ftello(b->recipe_fp), recipebufsize,
+			POSIX_FADV_WILLNEED);
+
+	return b->recipebuflen;
+}
+
+/*
+ * Read the next chunk pointer into cp, skipping segment flags.
+ * The recipe is read in blocks of recipebufsize,
+ * and chunk pointers are decoded from the buffer.
+ * Return 0 at the end of the stream.
+ */
+int read_next_chunk_pointer(struct backupVersion* b, struct chunkPointer* cp) {
+	if (b->read_chunk_num == b->number_of_chunks)
+		return 0;
+
+	while (1) {
+		if (b->recipebuflen - b->recipebufoff < CHUNK_POINTER_SIZE
+				&& fill_recipe_buffer(b) < CHUNK_POINTER_SIZE) {
+			fprintf(stderr, "bv%d.recipe is truncated!\n", b->bv_num);
+			exit(1);
+		}
+
+		char *p = b->recipebuf + b->recipebufoff;
+		b->recipebufoff += CHUNK_POINTER_SIZE;
+
+		containerid id;
+		memcpy(&id, p + sizeof(fingerprint), sizeof(containerid));
+		/* Ignore segment boundaries */
+		if (id == 0 - CHUNK_SEGMENT_START || id == 0 - CHUNK_SEGMENT_END)
+			continue;
+
+		memcpy(&cp->fp, p, sizeof(fingerprint));
+		cp->id = id;
+		memcpy(&cp->size, p + sizeof(fingerprint) + sizeof(containerid),
+				sizeof(int32_t));
+
+		b->read_chunk_num++;
+		return 1;
+	}
+}
+
 /*
  * If return value is not NULL, a new file starts.
  * If no recipe and chunkpointer are read,
@@ -430,35 +506,23 @@ struct fileRecipeMeta* read_next_file_recipe_meta(struct backupVersion* b) {
 struct chunkPointer* read_next_n_chunk_pointers(struct backupVersion* b, int n,
 		int *k) {
 
-	/* Total number of read chunks. */
-	static int read_chunk_num;
-
-	if (read_chunk_num == b->number_of_chunks) {
+	if (b->read_chunk_num == b->number_of_chunks) {
 		/* It's the stream end. */
 		*k = 0;
 		return NULL;
 	}
 
-	int num = (b->number_of_chunks - read_chunk_num) > n ?
-					n : (b->number_of_chunks - read_chunk_num), i;
+	int num = (b->number_of_chunks - b->read_chunk_num) > n ?
+					n : (b->number_of_chunks - b->read_chunk_num), i;
 
 	struct chunkPointer *cp = (struct chunkPointer *) malloc(
 			sizeof(struct chunkPointer) * num);
 
-	for (i = 0; i < num; i++) {
-		fread(&(cp[i].fp), sizeof(fingerprint), 1, b->recipe_fp);
-		fread(&(cp[i].id), sizeof(containerid), 1, b->recipe_fp);
-		fread(&(cp[i].size), sizeof(int32_t), 1, b->recipe_fp);
-		/* Ignore segment boundaries */
-		if(cp[i].id == 0 - CHUNK_SEGMENT_START || cp[i].id == 0 - CHUNK_SEGMENT_END)
-			i--;
-	}
+	for (i = 0; i < num; i++)
+		read_next_chunk_pointer(b, &cp[i]);
 
 	*k = num;
 
-	read_chunk_num += num;
-	assert(read_chunk_num <= b->number_of_chunks);
-
 	return cp;
 }
 
@@ -648,3 +712,13 @@ int lookup_fingerprint_in_segment_recipe(struct segmentRecipe* sr,
         fingerprint *fp) {
     return g_hash_table_lookup(sr->kvpairs, fp) == NULL ? 0 : 1;
 }
+
+/* For indexed caches of segment recipes. */
+void segment_recipe_foreach_fingerprint(struct segmentRecipe* sr,
+        void (*visit)(void* fp, void* arg), void* arg) {
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, sr->kvpairs);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        visit(key, arg);
+}
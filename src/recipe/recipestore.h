@@ -49,6 +49,12 @@ struct backupVersion {
 	char* segmentbuf;
 	int segmentlen;
 	int segmentbufoff;
+
+	/* the read buffer of the recipe, for restore */
+	char *recipebuf;
+	int recipebufoff;
+	int recipebuflen;
+	int64_t read_chunk_num;
 };
 
 /* Point to the meta of a file recipe */
@@ -106,6 +112,7 @@ void append_file_recipe_meta(struct backupVersion* b, struct fileRecipeMeta* r);
 void append_n_chunk_pointers(struct backupVersion* b,
 		struct chunkPointer* cp, int n);
 struct fileRecipeMeta* read_next_file_recipe_meta(struct backupVersion* b);
+int read_next_chunk_pointer(struct backupVersion* b, struct chunkPointer* cp);
 struct chunkPointer* read_next_n_chunk_pointers(struct backupVersion* b, int n,
 		int *k);
 containerid* read_next_n_records(struct backupVersion* b, int n, int *k);
@@ -119,6 +126,8 @@ segmentid append_segment_flag(struct backupVersion* b, int flag, int segment_siz
 GQueue* prefetch_segments(segmentid id, int prefetch_num);
 int lookup_fingerprint_in_segment_recipe(struct segmentRecipe* sr,
         fingerprint *fp);
+void segment_recipe_foreach_fingerprint(struct segmentRecipe* sr,
+        void (*visit)(void* fp, void* arg), void* arg);
 
 struct segmentRecipe* read_next_segment(struct backupVersion *bv);
 
@@ -15,6 +15,8 @@ SyncQueue *restore_recipe_queue;
 
 void* assembly_restore_thread(void *arg);
 void* optimal_restore_thread(void *arg);
+void* chunk_restore_thread(void *arg);
+void* alacc_restore_thread(void *arg);
 void* pattern_restore_thread(void *arg);
 void* pattern_restore_plus_thread(void *arg);
 
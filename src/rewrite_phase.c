@@ -109,25 +109,25 @@ struct chunk* rewrite_buffer_pop() {
  */
 static void* no_rewrite(void* arg) {
 	while (1) {
-		struct chunk* c = sync_queue_pop(dedup_queue);
+		struct chunk* c = spsc_ring_pop(dedup_queue);
 
 		if (c == NULL)
 			break;
 
-		sync_queue_push(rewrite_queue, c);
+		spsc_ring_push(rewrite_queue, c);
 
         /* History-Aware Rewriting */
         if (destor.rewrite_enable_har && CHECK_CHUNK(c, CHUNK_DUPLICATE))
             har_check(c);
     }
 
-    sync_queue_term(rewrite_queue);
+    spsc_ring_term(rewrite_queue);
 
     return NULL;
 }
 
 void start_rewrite_phase() {
-    rewrite_queue = sync_queue_new(1000);
+    rewrite_queue = spsc_ring_new(1000);
 
     init_rewrite_buffer();
 
@@ -0,0 +1,318 @@
+/*
+ * compression.c
+ *
+ *  The filter phase hands a segment to the pool,
+ *  and compresses chunks along with the workers until all are done.
+ */
+#include "compression.h"
+#include "containerstore.h"
+#include "../jcr.h"
+#include "../utils/lru_cache.h"
+#include "../utils/delta.h"
+#include "../index/sketch_index.h"
+#include <lz4.h>
+#include <zstd.h>
+
+static struct {
+	pthread_mutex_t mutex;
+	/* a new segment, or stop */
+	pthread_cond_t work;
+	pthread_cond_t done;
+
+	/* the chunks of the current segment */
+	struct chunk **chunks;
+	/* the container being filled, not a base here */
+	containerid open_id;
+	int chunk_num;
+	/* the next chunk to compress */
+	int next;
+	int finished;
+
+	int stop;
+	int thread_num;
+	pthread_t *threads;
+} pool;
+
+static struct chunk* retrieve_base_chunk(fingerprint *fp, containerid id);
+
+/* Whether chunks are compressed or delta compressed before being stored. */
+static int compression_enabled() {
+	return (destor.chunk_compression[0] != CHUNK_CODEC_NONE
+			|| destor.delta_compression)
+			&& destor.simulation_level < SIMULATION_APPEND;
+}
+
+static void compress_chunk_data(struct chunk* c) {
+	/* It is worth storing only if smaller. */
+	unsigned char *z = malloc(c->size);
+	int64_t n = 0;
+
+	switch (destor.chunk_compression[0]) {
+	case CHUNK_CODEC_LZ4:
+		n = LZ4_compress_default((char*) c->data, (char*) z, c->size,
+				c->size - 1);
+		break;
+	case CHUNK_CODEC_ZSTD:
+		n = ZSTD_compress(z, c->size - 1, c->data, c->size,
+				destor.chunk_compression[1]);
+		if (ZSTD_isError(n))
+			n = 0;
+		break;
+	default:
+		assert(0);
+	}
+
+	if (n <= 0) {
+		free(z);
+		return;
+	}
+	c->zdata = z;
+	c->zsize = n;
+	c->zcodec = destor.chunk_compression[0];
+}
+
+/*
+ * Delta compress a unique chunk against a resembling stored chunk.
+ * The sketch index is updated only by the filter phase,
+ * which is in compress_segment, so it is read here without a lock.
+ */
+static void delta_compress_stored(struct chunk* c) {
+	c->sf = malloc(sizeof(uint64_t) * SKETCH_SF_NUM);
+	chunk_super_features(c, c->sf);
+
+	fingerprint base_fp;
+	containerid base_id;
+	if (!sketch_index_lookup(c->sf, &base_fp, &base_id)
+			|| base_id == pool.open_id)
+		return;
+
+	struct chunk *base = retrieve_base_chunk(&base_fp, base_id);
+	delta_compress_chunk(c, base, &base_fp, base_id);
+	free_chunk(base);
+}
+
+static void compress_chunk(struct chunk* c) {
+	if (destor.chunk_compression[0] != CHUNK_CODEC_NONE)
+		compress_chunk_data(c);
+	if (destor.delta_compression && !CHECK_CHUNK(c, CHUNK_DUPLICATE))
+		delta_compress_stored(c);
+}
+
+static void* compress_thread(void *arg) {
+	pthread_mutex_lock(&pool.mutex);
+	while (1) {
+		while (!pool.stop && pool.next >= pool.chunk_num)
+			pthread_cond_wait(&pool.work, &pool.mutex);
+		if (pool.stop)
+			break;
+
+		struct chunk *c = pool.chunks[pool.next++];
+		pthread_mutex_unlock(&pool.mutex);
+
+		compress_chunk(c);
+
+		pthread_mutex_lock(&pool.mutex);
+		if (++pool.finished == pool.chunk_num)
+			pthread_cond_signal(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+	return NULL;
+}
+
+void init_compression() {
+	pool.thread_num = 0;
+	if (!compression_enabled())
+		return;
+
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pool.chunks = NULL;
+	pool.chunk_num = 0;
+	pool.next = 0;
+	pool.finished = 0;
+	pool.stop = 0;
+
+	/* The filter phase is a worker too. */
+	pool.thread_num = destor.compression_thread_num - 1;
+	if (pool.thread_num > 0) {
+		pool.threads = malloc(sizeof(pthread_t) * pool.thread_num);
+		int i;
+		for (i = 0; i < pool.thread_num; i++)
+			pthread_create(&pool.threads[i], NULL, compress_thread, NULL);
+	}
+}
+
+void close_compression() {
+	if (!compression_enabled())
+		return;
+
+	if (pool.thread_num > 0) {
+		pthread_mutex_lock(&pool.mutex);
+		pool.stop = 1;
+		pthread_cond_broadcast(&pool.work);
+		pthread_mutex_unlock(&pool.mutex);
+
+		int i;
+		for (i = 0; i < pool.thread_num; i++)
+			pthread_join(pool.threads[i], NULL);
+		free(pool.threads);
+	}
+
+	pthread_mutex_destroy(&pool.mutex);
+	pthread_cond_destroy(&pool.work);
+	pthread_cond_destroy(&pool.done);
+}
+
+void compress_segment(struct segment* s, containerid open_id) {
+	if (!compression_enabled())
+		return;
+
+	/* Unique chunks and rewrite candidates. */
+	struct chunk **chunks = malloc(sizeof(struct chunk*) * s->chunk_num);
+	int num = 0;
+	GSequenceIter *iter = g_sequence_get_begin_iter(s->chunks);
+	GSequenceIter *end = g_sequence_get_end_iter(s->chunks);
+	for (; iter != end; iter = g_sequence_iter_next(iter)) {
+		struct chunk* c = g_sequence_get(iter);
+		if (CHECK_CHUNK(c, CHUNK_FILE_START) || CHECK_CHUNK(c, CHUNK_FILE_END))
+			continue;
+		if (!CHECK_CHUNK(c, CHUNK_DUPLICATE) || CHECK_CHUNK(c, CHUNK_SPARSE)
+				|| CHECK_CHUNK(c, CHUNK_OUT_OF_ORDER))
+			chunks[num++] = c;
+	}
+
+	pool.open_id = open_id;
+	if (pool.thread_num <= 0 || num <= 1) {
+		int i;
+		for (i = 0; i < num; i++)
+			compress_chunk(chunks[i]);
+		free(chunks);
+		return;
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.chunks = chunks;
+	pool.chunk_num = num;
+	pool.next = 0;
+	pool.finished = 0;
+	pthread_cond_broadcast(&pool.work);
+
+	while (pool.next < pool.chunk_num) {
+		struct chunk *c = pool.chunks[pool.next++];
+		pthread_mutex_unlock(&pool.mutex);
+
+		compress_chunk(c);
+
+		pthread_mutex_lock(&pool.mutex);
+		pool.finished++;
+	}
+	while (pool.finished < pool.chunk_num)
+		pthread_cond_wait(&pool.done, &pool.mutex);
+
+	pool.chunks = NULL;
+	pool.chunk_num = 0;
+	pool.next = 0;
+	pthread_mutex_unlock(&pool.mutex);
+
+	free(chunks);
+}
+
+/* A delta starts with the fingerprint and the container id of its base. */
+#define DELTA_HEAD (sizeof(fingerprint) + sizeof(containerid))
+
+/* Containers of recent base chunks, as resembling chunks cluster. */
+#define BASE_CACHE_SIZE 16
+static struct lruCache *base_cache;
+static pthread_mutex_t base_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The base chunk fp of delta compression in container id. */
+static struct chunk* retrieve_base_chunk(fingerprint *fp, containerid id) {
+	pthread_mutex_lock(&base_mutex);
+
+	if (!base_cache)
+		base_cache = new_lru_cache(BASE_CACHE_SIZE, free_container,
+				container_check_id);
+
+	struct container *c = lru_cache_lookup(base_cache, &id);
+	if (!c) {
+		c = retrieve_container_by_id(id);
+		lru_cache_insert(base_cache, c, NULL, NULL);
+	}
+	struct chunk *base = get_chunk_in_container(c, fp);
+
+	pthread_mutex_unlock(&base_mutex);
+	return base;
+}
+
+void free_base_cache() {
+	pthread_mutex_lock(&base_mutex);
+	if (base_cache) {
+		free_lru_cache(base_cache);
+		base_cache = NULL;
+	}
+	pthread_mutex_unlock(&base_mutex);
+}
+
+void delta_compress_chunk(struct chunk* c, struct chunk* base,
+		fingerprint *base_fp, containerid base_id) {
+	int cap = chunk_stored_size(c) - 1 - DELTA_HEAD;
+	if (cap <= 0)
+		return;
+
+	unsigned char *z = malloc(DELTA_HEAD + cap);
+	int n = delta_encode(base->data, base->size, c->data, c->size,
+			z + DELTA_HEAD, cap);
+	if (n == 0) {
+		free(z);
+		return;
+	}
+	memcpy(z, base_fp, sizeof(fingerprint));
+	memcpy(z + sizeof(fingerprint), &base_id, sizeof(containerid));
+
+	if (c->zdata)
+		free(c->zdata);
+	c->zdata = z;
+	c->zsize = DELTA_HEAD + n;
+	c->zcodec = CHUNK_CODEC_DELTA;
+}
+
+void decompress_chunk_data(struct metaEntry* me, unsigned char* stored,
+		unsigned char* data) {
+	int64_t n;
+	switch (me->codec) {
+	case CHUNK_CODEC_NONE:
+		memcpy(data, stored, me->len);
+		return;
+	case CHUNK_CODEC_LZ4:
+		n = LZ4_decompress_safe((char*) stored, (char*) data, me->len,
+				me->size);
+		break;
+	case CHUNK_CODEC_ZSTD:
+		n = ZSTD_decompress(data, me->size, stored, me->len);
+		if (ZSTD_isError(n))
+			n = -1;
+		break;
+	case CHUNK_CODEC_DELTA: {
+		fingerprint base_fp;
+		containerid base_id;
+		memcpy(&base_fp, stored, sizeof(fingerprint));
+		memcpy(&base_id, stored + sizeof(fingerprint), sizeof(containerid));
+
+		/* A base is never a delta, so no chain is followed. */
+		struct chunk *base = retrieve_base_chunk(&base_fp, base_id);
+		n = delta_decode(base->data, base->size, stored + DELTA_HEAD,
+				me->len - DELTA_HEAD, data, me->size);
+		free_chunk(base);
+		break;
+	}
+	default:
+		n = -1;
+	}
+
+	if (n != me->size) {
+		WARNING("Fail to decompress a chunk of %d bytes at offset %d",
+				me->len, me->off);
+		exit(1);
+	}
+}
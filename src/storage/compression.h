@@ -0,0 +1,40 @@
+/*
+ * compression.h
+ *
+ *  Chunks are compressed one by one before being packed into containers,
+ *  so a chunk can still be read without the rest of its container.
+ */
+
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+#include "../destor.h"
+
+struct metaEntry;
+
+void init_compression();
+void close_compression();
+
+/*
+ * Compress the chunks of the segment that may be written to containers,
+ * in parallel. A chunk keeps its compressed data in zdata,
+ * or NULL if compressing it saves nothing.
+ * With delta compression, a unique chunk gets its super-features,
+ * and is delta compressed against a resembling stored chunk,
+ * unless the base is in container open_id, which is being filled.
+ */
+void compress_segment(struct segment* s, containerid open_id);
+
+/* Restore the original data of a chunk stored at stored. */
+void decompress_chunk_data(struct metaEntry* me, unsigned char* stored,
+		unsigned char* data);
+
+/*
+ * Delta compress c against its base chunk,
+ * if smaller than storing it as is or compressed.
+ */
+void delta_compress_chunk(struct chunk* c, struct chunk* base,
+		fingerprint *base_fp, containerid base_id);
+void free_base_cache();
+
+#endif /* COMPRESSION_H_ */
@@ -1,25 +1,76 @@
+/* for O_DIRECT */
+#define _GNU_SOURCE
 #include "containerstore.h"
 #include "../utils/serial.h"
 #include "../utils/sync_queue.h"
 #include "../jcr.h"
+#include "compression.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+/* The offset and size alignment of O_DIRECT. */
+#define DIRECT_IO_ALIGN 4096
 
 static int64_t container_count = 0;
-static FILE* fp;
-/* Control the concurrent accesses to fp. */
-static pthread_mutex_t mutex;
 
-static pthread_t append_t;
+/*
+ * Container id is stored in shard id % shard_num,
+ * at position id / shard_num of the shard.
+ * Each shard has its own write queue and append thread,
+ * so the shards on different disks are written in parallel.
+ */
+struct containerShard {
+	/*
+	 * The pool file is accessed by pread/pwrite,
+	 * so the readers and the append thread do not share a file offset
+	 * and need no lock.
+	 */
+	int fd;
+	/* The pool file opened with O_DIRECT for reading container data, or -1. */
+	int direct_fd;
+
+	pthread_t append_t;
+	SyncQueue* container_buffer;
+	/* written only by the append thread, summed up at close */
+	double write_time;
+};
+
+/*
+ * Set in the data size of a container with compressed chunks,
+ * whose metaEntry has the original size and the codec.
+ */
+#define CONTAINER_COMPRESSED 0x40000000
+/* The original size, and the codec in the high byte. */
+#define CODEC_SHIFT 24
+
+static inline int container_compressed() {
+	return (destor.chunk_compression[0] != CHUNK_CODEC_NONE
+			|| destor.delta_compression)
+			&& destor.simulation_level < SIMULATION_APPEND;
+}
+
+static struct containerShard *shards;
+static int shard_num;
 
-static SyncQueue* container_buffer;
+static inline struct containerShard* shard_of(containerid id) {
+	return &shards[id % shard_num];
+}
 
+static inline int64_t shard_index(containerid id) {
+	return id / shard_num;
+}
 
 /*
  * We must ensure a container is either in the buffer or written to disks.
  */
 static void* append_thread(void *arg) {
+	struct containerShard *shard = arg;
 
 	while (1) {
-		struct container *c = sync_queue_get_top(container_buffer);
+		struct container *c = sync_queue_get_top(shard->container_buffer);
 		if (c == NULL)
 			break;
 
@@ -28,9 +79,9 @@ static void* append_thread(void *arg) {
 
 		write_container(c);
 
-		TIMER_END(1, jcr.write_time);
+		TIMER_END(1, shard->write_time);
 
-		sync_queue_pop(container_buffer);
+		sync_queue_pop(shard->container_buffer);
 
 		free_container(c);
 	}
@@ -38,53 +89,227 @@ static void* append_thread(void *arg) {
 	return NULL;
 }
 
-void init_container_store() {
+/* A short read only happens at the end of the pool, and the rest is zeroed. */
+static void pool_read(struct containerShard *shard, void *buf, int64_t len,
+		int64_t off) {
+	unsigned char *p = buf;
+	while (len > 0) {
+		ssize_t n = pread(shard->fd, p, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror("Fail to read the container store.");
+			exit(1);
+		}
+		if (n == 0) {
+			memset(p, 0, len);
+			break;
+		}
+		p += n;
+		len -= n;
+		off += n;
+	}
+}
+
+/* As pool_read, into the buffers of iov, which is consumed. */
+static void pool_readv(struct containerShard *shard, struct iovec *iov,
+		int cnt, int64_t off) {
+	while (cnt > 0) {
+		ssize_t n = preadv(shard->fd, iov, cnt < IOV_MAX ? cnt : IOV_MAX, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror("Fail to read the container store.");
+			exit(1);
+		}
+		if (n == 0) {
+			for (; cnt > 0; cnt--, iov++)
+				memset(iov->iov_base, 0, iov->iov_len);
+			break;
+		}
+		off += n;
+		while (cnt > 0 && n >= (ssize_t) iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (unsigned char*) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+static void pool_write(struct containerShard *shard, void *buf, int64_t len,
+		int64_t off) {
+	unsigned char *p = buf;
+	while (len > 0) {
+		ssize_t n = pwrite(shard->fd, p, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			perror("Fail to write a container in container store.");
+			exit(1);
+		}
+		p += n;
+		len -= n;
+		off += n;
+	}
+}
+
+/*
+ * Read the data of containers bypassing the page cache,
+ * so a large restore does not evict everything else.
+ * The range is widened to aligned boundaries
+ * and read into an aligned buffer.
+ */
+static void pool_read_direct(struct containerShard *shard, void *buf,
+		int64_t len, int64_t off) {
+	if (shard->direct_fd < 0) {
+		pool_read(shard, buf, len, off);
+		return;
+	}
+
+	int64_t begin = off & ~(int64_t) (DIRECT_IO_ALIGN - 1);
+	int64_t end = (off + len + DIRECT_IO_ALIGN - 1)
+			& ~(int64_t) (DIRECT_IO_ALIGN - 1);
+	unsigned char *aligned;
+	if (posix_memalign((void**) &aligned, DIRECT_IO_ALIGN, end - begin)) {
+		pool_read(shard, buf, len, off);
+		return;
+	}
+
+	/* The pool may end in the middle of the last block. */
+	int64_t got = 0;
+	while (got < off + len - begin) {
+		ssize_t n = pread(shard->direct_fd, aligned + got, end - begin - got,
+				begin + got);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0 || (n & (DIRECT_IO_ALIGN - 1)))
+			break;
+		got += n;
+	}
+
+	if (got >= off + len - begin) {
+		memcpy(buf, aligned + off - begin, len);
+	} else if (got < off - begin) {
+		pool_read(shard, buf, len, off);
+	} else {
+		memcpy(buf, aligned + off - begin, got - (off - begin));
+		pool_read(shard, (unsigned char*) buf + got - (off - begin),
+				len - (got - (off - begin)), begin + got);
+	}
+	free(aligned);
+}
 
+/*
+ * Shard 0 is containers/container.pool, as in a single pool,
+ * and shard i is containers/container.pool.i,
+ * which can be a symbolic link to another disk.
+ */
+static sds shard_file_name(int i) {
 	sds containerfile = sdsdup(destor.working_directory);
 	containerfile = sdscat(containerfile, "containers/container.pool");
+	if (i > 0)
+		containerfile = sdscatprintf(containerfile, ".%d", i);
+	return containerfile;
+}
+
+void init_container_store() {
+
+	shard_num = destor.container_pool_num;
+	shards = calloc(shard_num, sizeof(struct containerShard));
 
-	if ((fp = fopen(containerfile, "r+"))) {
-		fread(&container_count, 8, 1, fp);
-	} else if (!(fp = fopen(containerfile, "w+"))) {
-        VERBOSE("container filename: %s", containerfile);
-		perror(
-				"Can not create container.pool for read and write because");
+	/* The ids would map to other shards. */
+	sds containerfile = shard_file_name(shard_num);
+	if (access(containerfile, F_OK) == 0) {
+		WARNING("%s exists, the container pool has more than %d shards",
+				containerfile, shard_num);
 		exit(1);
 	}
-
 	sdsfree(containerfile);
 
-	container_buffer = sync_queue_new(25);
+	int i;
+	for (i = 0; i < shard_num; i++) {
+		struct containerShard *shard = &shards[i];
+		containerfile = shard_file_name(i);
+
+		if ((shard->fd = open(containerfile, O_RDWR | O_CREAT, 0644)) < 0) {
+			VERBOSE("container filename: %s", containerfile);
+			perror(
+					"Can not create container.pool for read and write because");
+			exit(1);
+		}
+
+		shard->direct_fd = -1;
+		if (destor.container_direct_io
+				&& destor.simulation_level < SIMULATION_RESTORE) {
+#ifdef O_DIRECT
+			shard->direct_fd = open(containerfile, O_RDONLY | O_DIRECT);
+#endif
+			if (shard->direct_fd < 0)
+				WARNING("Direct I/O is unavailable for %s", containerfile);
+		}
+
+		sdsfree(containerfile);
+	}
 
-	pthread_mutex_init(&mutex, NULL);
+	/* Every shard keeps the count, and a new pool has no count yet. */
+	pool_read(&shards[0], &container_count, sizeof(container_count), 0);
+	if (shard_num > 1 && container_count > 0) {
+		int64_t count;
+		pool_read(&shards[shard_num - 1], &count, sizeof(count), 0);
+		if (count != container_count) {
+			WARNING("The container pool has fewer than %d shards", shard_num);
+			exit(1);
+		}
+	}
 
-	pthread_create(&append_t, NULL, append_thread, NULL);
+	/* The buffered containers are shared by shards, at least 2 each. */
+	int buffer_size = (25 + shard_num - 1) / shard_num;
+	if (buffer_size < 2)
+		buffer_size = 2;
+
+	for (i = 0; i < shard_num; i++) {
+		shards[i].container_buffer = sync_queue_new(buffer_size);
+		pthread_create(&shards[i].append_t, NULL, append_thread, &shards[i]);
+	}
 
     NOTICE("Init container store successfully");
 }
 
 void close_container_store() {
-	sync_queue_term(container_buffer);
+	int i;
+	for (i = 0; i < shard_num; i++)
+		sync_queue_term(shards[i].container_buffer);
 
-	pthread_join(append_t, NULL);
+	for (i = 0; i < shard_num; i++) {
+		pthread_join(shards[i].append_t, NULL);
+		jcr.write_time += shards[i].write_time;
+	}
 	NOTICE("append phase stops successfully!");
 
-	fseek(fp, 0, SEEK_SET);
-	fwrite(&container_count, sizeof(container_count), 1, fp);
+	for (i = 0; i < shard_num; i++) {
+		struct containerShard *shard = &shards[i];
+		pool_write(shard, &container_count, sizeof(container_count), 0);
 
-	fclose(fp);
-	fp = NULL;
+		close(shard->fd);
+		if (shard->direct_fd >= 0)
+			close(shard->direct_fd);
+	}
 
-	pthread_mutex_destroy(&mutex);
+	free_base_cache();
+
+	free(shards);
+	shards = NULL;
 }
 
 static void init_container_meta(struct containerMeta *meta) {
 	meta->chunk_num = 0;
 	meta->data_size = 0;
 	meta->id = TEMPORARY_ID;
-    
-    
-    meta->chunks = NULL;//empty list
+	meta->entries = NULL;
 	meta->map = g_hash_table_new_full(g_int_hash, (GEqualFunc)g_fingerprint_equal, NULL, NULL);
 }
 
@@ -99,6 +324,7 @@ struct container* create_container() {
 		c->data = 0;
 
 	init_container_meta(&c->meta);
+	c->meta.entries = malloc(sizeof(struct metaEntry) * CONTAINER_MAX_CHUNKS);
 	c->meta.id = container_count++;
 	return c;
 }
@@ -119,7 +345,7 @@ void write_container_async(struct container* c) {
 		return;
 	}
 
-	sync_queue_push(container_buffer, c);
+	sync_queue_push(shard_of(c->meta.id)->container_buffer, c);
 }
 
 /*
@@ -143,20 +369,23 @@ void write_container(struct container* c) {
 
 	if (destor.simulation_level < SIMULATION_APPEND) {
 
+		int compressed = container_compressed();
 		unsigned char * cur = &c->data[CONTAINER_SIZE - CONTAINER_META_SIZE];
 		ser_declare;
 		ser_begin(cur, CONTAINER_META_SIZE);
 		ser_int64(c->meta.id);
 		ser_int32(c->meta.chunk_num);
-		ser_int32(c->meta.data_size);
-        GList *le = g_list_first((c->meta.chunks));
-        for(; le; le=g_list_next(le)){
-            struct metaEntry *me = (struct metaEntry *) le->data;
-            
-            
+		ser_int32(c->meta.data_size | (compressed ? CONTAINER_COMPRESSED : 0));
+		int i;
+		for (i = 0; i < c->meta.chunk_num; i++) {
+			struct metaEntry *me = &c->meta.entries[i];
             ser_bytes(&me->fp, sizeof(fingerprint));
             ser_bytes(&me->len, sizeof(int32_t));
             ser_bytes(&me->off, sizeof(int32_t));
+            if (compressed) {
+                int32_t size = me->size | (me->codec << CODEC_SHIFT);
+                ser_bytes(&size, sizeof(int32_t));
+            }
         }
 
         
@@ -174,18 +403,8 @@ void write_container(struct container* c) {
 
 		ser_end(cur, CONTAINER_META_SIZE);
 
-		pthread_mutex_lock(&mutex);
-
-		if (fseek(fp, c->meta.id * CONTAINER_SIZE + 8, SEEK_SET) != 0) {
-			perror("Fail seek in container store.");
-			exit(1);
-		}
-		if(fwrite(c->data, CONTAINER_SIZE, 1, fp) != 1){
-			perror("Fail to write a container in container store.");
-			exit(1);
-		}
-
-		pthread_mutex_unlock(&mutex);
+		pool_write(shard_of(c->meta.id), c->data, CONTAINER_SIZE,
+				shard_index(c->meta.id) * CONTAINER_SIZE + 8);
 	} else {
 		char buf[CONTAINER_META_SIZE];
 		memset(buf, 0, CONTAINER_META_SIZE);
@@ -196,11 +415,9 @@ void write_container(struct container* c) {
 		ser_int32(c->meta.chunk_num);
 		ser_int32(c->meta.data_size);
 
-        GList *le = g_list_first((c->meta.chunks));
-        for(; le; le=g_list_next(le)){
-            struct metaEntry *me = (struct metaEntry *) le->data;
-            
-            
+		int i;
+		for (i = 0; i < c->meta.chunk_num; i++) {
+			struct metaEntry *me = &c->meta.entries[i];
             ser_bytes(&me->fp, sizeof(fingerprint));
             ser_bytes(&me->len, sizeof(int32_t));
             ser_bytes(&me->off, sizeof(int32_t));
@@ -220,18 +437,8 @@ void write_container(struct container* c) {
 
 		ser_end(buf, CONTAINER_META_SIZE);
 
-		pthread_mutex_lock(&mutex);
-
-		if(fseek(fp, c->meta.id * CONTAINER_META_SIZE + 8, SEEK_SET) != 0){
-			perror("Fail seek in container store.");
-			exit(1);
-		}
-		if(fwrite(buf, CONTAINER_META_SIZE, 1, fp) != 1){
-			perror("Fail to write a container in container store.");
-			exit(1);
-		}
-
-		pthread_mutex_unlock(&mutex);
+		pool_write(shard_of(c->meta.id), buf, CONTAINER_META_SIZE,
+				shard_index(c->meta.id) * CONTAINER_META_SIZE + 8);
 	}
 
 }
@@ -242,21 +449,106 @@ void read_data_in_container(containerid id, int off, int len, void*data){
        
     }
     else {
-        pthread_mutex_lock(&mutex);
-        
-        fseek(fp, id * CONTAINER_SIZE + 8 + off, SEEK_SET);
-        fread(data, len, 1, fp);
-        
-        pthread_mutex_unlock(&mutex);
+        pool_read_direct(shard_of(id), data, len,
+                shard_index(id) * CONTAINER_SIZE + 8 + off);
     }
 }
 
+/*
+ * The span from the first range to the last is read,
+ * with the gaps between ranges read into a scratch buffer.
+ */
+void read_ranges_in_container(containerid id, struct containerRange *ranges,
+		int n) {
+	if (destor.simulation_level >= SIMULATION_RESTORE || n == 0)
+		return;
+
+	struct containerShard *shard = shard_of(id);
+	int64_t base = shard_index(id) * CONTAINER_SIZE + 8;
+	int32_t begin = ranges[0].off;
+	int32_t end = ranges[n - 1].off + ranges[n - 1].len;
+	int i;
+
+	if (shard->direct_fd >= 0) {
+		/* O_DIRECT needs aligned buffers, so the span is read and copied. */
+		unsigned char *span = malloc(end - begin);
+		pool_read_direct(shard, span, end - begin, base + begin);
+		for (i = 0; i < n; i++)
+			memcpy(ranges[i].buf, span + ranges[i].off - begin, ranges[i].len);
+		free(span);
+		return;
+	}
+
+	int32_t gap = 0;
+	for (i = 1; i < n; i++) {
+		int32_t g = ranges[i].off - ranges[i - 1].off - ranges[i - 1].len;
+		assert(g >= 0);
+		if (g > gap)
+			gap = g;
+	}
+	unsigned char *scratch = gap > 0 ? malloc(gap) : NULL;
+
+	struct iovec *iov = malloc(sizeof(struct iovec) * (2 * n - 1));
+	int cnt = 0;
+	for (i = 0; i < n; i++) {
+		if (i > 0 && ranges[i].off > ranges[i - 1].off + ranges[i - 1].len) {
+			iov[cnt].iov_base = scratch;
+			iov[cnt].iov_len = ranges[i].off - ranges[i - 1].off
+					- ranges[i - 1].len;
+			cnt++;
+		}
+		iov[cnt].iov_base = ranges[i].buf;
+		iov[cnt].iov_len = ranges[i].len;
+		cnt++;
+	}
+	pool_readv(shard, iov, cnt, base + begin);
+
+	free(iov);
+	free(scratch);
+}
+
+
 
 
 
+/* The rest of a metaEntry, following its offset. */
+#define unser_codec(me, compressed) \
+	do { \
+		if (compressed) { \
+			int32_t size; \
+			unser_bytes(&size, sizeof(int32_t)); \
+			(me)->size = size & ((1 << CODEC_SHIFT) - 1); \
+			(me)->codec = (uint32_t) size >> CODEC_SHIFT; \
+		} else { \
+			(me)->size = (me)->len; \
+			(me)->codec = CHUNK_CODEC_NONE; \
+		} \
+	} while (0)
+
+static struct containerMeta* container_meta_duplicate(struct container *c);
+
+static struct container* container_duplicate(struct container *c) {
+	struct container* dup = (struct container*) malloc(sizeof(struct container));
+	struct containerMeta* meta = container_meta_duplicate(c);
+	dup->meta = *meta;
+	free(meta);
+
+	dup->data = 0;
+	if (c->data && destor.simulation_level < SIMULATION_RESTORE) {
+		dup->data = malloc(CONTAINER_SIZE);
+		memcpy(dup->data, c->data, CONTAINER_SIZE);
+	}
+	return dup;
+}
 
 struct container* retrieve_container_by_id(containerid id) {
-	struct container *c = (struct container*) malloc(sizeof(struct container));
+	/* A base chunk of delta compression can be in a container not written yet. */
+	struct container *c = sync_queue_find(shard_of(id)->container_buffer,
+			container_check_id, &id, container_duplicate);
+	if (c)
+		return c;
+
+	c = (struct container*) malloc(sizeof(struct container));
 
 	init_container_meta(&c->meta);
 
@@ -264,28 +556,20 @@ struct container* retrieve_container_by_id(containerid id) {
 	if (destor.simulation_level >= SIMULATION_RESTORE) {
 		c->data = malloc(CONTAINER_META_SIZE);
 
-		pthread_mutex_lock(&mutex);
-
 		if (destor.simulation_level >= SIMULATION_APPEND)
-			fseek(fp, id * CONTAINER_META_SIZE + 8, SEEK_SET);
+			pool_read(shard_of(id), c->data, CONTAINER_META_SIZE,
+					shard_index(id) * CONTAINER_META_SIZE + 8);
 		else
-			fseek(fp, (id + 1) * CONTAINER_SIZE - CONTAINER_META_SIZE + 8,
-			SEEK_SET);
-
-		fread(c->data, CONTAINER_META_SIZE, 1, fp);
-
-		pthread_mutex_unlock(&mutex);
+			pool_read(shard_of(id), c->data, CONTAINER_META_SIZE,
+					(shard_index(id) + 1) * CONTAINER_SIZE
+							- CONTAINER_META_SIZE + 8);
 
 		cur = c->data;
 	} else {
 		c->data = malloc(CONTAINER_SIZE);
 
-		pthread_mutex_lock(&mutex);
-
-		fseek(fp, id * CONTAINER_SIZE + 8, SEEK_SET);
-		fread(c->data, CONTAINER_SIZE, 1, fp);
-
-		pthread_mutex_unlock(&mutex);
+		pool_read_direct(shard_of(id), c->data, CONTAINER_SIZE,
+				shard_index(id) * CONTAINER_SIZE + 8);
 
 		cur = &c->data[CONTAINER_SIZE - CONTAINER_META_SIZE];
 	}
@@ -296,22 +580,23 @@ struct container* retrieve_container_by_id(containerid id) {
 	unser_int64(c->meta.id);
 	unser_int32(c->meta.chunk_num);
 	unser_int32(c->meta.data_size);
+	int compressed = c->meta.data_size & CONTAINER_COMPRESSED;
+	c->meta.data_size &= ~CONTAINER_COMPRESSED;
 
 	if(c->meta.id != id){
 		WARNING("expect %lld, but read %lld", id, c->meta.id);
 		assert(c->meta.id == id);
 	}
 
+	c->meta.entries = malloc(sizeof(struct metaEntry) * c->meta.chunk_num);
 	int i;
 	for (i = 0; i < c->meta.chunk_num; i++) {
-		struct metaEntry* me = (struct metaEntry*) malloc(
-				sizeof(struct metaEntry));
+		struct metaEntry* me = &c->meta.entries[i];
 		unser_bytes(&me->fp, sizeof(fingerprint));
 		unser_bytes(&me->len, sizeof(int32_t));
 		unser_bytes(&me->off, sizeof(int32_t));
-		
-	    c->meta.chunks = g_list_append(c->meta.chunks, me);
-        g_hash_table_insert(c->meta.map, &me->fp, g_list_last(c->meta.chunks));
+		unser_codec(me, compressed);
+		g_hash_table_insert(c->meta.map, &me->fp, me);
 	}
 
 	unser_end(cur, CONTAINER_META_SIZE);
@@ -333,18 +618,13 @@ static struct containerMeta* container_meta_duplicate(struct container *c) {
 	dup->chunk_num = base->chunk_num;
 	dup->data_size = base->data_size;
     
-    GList *le = g_list_first (base->chunks);
-    while(le) {
-        struct metaEntry* value =  (struct metaEntry*)le->data;
-        struct metaEntry* me = (struct metaEntry*) malloc(sizeof(struct metaEntry));
-        memcpy(me, value, sizeof(struct metaEntry));
-        
-        dup->chunks = g_list_append(dup->chunks, me);
-        g_hash_table_insert(dup->map, &me->fp, g_list_last(dup->chunks));
-        
-        le = g_list_next(le);
-    }
-    
+	dup->entries = malloc(sizeof(struct metaEntry) * base->chunk_num);
+	memcpy(dup->entries, base->entries,
+			sizeof(struct metaEntry) * base->chunk_num);
+	int i;
+	for (i = 0; i < dup->chunk_num; i++)
+		g_hash_table_insert(dup->map, &dup->entries[i].fp, &dup->entries[i]);
+
     
 //	GHashTableIter iter;
 //	gpointer key, value;
@@ -363,7 +643,7 @@ struct containerMeta* retrieve_container_meta_by_id(containerid id) {
 	struct containerMeta* cm = NULL;
 
 	/* First, we find it in the buffer */
-	cm = sync_queue_find(container_buffer, container_check_id, &id, container_meta_duplicate);
+	cm = sync_queue_find(shard_of(id)->container_buffer, container_check_id, &id, container_meta_duplicate);
 
 	if (cm)
 		return cm;
@@ -373,17 +653,13 @@ struct containerMeta* retrieve_container_meta_by_id(containerid id) {
 
 	unsigned char buf[CONTAINER_META_SIZE];
 
-	pthread_mutex_lock(&mutex);
-
 	if (destor.simulation_level >= SIMULATION_APPEND)
-		fseek(fp, id * CONTAINER_META_SIZE + 8, SEEK_SET);
+		pool_read(shard_of(id), buf, CONTAINER_META_SIZE,
+				shard_index(id) * CONTAINER_META_SIZE + 8);
 	else
-		fseek(fp, (id + 1) * CONTAINER_SIZE - CONTAINER_META_SIZE + 8,
-		SEEK_SET);
-
-	fread(buf, CONTAINER_META_SIZE, 1, fp);
-
-	pthread_mutex_unlock(&mutex);
+		pool_read(shard_of(id), buf, CONTAINER_META_SIZE,
+				(shard_index(id) + 1) * CONTAINER_SIZE - CONTAINER_META_SIZE
+						+ 8);
 
 	unser_declare;
 	unser_begin(buf, CONTAINER_META_SIZE);
@@ -391,21 +667,23 @@ struct containerMeta* retrieve_container_meta_by_id(containerid id) {
 	unser_int64(cm->id);
 	unser_int32(cm->chunk_num);
 	unser_int32(cm->data_size);
+	int compressed = cm->data_size & CONTAINER_COMPRESSED;
+	cm->data_size &= ~CONTAINER_COMPRESSED;
 
 	if(cm->id != id){
 		WARNING("expect %lld, but read %lld", id, cm->id);
 		assert(cm->id == id);
 	}
 
+	cm->entries = malloc(sizeof(struct metaEntry) * cm->chunk_num);
 	int i;
 	for (i = 0; i < cm->chunk_num; i++) {
-		struct metaEntry* me = (struct metaEntry*) malloc(sizeof(struct metaEntry));
+		struct metaEntry* me = &cm->entries[i];
 		unser_bytes(&me->fp, sizeof(fingerprint));
 		unser_bytes(&me->len, sizeof(int32_t));
 		unser_bytes(&me->off, sizeof(int32_t));
-        
-        cm->chunks = g_list_append(cm->chunks, me);
-        g_hash_table_insert(cm->map, &me->fp, g_list_last(cm->chunks));
+		unser_codec(me, compressed);
+		g_hash_table_insert(cm->map, &me->fp, me);
 	}
 
 	return cm;
@@ -413,8 +691,7 @@ struct containerMeta* retrieve_container_meta_by_id(containerid id) {
 
 static struct metaEntry* get_metaentry_in_container_meta(
 		struct containerMeta* cm, fingerprint *fp) {
-    GList* le = g_hash_table_lookup(cm->map, fp);
-	return (struct metaEntry*)le->data;
+	return g_hash_table_lookup(cm->map, fp);
 }
 
 struct chunk* get_chunk_in_container(struct container* c, fingerprint *fp) {
@@ -422,25 +699,31 @@ struct chunk* get_chunk_in_container(struct container* c, fingerprint *fp) {
 
 	assert(me);
 
-	struct chunk* ck = new_chunk(me->len);
+	struct chunk* ck = new_chunk(me->size);
 
 	if (destor.simulation_level < SIMULATION_RESTORE)
-		memcpy(ck->data, c->data + me->off, me->len);
+		decompress_chunk_data(me, c->data + me->off, ck->data);
 
-	ck->size = me->len;
+	ck->size = me->size;
 	ck->id = c->meta.id;
-	memcpy(&ck->fp, &fp, sizeof(fingerprint));
+	memcpy(&ck->fp, fp, sizeof(fingerprint));
 
 	return ck;
 }
 
+/* The bytes the chunk takes in a container. */
+int32_t chunk_stored_size(struct chunk* ck) {
+	return ck->zdata ? ck->zsize : ck->size;
+}
+
 int container_overflow(struct container* c, int32_t size) {
 	if (c->meta.data_size + size > CONTAINER_SIZE - CONTAINER_META_SIZE)
 		return 1;
 	/*
-	 * 28 is the size of metaEntry.
+	 * 28 is the size of metaEntry, and 32 with the original size.
 	 */
-	if ((c->meta.chunk_num + 1) * 28 + 16 > CONTAINER_META_SIZE)
+	int entry_size = container_compressed() ? 32 : 28;
+	if ((c->meta.chunk_num + 1) * entry_size + 16 > CONTAINER_META_SIZE)
 		return 1;
 	return 0;
 }
@@ -451,28 +734,29 @@ int container_overflow(struct container* c, int32_t size) {
  * return 0 indicates fail.
  */
 int add_chunk_to_container(struct container* c, struct chunk* ck) {
-	assert(!container_overflow(c, ck->size));
+	assert(!container_overflow(c, chunk_stored_size(ck)));
 	if (g_hash_table_contains(c->meta.map, &ck->fp)) {
 		NOTICE("Writing a chunk already in the container buffer!");
 		ck->id = c->meta.id;
 		return 0;
 	}
 
-	struct metaEntry* me = (struct metaEntry*) malloc(sizeof(struct metaEntry));
+	assert(c->meta.chunk_num < CONTAINER_MAX_CHUNKS);
+	struct metaEntry* me = &c->meta.entries[c->meta.chunk_num];
 	memcpy(&me->fp, &ck->fp, sizeof(fingerprint));
-	me->len = ck->size;
+	me->len = chunk_stored_size(ck);
 	me->off = c->meta.data_size;
+	me->size = ck->size;
+	me->codec = ck->zdata ? ck->zcodec : CHUNK_CODEC_NONE;
 
-    //update the search structures
-    c->meta.chunks = g_list_append(c->meta.chunks, me);
-    g_hash_table_insert(c->meta.map, &me->fp, g_list_last(c->meta.chunks));
-    
+	g_hash_table_insert(c->meta.map, &me->fp, me);
 	c->meta.chunk_num++;
 
 	if (destor.simulation_level < SIMULATION_APPEND)
-		memcpy(c->data + c->meta.data_size, ck->data, ck->size);
+		memcpy(c->data + c->meta.data_size, ck->zdata ? ck->zdata : ck->data,
+				me->len);
 
-	c->meta.data_size += ck->size;
+	c->meta.data_size += me->len;
 
 	ck->id = c->meta.id;
 
@@ -480,16 +764,14 @@ int add_chunk_to_container(struct container* c, struct chunk* ck) {
 }
 
 void free_container_meta(struct containerMeta* cm) {
-	g_list_free (cm->chunks);
 	g_hash_table_destroy(cm->map);
-    
+	free(cm->entries);
 	free(cm);
 }
 
 void free_container(struct container* c) {
-	g_list_free (c->meta.chunks);
 	g_hash_table_destroy(c->meta.map);
-    
+	free(c->meta.entries);
 	if (c->data)
 		free(c->data);
 	free(c);
@@ -518,6 +800,19 @@ int lookup_fingerprint_in_container(struct container* c, fingerprint *fp) {
 	return lookup_fingerprint_in_container_meta(&c->meta, fp);
 }
 
+/* For indexed caches of containers. */
+void container_meta_foreach_fingerprint(struct containerMeta* cm,
+		void (*visit)(void* fp, void* arg), void* arg) {
+	int i;
+	for (i = 0; i < cm->chunk_num; i++)
+		visit(&cm->entries[i].fp, arg);
+}
+
+void container_foreach_fingerprint(struct container* c,
+		void (*visit)(void* fp, void* arg), void* arg) {
+	container_meta_foreach_fingerprint(&c->meta, visit, arg);
+}
+
 gint g_container_cmp_desc(struct container* c1, struct container* c2,
 		gpointer user_data) {
 	return g_container_meta_cmp_desc(&c1->meta, &c2->meta, user_data);
@@ -538,10 +833,7 @@ int container_meta_check_id(struct containerMeta* cm, containerid* id) {
 
 
 void container_meta_foreach(struct containerMeta* cm, void (*func)(fingerprint*, void*), void* data){
-	GHashTableIter iter;
-	gpointer key, value;
-	g_hash_table_iter_init(&iter, cm->map);
-	while(g_hash_table_iter_next(&iter, &key, &value)){
-		func(key, data);
-	}
+	int i;
+	for (i = 0; i < cm->chunk_num; i++)
+		func(&cm->entries[i].fp, data);
 }
@@ -14,12 +14,19 @@
 #define CONTAINER_META_SIZE (32768ll) //32KB
 #define CONTAINER_HEAD 16
 #define CONTAINER_META_ENTRY 28
+/* The most chunks the metadata of a container can hold. */
+#define CONTAINER_MAX_CHUNKS \
+	((CONTAINER_META_SIZE - CONTAINER_HEAD) / CONTAINER_META_ENTRY)
 
 
 struct metaEntry {
     fingerprint fp;
+    /* the bytes in the container, compressed or not */
     int32_t len;
     int32_t off;
+    /* the original size of the chunk */
+    int32_t size;
+    int32_t codec;
 };
 
 
@@ -28,9 +35,10 @@ struct containerMeta {
 	int32_t data_size;
 	int32_t chunk_num;
 
-	/* Map fingerprints to chunk offsets. */
+	/* Map fingerprints to their entries. */
 	GHashTable *map;
-    GList  *chunks; //used in restore: meta data of chunks in container
+	/* The entries of the chunks, in the order of their offsets. */
+	struct metaEntry *entries;
 };
 
 
@@ -53,8 +61,22 @@ struct containerMeta* retrieve_container_meta_by_id_async(containerid);
 
 void read_data_in_container(containerid id, int off, int len, void*data);
 
+/* A range of data in a container, read into buf. */
+struct containerRange {
+	int32_t off;
+	int32_t len;
+	unsigned char *buf;
+};
+/*
+ * Read the ranges of container id, in ascending order of offsets,
+ * by a single vectored read.
+ */
+void read_ranges_in_container(containerid id, struct containerRange *ranges,
+		int n);
+
 struct chunk* get_chunk_in_container(struct container*, fingerprint*);
 int add_chunk_to_container(struct container*, struct chunk*);
+int32_t chunk_stored_size(struct chunk*);
 int container_overflow(struct container*, int32_t size);
 void free_container(struct container*);
 void free_container_meta(struct containerMeta*);
@@ -69,6 +91,10 @@ gint g_container_meta_cmp_desc(struct containerMeta*, struct containerMeta*,
 int lookup_fingerprint_in_chunk(struct chunk* ch, fingerprint *fp);
 int lookup_fingerprint_in_container(struct container*, fingerprint *);
 int lookup_fingerprint_in_container_meta(struct containerMeta*, fingerprint *);
+void container_meta_foreach_fingerprint(struct containerMeta* cm,
+		void (*visit)(void* fp, void* arg), void* arg);
+void container_foreach_fingerprint(struct container* c,
+		void (*visit)(void* fp, void* arg), void* arg);
 int container_check_id(struct container*, containerid*);
 int container_meta_check_id(struct containerMeta*, containerid*);
 
@@ -0,0 +1,112 @@
+/*
+ * readahead.c
+ *
+ *  The restore cache looks ahead in the recipe queue,
+ *  and submits the containers of upcoming chunks it does not cache.
+ *  A request is tagged with the last position needing it,
+ *  and dropped once the stream has passed it.
+ *  The window bounds the requests in the table,
+ *  which hold up to a container each.
+ */
+#include "readahead.h"
+#include "containerstore.h"
+#include "../utils/async_reader.h"
+
+/* How many chunks are popped ahead of the restore cache. */
+#define READAHEAD_CHUNKS 4096
+
+static struct asyncReader *readahead;
+
+/* The chunks popped ahead, the head is at head_pos of the stream. */
+static struct {
+	GQueue *chunks;
+	int64_t head_pos;
+	/* popped, but not submitted yet as the window was full */
+	struct chunk *unchecked;
+	int end;
+} lookahead;
+
+static void* read_container(int64_t id) {
+	return retrieve_container_by_id(id);
+}
+
+void init_readahead() {
+	lookahead.chunks = g_queue_new();
+	lookahead.head_pos = 0;
+	lookahead.unchecked = NULL;
+	lookahead.end = 0;
+
+	/* Only containers with data are read ahead. */
+	readahead = new_async_reader(
+			destor.simulation_level == SIMULATION_NO ?
+					destor.restore_read_thread_num : 0, read_container,
+			(void (*)(void*)) free_container);
+}
+
+void close_readahead() {
+	assert(g_queue_is_empty(lookahead.chunks) && !lookahead.unchecked);
+	g_queue_free(lookahead.chunks);
+
+	free_async_reader(readahead);
+	readahead = NULL;
+}
+
+int readahead_submit(containerid id, int64_t pos) {
+	if (!readahead)
+		return 1;
+	return async_reader_submit(readahead, id, pos,
+			destor.restore_readahead_window);
+}
+
+/* The chunks needing them were served by the cache. */
+static int passed_by_pos(int64_t tag, void *pos) {
+	return tag < *(int64_t*) pos;
+}
+
+struct container* readahead_take(containerid id, int64_t pos) {
+	struct container *con = NULL;
+	if (readahead)
+		con = async_reader_take(readahead, id, passed_by_pos, &pos);
+	if (!con)
+		con = retrieve_container_by_id(id);
+	return con;
+}
+
+struct chunk* readahead_pop(SyncQueue *recipe, int (*cached)(struct chunk*),
+		int64_t *pos) {
+	if (!readahead) {
+		*pos = lookahead.head_pos++;
+		return sync_queue_pop(recipe);
+	}
+
+	while (g_queue_get_length(lookahead.chunks) < READAHEAD_CHUNKS) {
+		struct chunk *c = lookahead.unchecked;
+		if (!c) {
+			/* Wait for the recipe only if no chunk is ready. */
+			if (lookahead.end || (!g_queue_is_empty(lookahead.chunks)
+					&& sync_queue_size(recipe) == 0))
+				break;
+			c = sync_queue_pop(recipe);
+			if (!c) {
+				lookahead.end = 1;
+				break;
+			}
+		}
+
+		int64_t cpos = lookahead.head_pos + g_queue_get_length(lookahead.chunks);
+		if (!CHECK_CHUNK(c, CHUNK_FILE_START) && !CHECK_CHUNK(c, CHUNK_FILE_END)
+				&& !cached(c) && !readahead_submit(c->id, cpos)
+				&& !g_queue_is_empty(lookahead.chunks)) {
+			/* The window is full, retry it later. */
+			lookahead.unchecked = c;
+			break;
+		}
+		lookahead.unchecked = NULL;
+		g_queue_push_tail(lookahead.chunks, c);
+	}
+
+	struct chunk *c = g_queue_pop_head(lookahead.chunks);
+	if (c)
+		*pos = lookahead.head_pos++;
+	return c;
+}
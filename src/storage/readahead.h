@@ -0,0 +1,40 @@
+/*
+ * readahead.h
+ *
+ *  Reads containers ahead for restore in a pool of reader threads,
+ *  so that several reads are in flight while chunks are assembled.
+ *  Requests are tagged with the position in the chunk stream
+ *  of the last chunk submitting the container.
+ */
+
+#ifndef READAHEAD_H_
+#define READAHEAD_H_
+
+#include "../destor.h"
+#include "../utils/sync_queue.h"
+
+void init_readahead();
+void close_readahead();
+
+/*
+ * Start reading container id, needed at pos,
+ * unless it is being read.
+ * Return 0 if the window is full.
+ */
+int readahead_submit(containerid id, int64_t pos);
+/*
+ * Return container id needed at pos, waiting for it if being read,
+ * or reading it now if never submitted.
+ * Requests needed before pos are dropped, as the stream has passed them.
+ */
+struct container* readahead_take(containerid id, int64_t pos);
+
+/*
+ * Pop the next chunk of the recipe queue, and set *pos to its position.
+ * The chunks behind it are popped ahead, and the containers
+ * of those not cached (by the restore cache) are submitted.
+ */
+struct chunk* readahead_pop(SyncQueue *recipe, int (*cached)(struct chunk*),
+		int64_t *pos);
+
+#endif /* READAHEAD_H_ */
@@ -116,7 +116,7 @@ void make_trace(char* path) {
 
 	FILE *fp = fopen(trace_file, "w");
 	while (1) {
-		struct chunk *c = sync_queue_pop(hash_queue);
+		struct chunk *c = spsc_ring_pop(hash_queue);
 
 		if (c == NULL) {
 			break;
@@ -156,7 +156,7 @@ static void* read_trace_thread(void *argv) {
 		TIMER_END(1, jcr.read_time);
 
 		if (strcmp(line, "stream end") == 0) {
-			sync_queue_term(trace_queue);
+			spsc_ring_term(trace_queue);
 			break;
 		}
 
@@ -178,7 +178,7 @@ static void* read_trace_thread(void *argv) {
 
 		TIMER_END(1, jcr.read_time);
 
-		sync_queue_push(trace_queue, c);
+		spsc_ring_push(trace_queue, c);
 
 		TIMER_BEGIN(1);
 		fgets(line, 128, trace_file);
@@ -192,7 +192,7 @@ static void* read_trace_thread(void *argv) {
 			c->size = atoi(line + 41);
 
 			TIMER_END(1, jcr.read_time);
-			sync_queue_push(trace_queue, c);
+			spsc_ring_push(trace_queue, c);
 			TIMER_BEGIN(1),
 
 			fgets(line, 128, trace_file);
@@ -200,7 +200,7 @@ static void* read_trace_thread(void *argv) {
 
 		c = new_chunk(0);
 		SET_CHUNK(c, CHUNK_FILE_END);
-		sync_queue_push(trace_queue, c);
+		spsc_ring_push(trace_queue, c);
 	}
 
 	fclose(trace_file);
@@ -213,7 +213,7 @@ extern void* read_fsl_trace(void *argv);
 void start_read_trace_phase() {
     /* running job */
     jcr.status = JCR_STATUS_RUNNING;
-	trace_queue = sync_queue_new(100);
+	trace_queue = spsc_ring_new(100);
     if(destor.trace_format == TRACE_DESTOR)
 	    pthread_create(&trace_t, NULL, read_trace_thread, NULL);
     else if(destor.trace_format == TRACE_FSL)
@@ -0,0 +1,195 @@
+/*
+ * async_reader.c
+ *
+ *  A request is owned by the table until taken or dropped,
+ *  or by its reader if dropped while being read.
+ */
+#include <stdlib.h>
+#include <pthread.h>
+#include <glib.h>
+#include "async_reader.h"
+
+struct readRequest {
+	int64_t id;
+	int64_t tag;
+	void *obj;
+	int done;
+	int discarded;
+};
+
+struct asyncReader {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/* id -> struct readRequest */
+	GHashTable *requests;
+	/* requests not yet picked by a reader */
+	GQueue *pending;
+
+	void* (*read)(int64_t id);
+	void (*free_obj)(void*);
+
+	int stop;
+	int thread_num;
+	pthread_t *threads;
+};
+
+static void* read_thread(void *arg) {
+	struct asyncReader *ar = arg;
+	pthread_mutex_lock(&ar->mutex);
+	while (1) {
+		while (!ar->stop && g_queue_is_empty(ar->pending))
+			pthread_cond_wait(&ar->cond, &ar->mutex);
+		if (g_queue_is_empty(ar->pending))
+			break;
+
+		struct readRequest *r = g_queue_pop_head(ar->pending);
+		pthread_mutex_unlock(&ar->mutex);
+
+		void *obj = ar->read(r->id);
+
+		pthread_mutex_lock(&ar->mutex);
+		if (r->discarded) {
+			ar->free_obj(obj);
+			free(r);
+		} else {
+			r->obj = obj;
+			r->done = 1;
+			pthread_cond_broadcast(&ar->cond);
+		}
+	}
+	pthread_mutex_unlock(&ar->mutex);
+	return NULL;
+}
+
+struct asyncReader* new_async_reader(int thread_num, void* (*read)(int64_t id),
+		void (*free_obj)(void*)) {
+	if (thread_num <= 0)
+		return NULL;
+
+	struct asyncReader *ar = malloc(sizeof(struct asyncReader));
+	pthread_mutex_init(&ar->mutex, NULL);
+	pthread_cond_init(&ar->cond, NULL);
+	ar->requests = g_hash_table_new(g_int64_hash, g_int64_equal);
+	ar->pending = g_queue_new();
+	ar->read = read;
+	ar->free_obj = free_obj;
+	ar->stop = 0;
+
+	ar->thread_num = thread_num;
+	ar->threads = malloc(sizeof(pthread_t) * thread_num);
+	int i;
+	for (i = 0; i < thread_num; i++)
+		pthread_create(&ar->threads[i], NULL, read_thread, ar);
+	return ar;
+}
+
+/* Called with the mutex held, after r is removed from the table. */
+static void drop_request(struct asyncReader *ar, struct readRequest *r) {
+	if (r->done) {
+		ar->free_obj(r->obj);
+		free(r);
+	} else if (g_queue_remove(ar->pending, r)) {
+		free(r);
+	} else {
+		/* The reader frees it. */
+		r->discarded = 1;
+	}
+}
+
+/* Called with the mutex held. */
+static void drop_requests(struct asyncReader *ar,
+		int (*drop)(int64_t tag, void* arg), void* arg) {
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, ar->requests);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct readRequest *r = value;
+		if (drop && !drop(r->tag, arg))
+			continue;
+		g_hash_table_iter_remove(&iter);
+		drop_request(ar, r);
+	}
+}
+
+void free_async_reader(struct asyncReader *ar) {
+	if (!ar)
+		return;
+
+	pthread_mutex_lock(&ar->mutex);
+	drop_requests(ar, NULL, NULL);
+	ar->stop = 1;
+	pthread_cond_broadcast(&ar->cond);
+	pthread_mutex_unlock(&ar->mutex);
+
+	int i;
+	for (i = 0; i < ar->thread_num; i++)
+		pthread_join(ar->threads[i], NULL);
+	free(ar->threads);
+
+	g_hash_table_destroy(ar->requests);
+	g_queue_free(ar->pending);
+	pthread_mutex_destroy(&ar->mutex);
+	pthread_cond_destroy(&ar->cond);
+	free(ar);
+}
+
+int async_reader_submit(struct asyncReader *ar, int64_t id, int64_t tag,
+		int window) {
+	int ret = 1;
+	pthread_mutex_lock(&ar->mutex);
+	struct readRequest *r = g_hash_table_lookup(ar->requests, &id);
+	if (r) {
+		if (r->tag < tag)
+			r->tag = tag;
+	} else if (window > 0 && g_hash_table_size(ar->requests) >= window) {
+		ret = 0;
+	} else {
+		r = malloc(sizeof(struct readRequest));
+		r->id = id;
+		r->tag = tag;
+		r->obj = NULL;
+		r->done = 0;
+		r->discarded = 0;
+		g_hash_table_insert(ar->requests, &r->id, r);
+		g_queue_push_tail(ar->pending, r);
+		pthread_cond_broadcast(&ar->cond);
+	}
+	pthread_mutex_unlock(&ar->mutex);
+	return ret;
+}
+
+void* async_reader_take(struct asyncReader *ar, int64_t id,
+		int (*drop)(int64_t tag, void* arg), void* arg) {
+	void *obj = NULL;
+	pthread_mutex_lock(&ar->mutex);
+	struct readRequest *r = g_hash_table_lookup(ar->requests, &id);
+	if (r)
+		g_hash_table_remove(ar->requests, &id);
+
+	if (drop)
+		drop_requests(ar, drop, arg);
+
+	if (r) {
+		if (!r->done && g_queue_remove(ar->pending, r)) {
+			/* Not picked yet, it is faster to read it here. */
+			pthread_mutex_unlock(&ar->mutex);
+			r->obj = ar->read(id);
+			pthread_mutex_lock(&ar->mutex);
+			r->done = 1;
+		}
+		while (!r->done)
+			pthread_cond_wait(&ar->cond, &ar->mutex);
+		obj = r->obj;
+		free(r);
+	}
+	pthread_mutex_unlock(&ar->mutex);
+	return obj;
+}
+
+void async_reader_drop(struct asyncReader *ar,
+		int (*drop)(int64_t tag, void* arg), void* arg) {
+	pthread_mutex_lock(&ar->mutex);
+	drop_requests(ar, drop, arg);
+	pthread_mutex_unlock(&ar->mutex);
+}
@@ -0,0 +1,45 @@
+/*
+ * async_reader.h
+ *
+ *  Reads objects by id in a pool of reader threads.
+ *  Each request is tagged by its caller,
+ *  e.g., with the position of the first chunk needing it,
+ *  and requests are dropped by a caller-supplied predicate on the tags.
+ */
+
+#ifndef ASYNC_READER_H_
+#define ASYNC_READER_H_
+
+#include <stdint.h>
+
+struct asyncReader;
+
+/*
+ * read returns the object of id, which free_obj frees.
+ * Return NULL if thread_num <= 0.
+ */
+struct asyncReader* new_async_reader(int thread_num, void* (*read)(int64_t id),
+		void (*free_obj)(void*));
+/* Drop all requests, and stop the readers. */
+void free_async_reader(struct asyncReader*);
+
+/*
+ * Start reading id, tagged with tag.
+ * If it is requested, its tag is raised to tag.
+ * Return 0 if window > 0 and window requests are in the table.
+ */
+int async_reader_submit(struct asyncReader*, int64_t id, int64_t tag,
+		int window);
+/*
+ * Return the object of id, waiting for it if being read,
+ * or reading it here if not picked by a reader yet.
+ * Return NULL if id was never submitted.
+ * The other requests that drop returns 1 for are dropped before waiting.
+ */
+void* async_reader_take(struct asyncReader*, int64_t id,
+		int (*drop)(int64_t tag, void* arg), void* arg);
+/* Drop the requests that drop returns 1 for. */
+void async_reader_drop(struct asyncReader*,
+		int (*drop)(int64_t tag, void* arg), void* arg);
+
+#endif /* ASYNC_READER_H_ */
@@ -0,0 +1,99 @@
+/*
+ * blocked_bloom.c
+ *
+ *  The layout follows the split block Bloom filter of Parquet/Impala:
+ *  8 odd salts turn the 32-bit hash into a bit index of each word.
+ *  Its false positive rate is close to a standard Bloom filter
+ *  with 8 hash functions when there are more than 16 bits per key.
+ */
+#include "blocked_bloom.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCKED_BLOOM_MAGIC 0xb10cb100
+
+/* A block is 8 words of 32 bits, two blocks share a 64-byte cache line. */
+#define BLOCK_BITS_LOG2 8
+
+static const uint32_t salt[BLOCKED_BLOOM_WORDS] = { 0x47b6137bU, 0x44974d91U,
+		0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U,
+		0x5c6bfb31U };
+
+struct blockedBloom* blocked_bloom_new(int size_log2) {
+	if (size_log2 < BLOCK_BITS_LOG2)
+		size_log2 = BLOCK_BITS_LOG2;
+
+	struct blockedBloom* bf = malloc(sizeof(struct blockedBloom));
+	bf->size_log2 = size_log2;
+	bf->block_num = 1LL << (size_log2 - BLOCK_BITS_LOG2);
+	if (posix_memalign((void**) &bf->blocks, 64,
+			bf->block_num * sizeof(*bf->blocks))) {
+		free(bf);
+		return NULL;
+	}
+	blocked_bloom_clear(bf);
+	return bf;
+}
+
+void blocked_bloom_free(struct blockedBloom* bf) {
+	free(bf->blocks);
+	free(bf);
+}
+
+void blocked_bloom_clear(struct blockedBloom* bf) {
+	memset(bf->blocks, 0, bf->block_num * sizeof(*bf->blocks));
+}
+
+static inline uint32_t* block_of(struct blockedBloom* bf, uint64_t h) {
+	/* the high bits, as the low 32 bits index the words */
+	return bf->blocks[(h >> 32) & (bf->block_num - 1)];
+}
+
+void blocked_bloom_insert(struct blockedBloom* bf, uint64_t h) {
+	uint32_t *block = block_of(bf, h);
+	int i;
+	for (i = 0; i < BLOCKED_BLOOM_WORDS; i++)
+		block[i] |= 1U << (((uint32_t) h * salt[i]) >> 27);
+}
+
+int blocked_bloom_lookup(struct blockedBloom* bf, uint64_t h) {
+	uint32_t *block = block_of(bf, h);
+	uint32_t miss = 0;
+	int i;
+	/* no early exit, the loop is vectorized */
+	for (i = 0; i < BLOCKED_BLOOM_WORDS; i++)
+		miss |= ~block[i] & (1U << (((uint32_t) h * salt[i]) >> 27));
+	return miss == 0;
+}
+
+int blocked_bloom_save(struct blockedBloom* bf, const char* path) {
+	FILE *fp = fopen(path, "w");
+	if (!fp)
+		return -1;
+
+	uint32_t header[2] = { BLOCKED_BLOOM_MAGIC, bf->size_log2 };
+	int ret = fwrite(header, sizeof(header), 1, fp) != 1
+			|| fwrite(bf->blocks, sizeof(*bf->blocks), bf->block_num, fp)
+					!= bf->block_num;
+	return fclose(fp) || ret ? -1 : 0;
+}
+
+struct blockedBloom* blocked_bloom_load(const char* path, int size_log2) {
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+
+	struct blockedBloom* bf = NULL;
+	uint32_t header[2];
+	if (fread(header, sizeof(header), 1, fp) == 1
+			&& header[0] == BLOCKED_BLOOM_MAGIC && header[1] == size_log2
+			&& (bf = blocked_bloom_new(size_log2))
+			&& fread(bf->blocks, sizeof(*bf->blocks), bf->block_num, fp)
+					!= bf->block_num) {
+		blocked_bloom_free(bf);
+		bf = NULL;
+	}
+	fclose(fp);
+	return bf;
+}
@@ -0,0 +1,38 @@
+/*
+ * blocked_bloom.h
+ *
+ *  A cache-line-blocked Bloom filter over 64-bit hashes.
+ *  The high bits of a hash select a 256-bit block,
+ *  and its low 32 bits set one bit in each of the 8 words of the block,
+ *  so a lookup touches a single cache line.
+ *  Keys cannot be removed, the filter is rebuilt instead.
+ */
+
+#ifndef BLOCKED_BLOOM_H_
+#define BLOCKED_BLOOM_H_
+
+#include <stdint.h>
+
+#define BLOCKED_BLOOM_WORDS 8
+
+struct blockedBloom {
+	/* 2^size_log2 bits */
+	int size_log2;
+	int64_t block_num;
+	uint32_t (*blocks)[BLOCKED_BLOOM_WORDS];
+};
+
+struct blockedBloom* blocked_bloom_new(int size_log2);
+void blocked_bloom_free(struct blockedBloom* bf);
+void blocked_bloom_clear(struct blockedBloom* bf);
+
+void blocked_bloom_insert(struct blockedBloom* bf, uint64_t h);
+/* Return 0 if h was never inserted. */
+int blocked_bloom_lookup(struct blockedBloom* bf, uint64_t h);
+
+/* Return 0, or -1 on failure. */
+int blocked_bloom_save(struct blockedBloom* bf, const char* path);
+/* Return NULL if path is missing or holds a filter of another size. */
+struct blockedBloom* blocked_bloom_load(const char* path, int size_log2);
+
+#endif /* BLOCKED_BLOOM_H_ */
@@ -0,0 +1,145 @@
+/*
+ * delta.c
+ *
+ *  Every window of the base is hashed into a table,
+ *  and the target is scanned for windows found in the base.
+ *  A match is extended in both directions,
+ *  and copied if long enough to pay for its instruction.
+ */
+#include "delta.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* The bytes hashed to find a match. */
+#define DELTA_WINDOW 8
+/* A shorter match is inserted as literals. */
+#define DELTA_MIN_MATCH 16
+
+struct deltaOut {
+	unsigned char *p;
+	int len;
+	int cap;
+	int overflow;
+};
+
+static inline uint32_t window_hash(const unsigned char *p, int bits) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return (v * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+}
+
+static void put_varint(struct deltaOut *o, uint64_t v) {
+	do {
+		if (o->len >= o->cap) {
+			o->overflow = 1;
+			return;
+		}
+		unsigned char b = v & 0x7f;
+		v >>= 7;
+		o->p[o->len++] = v ? b | 0x80 : b;
+	} while (v);
+}
+
+static void emit_insert(struct deltaOut *o, const unsigned char *p, int len) {
+	if (len == 0)
+		return;
+	put_varint(o, (uint64_t) len << 1);
+	if (o->overflow || o->len + len > o->cap) {
+		o->overflow = 1;
+		return;
+	}
+	memcpy(o->p + o->len, p, len);
+	o->len += len;
+}
+
+static void emit_copy(struct deltaOut *o, int off, int len) {
+	put_varint(o, (uint64_t) len << 1 | 1);
+	put_varint(o, off);
+}
+
+int delta_encode(const unsigned char *base, int base_len,
+		const unsigned char *target, int target_len, unsigned char *out,
+		int cap) {
+	struct deltaOut o = { out, 0, cap, 0 };
+
+	int bits = 8;
+	while (bits < 20 && (1 << bits) < 2 * base_len)
+		bits++;
+	int32_t *table = malloc(sizeof(int32_t) << bits);
+	memset(table, 0xff, sizeof(int32_t) << bits);
+
+	int i;
+	for (i = 0; i + DELTA_WINDOW <= base_len; i++)
+		table[window_hash(base + i, bits)] = i;
+
+	/* target[lit, pos) is not encoded yet */
+	int pos = 0, lit = 0;
+	while (pos + DELTA_WINDOW <= target_len && !o.overflow) {
+		int32_t cand = table[window_hash(target + pos, bits)];
+		if (cand >= 0 && memcmp(base + cand, target + pos, DELTA_WINDOW) == 0) {
+			int len = DELTA_WINDOW;
+			while (pos + len < target_len && cand + len < base_len
+					&& base[cand + len] == target[pos + len])
+				len++;
+			int back = 0;
+			while (pos - back > lit && cand - back > 0
+					&& base[cand - back - 1] == target[pos - back - 1])
+				back++;
+
+			if (len + back >= DELTA_MIN_MATCH) {
+				emit_insert(&o, target + lit, pos - back - lit);
+				emit_copy(&o, cand - back, len + back);
+				pos += len;
+				lit = pos;
+				continue;
+			}
+		}
+		pos++;
+	}
+	emit_insert(&o, target + lit, target_len - lit);
+
+	free(table);
+	return o.overflow ? 0 : o.len;
+}
+
+static int get_varint(const unsigned char *p, int len, int *i, uint64_t *v) {
+	int shift = 0;
+	*v = 0;
+	while (*i < len && shift < 64) {
+		unsigned char b = p[(*i)++];
+		*v |= (uint64_t) (b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return 0;
+		shift += 7;
+	}
+	return -1;
+}
+
+int delta_decode(const unsigned char *base, int base_len,
+		const unsigned char *delta, int delta_len, unsigned char *out,
+		int cap) {
+	int i = 0, n = 0;
+	while (i < delta_len) {
+		uint64_t head, off;
+		if (get_varint(delta, delta_len, &i, &head))
+			return -1;
+		uint64_t len = head >> 1;
+		if (len > cap - n)
+			return -1;
+
+		if (head & 1) {
+			if (get_varint(delta, delta_len, &i, &off) || off > base_len
+					|| len > base_len - off)
+				return -1;
+			memcpy(out + n, base + off, len);
+		} else {
+			if (len > delta_len - i)
+				return -1;
+			memcpy(out + n, delta + i, len);
+			i += len;
+		}
+		n += len;
+	}
+	return n;
+}
@@ -0,0 +1,30 @@
+/*
+ * delta.h
+ *
+ *  Delta encoding of a chunk against a resembling base chunk.
+ *  The delta is a sequence of instructions,
+ *  each a varint of (length << 1 | copy),
+ *  followed by the base offset of a copy,
+ *  or the literal bytes of an insert.
+ */
+
+#ifndef DELTA_H_
+#define DELTA_H_
+
+/*
+ * Encode target against base into out of cap bytes.
+ * Return the length of the delta, or 0 if it does not fit.
+ */
+int delta_encode(const unsigned char *base, int base_len,
+		const unsigned char *target, int target_len, unsigned char *out,
+		int cap);
+
+/*
+ * Decode delta against base into out of cap bytes.
+ * Return the length of the target, or -1 if the delta is corrupted.
+ */
+int delta_decode(const unsigned char *base, int base_len,
+		const unsigned char *delta, int delta_len, unsigned char *out,
+		int cap);
+
+#endif /* DELTA_H_ */
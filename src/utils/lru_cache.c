@@ -8,8 +8,24 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <assert.h>
 #include "lru_cache.h"
 
+/*
+ * A key of an elem in the index.
+ * The index maps a key to the first posting of its chain,
+ * and keeps the key pointer of that posting,
+ * which stays valid as long as its elem is cached.
+ */
+struct lruPosting {
+	void *key;
+	struct lruNode *node;
+	/* the next posting of the same key */
+	struct lruPosting *next_key;
+	/* the next posting of the same node */
+	struct lruPosting *next_node;
+};
+
 /*
  * The container read cache.
  */
@@ -17,7 +33,8 @@ struct lruCache* new_lru_cache(int size, void (*free_elem)(void *),
 		int (*hit_elem)(void* elem, void* user_data)) {
 	struct lruCache* c = (struct lruCache*) malloc(sizeof(struct lruCache));
 
-	c->elem_queue = NULL;
+	c->head = NULL;
+	c->tail = NULL;
 
 	c->max_size = size;
 	c->size = 0;
@@ -27,27 +44,149 @@ struct lruCache* new_lru_cache(int size, void (*free_elem)(void *),
 	c->free_elem = free_elem;
 	c->hit_elem = hit_elem;
 
+	c->index = NULL;
+	c->foreach_key = NULL;
+	c->clock = 0;
+
+	return c;
+}
+
+struct lruCache* new_indexed_lru_cache(int size, void (*free_elem)(void *),
+		int (*hit_elem)(void* elem, void* user_data),
+		void (*foreach_key)(void* elem, void (*visit)(void* key, void* arg),
+				void* arg), GHashFunc key_hash, GEqualFunc key_equal) {
+	struct lruCache* c = new_lru_cache(size, free_elem, hit_elem);
+	c->index = g_hash_table_new(key_hash, key_equal);
+	c->foreach_key = foreach_key;
 	return c;
 }
 
+struct indexVisit {
+	struct lruCache *cache;
+	struct lruNode *node;
+};
+
+static void index_key(void* key, void* arg) {
+	struct indexVisit *v = arg;
+	struct lruPosting *p = malloc(sizeof(struct lruPosting));
+	p->key = key;
+	p->node = v->node;
+	p->next_node = v->node->postings;
+	v->node->postings = p;
+
+	p->next_key = g_hash_table_lookup(v->cache->index, key);
+	g_hash_table_replace(v->cache->index, key, p);
+}
+
+static void index_node(struct lruCache* c, struct lruNode* node) {
+	if (!c->index)
+		return;
+	struct indexVisit v = { c, node };
+	c->foreach_key(node->data, index_key, &v);
+}
+
+static void unindex_node(struct lruCache* c, struct lruNode* node) {
+	struct lruPosting *p = node->postings;
+	while (p) {
+		struct lruPosting *head = g_hash_table_lookup(c->index, p->key);
+		struct lruPosting **pp = &head;
+		while (*pp != p)
+			pp = &(*pp)->next_key;
+		*pp = p->next_key;
+
+		if (head)
+			g_hash_table_replace(c->index, head->key, head);
+		else
+			g_hash_table_remove(c->index, p->key);
+
+		struct lruPosting *next = p->next_node;
+		free(p);
+		p = next;
+	}
+	node->postings = NULL;
+}
+
+static void unlink_node(struct lruCache* c, struct lruNode* node) {
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		c->head = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	else
+		c->tail = node->prev;
+}
+
+static void push_front(struct lruCache* c, struct lruNode* node) {
+	node->prev = NULL;
+	node->next = c->head;
+	if (c->head)
+		c->head->prev = node;
+	else
+		c->tail = node;
+	c->head = node;
+	node->stamp = ++c->clock;
+}
+
+/* Remove the node, and return its elem. */
+static void* remove_node(struct lruCache* c, struct lruNode* node) {
+	void *data = node->data;
+	unlink_node(c, node);
+	if (c->index)
+		unindex_node(c, node);
+	free(node);
+	c->size--;
+	return data;
+}
+
 void free_lru_cache(struct lruCache* c) {
-	g_list_free_full(c->elem_queue, c->free_elem);
+	while (c->head)
+		c->free_elem(remove_node(c, c->head));
+	if (c->index)
+		g_hash_table_destroy(c->index);
 	free(c);
 }
 
+/* The most recently used node whose elem has the key, or NULL. */
+static struct lruNode* index_lookup(struct lruCache* c, void* key) {
+	struct lruPosting *p = g_hash_table_lookup(c->index, key);
+	if (!p)
+		return NULL;
+
+	struct lruNode *node = p->node;
+	for (p = p->next_key; p; p = p->next_key)
+		if (p->node->stamp > node->stamp)
+			node = p->node;
+	return node;
+}
+
+static struct lruNode* find_node(struct lruCache* c, void* user_data) {
+	struct lruNode *node;
+	if (c->index) {
+		node = index_lookup(c, user_data);
+		/* The hit function may also account for the hit, e.g., its score. */
+		if (node && c->hit_elem) {
+			int hit = c->hit_elem(node->data, user_data);
+			assert(hit);
+		}
+		return node;
+	}
+
+	for (node = c->head; node; node = node->next)
+		if (c->hit_elem(node->data, user_data))
+			break;
+	return node;
+}
+
 /* find a item in cache matching the condition */
 void* lru_cache_lookup(struct lruCache* c, void* user_data) {
-	GList* elem = g_list_first(c->elem_queue);
-	while (elem) {
-		if (c->hit_elem(elem->data, user_data))
-			break;
-		elem = g_list_next(elem);
-	}
-	if (elem) {
-		c->elem_queue = g_list_remove_link(c->elem_queue, elem);
-		c->elem_queue = g_list_concat(elem, c->elem_queue);//move the hit segment front
+	struct lruNode *node = find_node(c, user_data);
+	if (node) {
+		//move the hit segment front
+		unlink_node(c, node);
+		push_front(c, node);
 		c->hit_count++;
-		return elem->data;
+		return node->data;
 	} else {
 		c->miss_count++;
 		return NULL;
@@ -55,33 +194,23 @@ void* lru_cache_lookup(struct lruCache* c, void* user_data) {
 }
 
 void* lru_cache_lookup_without_update(struct lruCache* c, void* user_data) {
-	GList* elem = g_list_first(c->elem_queue);
-	while (elem) {
-		if (c->hit_elem(elem->data, user_data))
-			break;
-		elem = g_list_next(elem);
-	}
-	if (elem) {
-		return elem->data;
-	} else {
-		return NULL;
-	}
+	struct lruNode *node = find_node(c, user_data);
+	return node ? node->data : NULL;
 }
+
 /*
  * Hit an existing elem for simulating an insertion of it.
  */
 void* lru_cache_hits(struct lruCache* c, void* user_data,
 		int (*hit)(void* elem, void* user_data)) {
-	GList* elem = g_list_first(c->elem_queue);
-	while (elem) {
-		if (hit(elem->data, user_data))
+	struct lruNode *node;
+	for (node = c->head; node; node = node->next)
+		if (hit(node->data, user_data))
 			break;
-		elem = g_list_next(elem);
-	}
-	if (elem) {
-		c->elem_queue = g_list_remove_link(c->elem_queue, elem);
-		c->elem_queue = g_list_concat(elem, c->elem_queue);
-		return elem->data;
+	if (node) {
+		unlink_node(c, node);
+		push_front(c, node);
+		return node->data;
 	} else {
 		return NULL;
 	}
@@ -90,44 +219,48 @@ void* lru_cache_hits(struct lruCache* c, void* user_data,
 /*
  * We know that the data does not exist!
  */
-GList* lru_cache_insert(struct lruCache *c, void* data,
+struct lruNode* lru_cache_insert(struct lruCache *c, void* data,
 		void (*func)(void*, void*), void* user_data) {
 	void *victim = 0;
-	if (c->max_size > 0 && c->size == c->max_size) {
-		GList *last = g_list_last(c->elem_queue);
-		c->elem_queue = g_list_remove_link(c->elem_queue, last);
-		victim = last->data;
-        
-		g_list_free_1(last);
-		c->size--;
-	}
+	if (c->max_size > 0 && c->size == c->max_size)
+		victim = remove_node(c, c->tail);
 
-	c->elem_queue = g_list_prepend(c->elem_queue, data);
+	struct lruNode *node = malloc(sizeof(struct lruNode));
+	node->data = data;
+	node->postings = NULL;
+	push_front(c, node);
+	index_node(c, node);
 	c->size++;
+
 	if (victim) {
 		if (func)
 			func(victim, user_data);
 		c->free_elem(victim);
 	}
-    return c->elem_queue;
+	return node;
 }
 
 void lru_cache_kicks(struct lruCache* c, void* user_data,
 		int (*func)(void* elem, void* user_data)) {
-	GList* elem = g_list_last(c->elem_queue);
-	while (elem) {
-		if (func(elem->data, user_data))
+	struct lruNode *node;
+	for (node = c->tail; node; node = node->prev)
+		if (func(node->data, user_data))
 			break;
-		elem = g_list_previous(elem);
-	}
-	if (elem) {
-		c->elem_queue = g_list_remove_link(c->elem_queue, elem);
-		c->free_elem(elem->data);
-		g_list_free_1(elem);
-		c->size--;
-	}
+	if (node)
+		c->free_elem(remove_node(c, node));
 }
 
 int lru_cache_is_full(struct lruCache* c) {
 	return c->size >= c->max_size ? 1 : 0;
 }
+
+void lru_cache_resize(struct lruCache *c, int max_size,
+		void (*func)(void*, void*), void* user_data) {
+	c->max_size = max_size;
+	while (max_size >= 0 && c->size > max_size) {
+		void *victim = remove_node(c, c->tail);
+		if (func)
+			func(victim, user_data);
+		c->free_elem(victim);
+	}
+}
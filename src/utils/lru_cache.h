@@ -1,6 +1,7 @@
 /*
  * lru_cache.h
- *	GList-based lru cache
+ *	lru cache of a doubly linked list,
+ *	optionally with an index from keys to elems
  *  Created on: May 23, 2012
  *      Author: fumin
  */
@@ -9,10 +10,25 @@
 #define Cache_H_
 #define INFI_Cache -1
 
+#include <stdint.h>
 #include <glib.h>
 
+struct lruPosting;
+
+struct lruNode {
+	void *data;
+	struct lruNode *prev;
+	struct lruNode *next;
+	/* the order of the last use, to choose among elems sharing a key */
+	uint64_t stamp;
+	/* the keys of data in the index */
+	struct lruPosting *postings;
+};
+
 struct lruCache {
-	GList *elem_queue;
+	/* head is the most recently used */
+	struct lruNode *head;
+	struct lruNode *tail;
 
 	int max_size; // less then zero means infinite cache
 	int size;
@@ -22,10 +38,29 @@ struct lruCache {
 
 	void (*free_elem)(void *);
 	int (*hit_elem)(void* elem, void* user_data);
+
+	/*
+	 * Maps each key of the cached elems to their nodes,
+	 * so lru_cache_lookup does not scan the cache.
+	 * NULL if the cache is not indexed.
+	 */
+	GHashTable *index;
+	void (*foreach_key)(void* elem, void (*visit)(void* key, void* arg),
+			void* arg);
+	uint64_t clock;
 };
 
 struct lruCache* new_lru_cache(int size, void (*free_elem)(void *),
 		int (*hit_elem)(void* elem, void* user_data));
+/*
+ * foreach_key visits the keys of an elem, which user_data of
+ * lru_cache_lookup is compared to by key_equal.
+ * The keys must not change while the elem is cached.
+ */
+struct lruCache* new_indexed_lru_cache(int size, void (*free_elem)(void *),
+		int (*hit_elem)(void* elem, void* user_data),
+		void (*foreach_key)(void* elem, void (*visit)(void* key, void* arg),
+				void* arg), GHashFunc key_hash, GEqualFunc key_equal);
 void free_lru_cache(struct lruCache*);
 void* lru_cache_lookup(struct lruCache*, void* user_data);
 void* lru_cache_lookup_without_update(struct lruCache* c, void* user_data);
@@ -34,8 +69,15 @@ void* lru_cache_hits(struct lruCache* c, void* user_data,
 /* Kick the elem that makes func returning 1. */
 void lru_cache_kicks(struct lruCache* c, void* user_data,
 		int (*func)(void* elem, void* user_data));
-GList* lru_cache_insert(struct lruCache *c, void* data,
+struct lruNode* lru_cache_insert(struct lruCache *c, void* data,
 		void (*victim)(void*, void*), void* user_data);
 int lru_cache_is_full(struct lruCache*);
+/*
+ * Set the max size, and evict the least recently used elems beyond it,
+ * calling func on each victim before it is freed as lru_cache_insert does.
+ * A max_size of 0 empties the cache.
+ */
+void lru_cache_resize(struct lruCache *c, int max_size,
+		void (*func)(void*, void*), void* user_data);
 
 #endif /* Cache_H_ */
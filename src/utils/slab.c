@@ -0,0 +1,146 @@
+#include "slab.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Block sizes (header included) are 32, 48 and 64 B,
+ * then four classes per power of two (80, 96, 112, 128, 160, ...),
+ * which wastes at most 25% for variable-sized chunks.
+ */
+#define SLAB_CLASSES 72
+/* Classes up to this size are carved from slabs; larger ones are malloc'ed one by one. */
+#define SLAB_CARVE_MAX 4096
+#define SLAB_SIZE (256 * 1024)
+
+struct slabCache;
+
+/* Precedes every block, and keeps the payload 16-byte aligned. */
+struct slabHeader {
+	struct slabCache *owner;
+	int32_t cls;
+	int32_t pad;
+};
+
+/* A free block links to the next one in its payload. */
+struct slabFree {
+	struct slabHeader h;
+	struct slabFree *next;
+};
+
+/*
+ * Only the owner thread touches local,
+ * other threads push freed blocks onto remote,
+ * which the owner takes over as a whole when local runs out.
+ * Taking the whole stack at once avoids the ABA problem.
+ */
+struct slabCache {
+	struct slabFree *local[SLAB_CLASSES];
+	struct slabFree *remote[SLAB_CLASSES];
+};
+
+/*
+ * A cache lives as long as the process,
+ * since its blocks may still be in flight when its thread exits.
+ */
+static __thread struct slabCache *cache;
+
+/* Set by slab_init(), the default is class 42, blocks of 64 KB. */
+static int max_cls = 42;
+
+static inline int size_class(size_t size) {
+	size_t total = size + sizeof(struct slabHeader);
+	if (total <= 64)
+		return total <= 32 ? 0 : (total + 15) / 16 - 2;
+
+	int k = 63 - __builtin_clzll(total - 1);
+	int sub = ((total - 1) >> (k - 2)) & 3;
+	return 3 + (k - 6) * 4 + sub;
+}
+
+static inline size_t class_size(int cls) {
+	if (cls < 3)
+		return 32 + cls * 16;
+	int k = 6 + (cls - 3) / 4;
+	int sub = (cls - 3) % 4;
+	return (size_t) (5 + sub) << (k - 2);
+}
+
+void slab_init(size_t max_size) {
+	int cls = size_class(max_size);
+	max_cls = cls < SLAB_CLASSES ? cls : SLAB_CLASSES - 1;
+}
+
+static void refill(struct slabCache *c, int cls) {
+	size_t bsize = class_size(cls);
+
+	/* blocks freed by other threads first */
+	c->local[cls] = __atomic_exchange_n(&c->remote[cls], NULL,
+			__ATOMIC_ACQUIRE);
+	if (c->local[cls])
+		return;
+
+	if (bsize > SLAB_CARVE_MAX) {
+		struct slabFree *f = malloc(bsize);
+		f->next = NULL;
+		c->local[cls] = f;
+		return;
+	}
+
+	char *slab = malloc(SLAB_SIZE);
+	size_t off;
+	for (off = 0; off + bsize <= SLAB_SIZE; off += bsize) {
+		struct slabFree *f = (struct slabFree*) (slab + off);
+		f->next = c->local[cls];
+		c->local[cls] = f;
+	}
+}
+
+void* slab_alloc(size_t size) {
+	int cls = size_class(size);
+
+	if (cls > max_cls) {
+		struct slabHeader *h = malloc(sizeof(struct slabHeader) + size);
+		h->owner = NULL;
+		h->cls = -1;
+		return h + 1;
+	}
+
+	if (cache == NULL)
+		cache = calloc(1, sizeof(struct slabCache));
+
+	if (cache->local[cls] == NULL)
+		refill(cache, cls);
+
+	struct slabFree *f = cache->local[cls];
+	cache->local[cls] = f->next;
+
+	f->h.owner = cache;
+	f->h.cls = cls;
+	return &f->h + 1;
+}
+
+void slab_free(void* p) {
+	if (p == NULL)
+		return;
+
+	struct slabHeader *h = (struct slabHeader*) p - 1;
+	if (h->cls < 0) {
+		free(h);
+		return;
+	}
+
+	struct slabCache *owner = h->owner;
+	struct slabFree *f = (struct slabFree*) h;
+	int cls = h->cls;
+
+	if (owner == cache) {
+		f->next = owner->local[cls];
+		owner->local[cls] = f;
+		return;
+	}
+
+	f->next = __atomic_load_n(&owner->remote[cls], __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&owner->remote[cls], &f->next, f, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
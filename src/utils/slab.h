@@ -0,0 +1,19 @@
+/*
+ * slab.h
+ *
+ *  Per-thread size-classed pools for chunk headers and payloads.
+ *  A block may be freed by any thread;
+ *  it is handed back to the pool of the thread that allocated it.
+ */
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stddef.h>
+
+/* Blocks larger than max_size bypass the pools. */
+void slab_init(size_t max_size);
+void* slab_alloc(size_t size);
+void slab_free(void* p);
+
+#endif /* SLAB_H_ */
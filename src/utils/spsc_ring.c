@@ -0,0 +1,184 @@
+#include "spsc_ring.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ * A waiting side spins up to spin iterations before parking.
+ * The budget grows when spinning succeeds and shrinks when it fails,
+ * so an idle phase quickly falls back to sleeping.
+ */
+#define SPSC_SPIN_MIN 16
+#define SPSC_SPIN_MAX 4096
+
+#define LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+SpscRing* spsc_ring_new(int size) {
+	SpscRing *ring;
+	if (posix_memalign((void**) &ring, SPSC_CACHELINE, sizeof(SpscRing))) {
+		puts("Failed to allocate SpscRing!");
+		return NULL;
+	}
+
+	ring->capacity = 1;
+	while (ring->capacity < size)
+		ring->capacity <<= 1;
+	ring->mask = ring->capacity - 1;
+	ring->items = malloc(sizeof(void*) * ring->capacity);
+
+	ring->tail = ring->cached_head = 0;
+	ring->head = ring->cached_tail = 0;
+	ring->push_spin = ring->pop_spin = SPSC_SPIN_MIN;
+	ring->term = 0;
+	ring->waiters = 0;
+
+	if (pthread_mutex_init(&ring->mutex, 0)
+			|| pthread_cond_init(&ring->cond, 0)) {
+		puts("Failed to init mutex or cond in SpscRing!");
+		return NULL;
+	}
+	return ring;
+}
+
+void spsc_ring_free(SpscRing* ring, void (*free_data)(void*)) {
+	if (free_data) {
+		int64_t i;
+		for (i = ring->head; i < ring->tail; i++)
+			free_data(ring->items[i & ring->mask]);
+	}
+	pthread_mutex_destroy(&ring->mutex);
+	pthread_cond_destroy(&ring->cond);
+	free(ring->items);
+	free(ring);
+}
+
+/*
+ * Wake up the other side if it is parked.
+ * The fence orders our publication before reading waiters,
+ * pairing with the one in park().
+ */
+static inline void wake(SpscRing* ring) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->waiters, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&ring->mutex);
+		pthread_cond_broadcast(&ring->cond);
+		pthread_mutex_unlock(&ring->mutex);
+	}
+}
+
+static inline int can_push(SpscRing* ring) {
+	if (ring->tail - ring->cached_head < ring->capacity)
+		return 1;
+	ring->cached_head = LOAD_ACQUIRE(&ring->head);
+	return ring->tail - ring->cached_head < ring->capacity;
+}
+
+static inline int can_pop(SpscRing* ring) {
+	if (ring->cached_tail > ring->head)
+		return 1;
+	ring->cached_tail = LOAD_ACQUIRE(&ring->tail);
+	return ring->cached_tail > ring->head
+			|| __atomic_load_n(&ring->term, __ATOMIC_ACQUIRE);
+}
+
+static void park(SpscRing* ring, int (*ready)(SpscRing*)) {
+	pthread_mutex_lock(&ring->mutex);
+	__atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while (!ready(ring))
+		pthread_cond_wait(&ring->cond, &ring->mutex);
+	__atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&ring->mutex);
+}
+
+static void wait_until(SpscRing* ring, int (*ready)(SpscRing*), int *spin) {
+	int i;
+	for (i = 0; i < *spin; i++) {
+		cpu_relax();
+		if (ready(ring)) {
+			if (*spin < SPSC_SPIN_MAX)
+				*spin <<= 1;
+			return;
+		}
+	}
+	if (*spin > SPSC_SPIN_MIN)
+		*spin >>= 1;
+	park(ring, ready);
+}
+
+void spsc_ring_push_batch(SpscRing* ring, void** items, int n) {
+	if (__atomic_load_n(&ring->term, __ATOMIC_ACQUIRE))
+		return;
+
+	while (n > 0) {
+		if (!can_push(ring))
+			wait_until(ring, can_push, &ring->push_spin);
+
+		int64_t tail = ring->tail;
+		int64_t room = ring->capacity - (tail - ring->cached_head);
+		int num = n < room ? n : room;
+		int i;
+		for (i = 0; i < num; i++)
+			ring->items[(tail + i) & ring->mask] = items[i];
+		STORE_RELEASE(&ring->tail, tail + num);
+		wake(ring);
+
+		items += num;
+		n -= num;
+	}
+}
+
+void spsc_ring_push(SpscRing* ring, void* item) {
+	spsc_ring_push_batch(ring, &item, 1);
+}
+
+/*
+ * Pop at most n items, waiting only if the ring is empty.
+ * Return 0 if the ring is terminated and empty.
+ */
+int spsc_ring_pop_batch(SpscRing* ring, void** items, int n) {
+	if (!can_pop(ring))
+		wait_until(ring, can_pop, &ring->pop_spin);
+
+	int64_t head = ring->head;
+	int64_t avail = ring->cached_tail - head;
+	if (avail == 0) {
+		/* terminated; recheck items pushed before the term */
+		ring->cached_tail = LOAD_ACQUIRE(&ring->tail);
+		avail = ring->cached_tail - head;
+		if (avail == 0)
+			return 0;
+	}
+
+	int num = n < avail ? n : avail;
+	int i;
+	for (i = 0; i < num; i++)
+		items[i] = ring->items[(head + i) & ring->mask];
+	STORE_RELEASE(&ring->head, head + num);
+	wake(ring);
+
+	return num;
+}
+
+/*
+ * Return NULL if the ring is terminated and empty.
+ */
+void* spsc_ring_pop(SpscRing* ring) {
+	void *item;
+	return spsc_ring_pop_batch(ring, &item, 1) ? item : NULL;
+}
+
+void spsc_ring_term(SpscRing* ring) {
+	__atomic_store_n(&ring->term, 1, __ATOMIC_RELEASE);
+	wake(ring);
+}
+
+int spsc_ring_size(SpscRing* ring) {
+	return LOAD_ACQUIRE(&ring->tail) - LOAD_ACQUIRE(&ring->head);
+}
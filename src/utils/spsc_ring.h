@@ -0,0 +1,50 @@
+/*
+ * spsc_ring.h
+ *
+ *  A bounded lock-free ring for exactly one producer and one consumer,
+ *  used between the backup phases.
+ *  It has the same term semantics as SyncQueue:
+ *  pushing into a terminated ring is ignored,
+ *  and popping returns NULL once the ring is terminated and empty.
+ */
+
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define SPSC_CACHELINE 64
+
+typedef struct {
+	/* producer side */
+	int64_t tail __attribute__((aligned(SPSC_CACHELINE)));
+	int64_t cached_head;
+	int push_spin;
+
+	/* consumer side */
+	int64_t head __attribute__((aligned(SPSC_CACHELINE)));
+	int64_t cached_tail;
+	int pop_spin;
+
+	int term __attribute__((aligned(SPSC_CACHELINE)));
+	int64_t capacity;
+	int64_t mask;
+	void **items;
+
+	/* for parking after spinning */
+	int waiters;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} SpscRing;
+
+SpscRing* spsc_ring_new(int size);
+void spsc_ring_free(SpscRing* ring, void (*free_data)(void*));
+void spsc_ring_push(SpscRing* ring, void* item);
+void spsc_ring_push_batch(SpscRing* ring, void** items, int n);
+void* spsc_ring_pop(SpscRing* ring);
+int spsc_ring_pop_batch(SpscRing* ring, void** items, int n);
+void spsc_ring_term(SpscRing* ring);
+int spsc_ring_size(SpscRing* ring);
+
+#endif /* SPSC_RING_H_ */